@@ -0,0 +1,110 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "job_allocator.h"
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+// Counts heap allocations made by the submitting thread so the cost of one submit() can be measured.
+static thread_local long long allocation_count = 0;
+
+void* operator new(std::size_t size)
+{
+    allocation_count++;
+
+    if (void* memory = std::malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+// submit() as it was implemented before the fused task_job: packaged_task + std::function + job
+template <typename F>
+std::future<int> legacySubmit(std::shared_ptr<thread_pool>& pool, F&& func)
+{
+    auto task = std::make_shared<std::packaged_task<int()>>(std::forward<F>(func));
+    auto future = task->get_future();
+
+    std::function<void()> work = [task]() mutable { (*task)(); };
+    pool->addJob(std::make_shared<job>(job_priority::NORMAL_PRIORITY, work));
+
+    return future;
+}
+
+template <typename Submit>
+void runCase(const char* name, int iterations, Submit submit)
+{
+    std::vector<std::future<int>> futures;
+    futures.reserve(iterations);
+
+    long long allocations_before = allocation_count;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++)
+    {
+        futures.push_back(submit(i));
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    long long allocations = allocation_count - allocations_before;
+
+    long long sum = 0;
+    for (auto& future : futures)
+    {
+        sum += future.get();
+    }
+
+    double ns_per_submit = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+
+    std::cout << name << ": " << (double)allocations / iterations << " allocations/submit, "
+              << ns_per_submit << " ns/submit (checksum " << sum << ")" << std::endl;
+}
+
+int main()
+{
+    const int iterations = 200000;
+
+    auto pool = std::make_shared<thread_pool>();
+
+    for (int i = 0; i < 2; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    runCase("legacy packaged_task submit", iterations, [&pool](int value) {
+        return legacySubmit(pool, [value]() { return value; });
+    });
+
+    runCase("task_job submit", iterations, [&pool](int value) {
+        return pool->submit([value]() { return value; });
+    });
+
+    std::cout << "slab memory before trim: " << job_allocator::getReservedBytes() << " bytes" << std::endl;
+    pool->trimJobMemory();
+    std::cout << "slab memory after trim: " << job_allocator::getReservedBytes() << " bytes" << std::endl;
+
+    pool->stopPool(true);
+
+    return 0;
+}
@@ -0,0 +1,565 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+// Microbenchmarks for thread_pool. Every case runs a fixed amount of work (after a warm-up round)
+// and the results are written as one JSON document so runs of different commits can be diffed.
+//
+// usage: thread_pool_bench [--workers N] [--repeat N] [--quick] [--output file.json]
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_options
+{
+    int max_workers = 0;
+    int repeat = 3;
+    bool quick = false;
+    std::string output;
+};
+
+struct bench_result
+{
+    std::string name;
+    int workers = 0;
+    std::vector<std::pair<std::string, double>> metrics;
+};
+
+static long long nanosSince(bench_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count();
+}
+
+static double percentile(std::vector<long long>& samples, double fraction)
+{
+    if (samples.empty())
+    {
+        return 0.0;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t index = std::min(samples.size() - 1, (size_t)(fraction * (double)(samples.size() - 1) + 0.5));
+
+    return (double)samples[index];
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+static std::shared_ptr<thread_pool> makePool(int high_workers, int normal_workers, int low_workers)
+{
+    auto pool = std::make_shared<thread_pool>();
+
+    for (int i = 0; i < high_workers; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::HIGH_PRIORITY));
+    }
+
+    for (int i = 0; i < normal_workers; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    }
+
+    for (int i = 0; i < low_workers; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::LOW_PRIORITY));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    return pool;
+}
+
+static void waitFor(std::atomic<long long>& counter, long long target)
+{
+    long long current = counter.load();
+
+    while (current < target)
+    {
+        counter.wait(current);
+        current = counter.load();
+    }
+}
+
+// jobs/s for jobs that do nothing, submitted one by one from the main thread
+static bench_result emptyJobThroughput(int workers, int jobs, int repeat)
+{
+    std::vector<double> rates;
+
+    for (int round = 0; round <= repeat; round++)
+    {
+        auto pool = makePool(0, workers, 0);
+        std::atomic<long long> done { 0 };
+
+        auto start = bench_clock::now();
+
+        for (int i = 0; i < jobs; i++)
+        {
+            pool->addJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&done, jobs]() {
+                if (done.fetch_add(1) + 1 == jobs)
+                {
+                    done.notify_all();
+                }
+            }));
+        }
+
+        waitFor(done, jobs);
+        long long elapsed = nanosSince(start);
+
+        pool->stopPool(true);
+
+        // round 0 is the warm-up
+        if (round > 0)
+        {
+            rates.push_back((double)jobs * 1e9 / (double)elapsed);
+        }
+    }
+
+    return { "empty_job_throughput", workers, { { "jobs", (double)jobs }, { "jobs_per_second", median(rates) } } };
+}
+
+// time from addJob() until the job starts, one job in flight at a time so workers are parked
+static bench_result submitToStartLatency(int workers, int samples_count)
+{
+    auto pool = makePool(0, workers, 0);
+    std::vector<long long> samples;
+    samples.reserve(samples_count);
+
+    for (int i = 0; i < samples_count + samples_count / 10; i++)
+    {
+        std::atomic<long long> started { 0 };
+        auto submit_time = bench_clock::now();
+
+        pool->addJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&started, submit_time]() {
+            started.store(nanosSince(submit_time));
+            started.notify_all();
+        }));
+
+        started.wait(0);
+
+        // the first 10% are warm-up
+        if (i >= samples_count / 10)
+        {
+            samples.push_back(started.load());
+        }
+
+        // give the worker time to park again
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    pool->stopPool(true);
+
+    return { "submit_to_start_latency", workers,
+        { { "samples", (double)samples.size() },
+          { "p50_ns", percentile(samples, 0.50) },
+          { "p90_ns", percentile(samples, 0.90) },
+          { "p99_ns", percentile(samples, 0.99) },
+          { "max_ns", percentile(samples, 1.0) } } };
+}
+
+// one root job fans out into children which each fan out again, fan-in through a counter
+static bench_result fanOutFanIn(int workers, int width, int repeat, bool work_stealing)
+{
+    std::vector<double> rates;
+    long long leaves = (long long)width * width;
+
+    for (int round = 0; round <= repeat; round++)
+    {
+        auto pool = makePool(0, workers, 0);
+        pool->setWorkStealing(work_stealing);
+
+        std::atomic<long long> done { 0 };
+        thread_pool* raw_pool = pool.get();
+
+        auto start = bench_clock::now();
+
+        pool->addJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [raw_pool, width, leaves, &done]() {
+            for (int i = 0; i < width; i++)
+            {
+                raw_pool->addJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [raw_pool, width, leaves, &done]() {
+                    std::vector<std::shared_ptr<job>> children;
+
+                    for (int j = 0; j < width; j++)
+                    {
+                        children.push_back(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [leaves, &done]() {
+                            if (done.fetch_add(1) + 1 == leaves)
+                            {
+                                done.notify_all();
+                            }
+                        }));
+                    }
+
+                    raw_pool->addJobs(children);
+                }));
+            }
+        }));
+
+        waitFor(done, leaves);
+        long long elapsed = nanosSince(start);
+
+        pool->stopPool(true);
+
+        if (round > 0)
+        {
+            rates.push_back((double)leaves * 1e9 / (double)elapsed);
+        }
+    }
+
+    return { work_stealing ? "fan_out_fan_in_work_stealing" : "fan_out_fan_in", workers,
+        { { "leaf_jobs", (double)leaves }, { "jobs_per_second", median(rates) } } };
+}
+
+// HIGH/NORMAL/LOW jobs submitted interleaved to a pool with one worker per priority plus extra
+// normal workers; reports the queueing latency of each priority
+static bench_result mixedPriority(int workers, int jobs)
+{
+    int normal_workers = std::max(1, workers - 2);
+    auto pool = makePool(1, normal_workers, 1);
+
+    std::vector<long long> latencies[3];
+    std::mutex latency_mutex;
+    std::atomic<long long> done { 0 };
+
+    for (int i = 0; i < jobs; i++)
+    {
+        job_priority priority = (job_priority)(i % 3);
+        auto submit_time = bench_clock::now();
+
+        pool->addJob(thread_pool::make_job(priority, [&, priority, submit_time]() {
+            long long latency = nanosSince(submit_time);
+
+            // a little work so the queues actually build up
+            volatile int sink = 0;
+            for (int spin = 0; spin < 2000; spin++)
+            {
+                sink = sink + spin;
+            }
+
+            {
+                std::lock_guard<std::mutex> locker(latency_mutex);
+                latencies[priority].push_back(latency);
+            }
+
+            if (done.fetch_add(1) + 1 == jobs)
+            {
+                done.notify_all();
+            }
+        }));
+    }
+
+    waitFor(done, jobs);
+
+    pool_metrics_snapshot metrics = pool->snapshot();
+    pool->stopPool(true);
+
+    const char* names[3] = { "high", "normal", "low" };
+    bench_result result { "mixed_priority", normal_workers + 2, { { "jobs", (double)jobs } } };
+
+    for (int i = 0; i < 3; i++)
+    {
+        result.metrics.push_back({ std::string(names[i]) + "_p50_ns", percentile(latencies[i], 0.50) });
+        result.metrics.push_back({ std::string(names[i]) + "_p99_ns", percentile(latencies[i], 0.99) });
+
+        // the pool's own wait-time histogram, bucketed to powers of two
+        result.metrics.push_back({ std::string(names[i]) + "_pool_wait_p99_ns", (double)metrics.priorities[i].wait_time.percentileNs(0.99) });
+    }
+
+    return result;
+}
+
+// sustained NORMAL flood with a trickle of LOW jobs while the only LOW worker is stuck in a long
+// background job. NORMAL workers always find NORMAL work first, so without the starvation watchdog
+// the LOW jobs wait until the flood ends.
+static bench_result starvation(int workers, int duration_ms, bool aging)
+{
+    int normal_workers = std::max(1, workers - 1);
+
+    // LOW worker alone first, so it is the one that picks up the long job
+    auto pool = makePool(0, 0, 1);
+    std::shared_ptr<job_manager> manager = pool->getJobManager().lock();
+
+    if (aging)
+    {
+        pool->setStarvationThreshold(std::chrono::milliseconds(10));
+    }
+
+    std::atomic<long long> done { 0 };
+    long long submitted = 0;
+
+    auto spin_job = [&done]() {
+        volatile int sink = 0;
+        for (int spin = 0; spin < 20000; spin++)
+        {
+            sink = sink + spin;
+        }
+
+        done.fetch_add(1);
+        done.notify_all();
+    };
+
+    auto end_time = bench_clock::now() + std::chrono::milliseconds(duration_ms);
+
+    pool->addJob(thread_pool::make_job(job_priority::LOW_PRIORITY, [&done, end_time]() {
+        std::this_thread::sleep_until(end_time);
+
+        done.fetch_add(1);
+        done.notify_all();
+    }));
+    submitted++;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    for (int i = 0; i < normal_workers; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    while (bench_clock::now() < end_time)
+    {
+        if (manager->getAllJobCount() > 2000)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+
+        std::vector<std::shared_ptr<job>> batch;
+
+        for (int i = 0; i < 500; i++)
+        {
+            batch.push_back(thread_pool::make_job(job_priority::NORMAL_PRIORITY, spin_job));
+        }
+
+        batch.push_back(thread_pool::make_job(job_priority::LOW_PRIORITY, spin_job));
+
+        pool->addJobs(batch);
+        submitted += (long long)batch.size();
+    }
+
+    waitFor(done, submitted);
+
+    pool_metrics_snapshot metrics = pool->snapshot();
+    const priority_metrics_snapshot& low = metrics.priorities[job_priority::LOW_PRIORITY];
+
+    pool->stopPool(true);
+
+    return { aging ? "starvation_aging" : "starvation", normal_workers + 1,
+        { { "duration_ms", (double)duration_ms },
+          { "low_jobs", (double)low.executed - 1 },
+          { "low_promoted", (double)low.promoted },
+          { "low_wait_p50_ns", (double)low.wait_time.percentileNs(0.50) },
+          { "low_wait_p99_ns", (double)low.wait_time.percentileNs(0.99) },
+          { "low_wait_max_ns", (double)low.wait_time.max_ns } } };
+}
+
+// a burst of sleeping NORMAL jobs pushed one by one while a busy-spinning HIGH worker is idle and the
+// NORMAL workers are parked. The burst should spread over every worker, not queue up behind the spinner.
+static bench_result burstWhileSpinning(int workers, int jobs, int repeat)
+{
+    int normal_workers = std::max(1, workers - 1);
+    std::vector<double> elapsed_ms;
+
+    for (int round = 0; round <= repeat; round++)
+    {
+        auto pool = makePool(1, normal_workers, 0);
+        pool->setWaitStrategy(job_priority::HIGH_PRIORITY, wait_strategy::busySpin());
+
+        // let the NORMAL workers park
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        std::atomic<long long> done { 0 };
+
+        auto start = bench_clock::now();
+
+        for (int i = 0; i < jobs; i++)
+        {
+            pool->addJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&done, jobs]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+                if (done.fetch_add(1) + 1 == jobs)
+                {
+                    done.notify_all();
+                }
+            }));
+        }
+
+        waitFor(done, jobs);
+        long long elapsed = nanosSince(start);
+
+        pool->stopPool(true);
+
+        if (round > 0)
+        {
+            elapsed_ms.push_back((double)elapsed / 1e6);
+        }
+    }
+
+    // 2ms per job spread over every worker, the spinner included
+    double ideal_ms = 2.0 * (double)((jobs + normal_workers) / (normal_workers + 1));
+
+    return { "burst_while_spinning", normal_workers + 1,
+        { { "jobs", (double)jobs }, { "elapsed_ms", median(elapsed_ms) }, { "ideal_ms", ideal_ms } } };
+}
+
+// throughput of small compute jobs as the worker count grows
+static bench_result scaling(int workers, int jobs, int repeat)
+{
+    std::vector<double> rates;
+
+    for (int round = 0; round <= repeat; round++)
+    {
+        auto pool = makePool(0, workers, 0);
+        std::atomic<long long> done { 0 };
+        std::vector<std::shared_ptr<job>> batch;
+
+        for (int i = 0; i < jobs; i++)
+        {
+            batch.push_back(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&done, jobs]() {
+                volatile double sink = 1.0;
+                for (int spin = 0; spin < 5000; spin++)
+                {
+                    sink = sink * 1.0000001;
+                }
+
+                if (done.fetch_add(1) + 1 == jobs)
+                {
+                    done.notify_all();
+                }
+            }));
+        }
+
+        auto start = bench_clock::now();
+
+        pool->addJobs(batch);
+        waitFor(done, jobs);
+
+        long long elapsed = nanosSince(start);
+
+        pool->stopPool(true);
+
+        if (round > 0)
+        {
+            rates.push_back((double)jobs * 1e9 / (double)elapsed);
+        }
+    }
+
+    return { "scaling", workers, { { "jobs", (double)jobs }, { "jobs_per_second", median(rates) } } };
+}
+
+static std::string toJson(const std::vector<bench_result>& results, int hardware_threads)
+{
+    std::ostringstream json;
+
+    json << "{\n  \"benchmark\": \"thread_pool_bench\",\n";
+    json << "  \"hardware_threads\": " << hardware_threads << ",\n";
+    json << "  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        json << "    { \"name\": \"" << results[i].name << "\", \"workers\": " << results[i].workers;
+
+        for (const auto& metric : results[i].metrics)
+        {
+            json << ", \"" << metric.first << "\": " << std::fixed << metric.second;
+        }
+
+        json << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    json << "  ]\n}\n";
+
+    return json.str();
+}
+
+static bench_options parseOptions(int argc, char** argv)
+{
+    bench_options options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        {
+            options.max_workers = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            options.repeat = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            options.quick = true;
+        }
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            options.output = argv[++i];
+        }
+        else
+        {
+            std::cerr << "usage: thread_pool_bench [--workers N] [--repeat N] [--quick] [--output file.json]" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    return options;
+}
+
+int main(int argc, char** argv)
+{
+    bench_options options = parseOptions(argc, argv);
+
+    int hardware_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    int max_workers = options.max_workers > 0 ? options.max_workers : hardware_threads;
+    int scale = options.quick ? 10 : 1;
+
+    std::vector<bench_result> results;
+
+    results.push_back(emptyJobThroughput(max_workers, 200000 / scale, options.repeat));
+    results.push_back(submitToStartLatency(max_workers, 2000 / scale));
+    results.push_back(fanOutFanIn(max_workers, 300 / (options.quick ? 3 : 1), options.repeat, false));
+    results.push_back(fanOutFanIn(max_workers, 300 / (options.quick ? 3 : 1), options.repeat, true));
+    results.push_back(mixedPriority(std::max(3, max_workers), 30000 / scale));
+    results.push_back(starvation(max_workers, 1000 / scale, false));
+    results.push_back(starvation(max_workers, 1000 / scale, true));
+    results.push_back(burstWhileSpinning(std::max(4, max_workers), 200 / (options.quick ? 5 : 1), options.repeat));
+
+    for (int workers = 1; workers <= max_workers; workers *= 2)
+    {
+        results.push_back(scaling(workers, 20000 / scale, options.repeat));
+
+        if (workers < max_workers && workers * 2 > max_workers)
+        {
+            results.push_back(scaling(max_workers, 20000 / scale, options.repeat));
+        }
+    }
+
+    std::string json = toJson(results, hardware_threads);
+
+    if (options.output.empty())
+    {
+        std::cout << json;
+    }
+    else
+    {
+        std::ofstream file(options.output);
+        file << json;
+        std::cout << "results written to " << options.output << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,256 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+using namespace std::chrono_literals;
+
+// a pool with one worker, held by a gate job until the gate opens, so the jobs added meanwhile stay queued
+class gated_pool
+{
+public:
+    gated_pool()
+        : pool(std::make_shared<thread_pool>())
+    {
+        this->pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        this->pool->setWorkersPriorityNumbers();
+
+        std::shared_future<void> opened = this->_gate.get_future().share();
+        this->pool->submit([opened]() { opened.wait(); });
+    }
+
+    void open()
+    {
+        this->_gate.set_value();
+    }
+
+    std::shared_ptr<thread_pool> pool;
+
+private:
+    std::promise<void> _gate;
+};
+
+// a job with an id whose future tells whether it ran
+static std::shared_ptr<task_job<int, std::function<int()>>> makeTask(unsigned long long job_id, int result)
+{
+    auto task = thread_pool::make_job<task_job<int, std::function<int()>>>(job_priority::NORMAL_PRIORITY, std::function<int()>([result]() { return result; }));
+    task->setJobId(job_id);
+
+    return task;
+}
+
+// 1 when the future fails with job_cancelled_error
+static int cancelledResult(std::future<int>& future)
+{
+    try
+    {
+        future.get();
+    }
+    catch (const job_cancelled_error&)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// a job cancelled by its handle fails its future right away, without waiting for a worker
+static bool checkCancelByHandle()
+{
+    gated_pool gated;
+
+    auto task = makeTask(0, 1);
+    auto future = task->getFuture();
+    job_handle handle = gated.pool->addJob(task);
+
+    bool cancelled = handle.cancel();
+    bool failed_at_once = future.wait_for(0ms) == std::future_status::ready;
+    bool cancelled_twice = handle.cancel();
+
+    gated.open();
+    int failed = cancelledResult(future);
+    gated.pool->stopPool(true);
+
+    std::cout << "handle: cancel " << (cancelled ? "succeeded" : "FAILED") << ", future " << (failed_at_once ? "failed at once" : "NOT READY")
+              << ", a second cancel " << (cancelled_twice ? "SUCCEEDED" : "failed") << std::endl;
+
+    return cancelled && failed_at_once && !cancelled_twice && failed == 1;
+}
+
+// cancelJob() drops the jobs queued with the id before the call, not jobs of other ids or pushed after it
+static bool checkCancelById()
+{
+    gated_pool gated;
+
+    std::vector<std::future<int>> cancelled_futures;
+
+    for (int i = 0; i < 5; i++)
+    {
+        auto task = makeTask(7, i);
+        cancelled_futures.push_back(task->getFuture());
+        gated.pool->addJob(task);
+    }
+
+    auto other_task = makeTask(8, 8);
+    auto other_future = other_task->getFuture();
+    gated.pool->addJob(other_task);
+
+    gated.pool->cancelJob(7);
+
+    auto late_task = makeTask(7, 70);
+    auto late_future = late_task->getFuture();
+    gated.pool->addJob(late_task);
+
+    gated.open();
+
+    int failed = 0;
+
+    for (auto& future : cancelled_futures)
+    {
+        failed += cancelledResult(future);
+    }
+
+    bool others_ran = other_future.get() == 8 && late_future.get() == 70;
+    gated.pool->stopPool(true);
+
+    std::cout << "id: " << failed << " of 5 futures failed with job_cancelled_error, other id and later push "
+              << (others_ran ? "ran" : "DID NOT RUN") << std::endl;
+
+    return failed == 5 && others_ran;
+}
+
+// token.cancel() drops every queued job carrying a copy of the token
+static bool checkCancelByToken()
+{
+    gated_pool gated;
+
+    cancellation_token token;
+    std::vector<std::future<int>> futures;
+
+    for (int i = 0; i < 5; i++)
+    {
+        futures.push_back(gated.pool->submit(token, [i]() { return i; }));
+    }
+
+    auto kept_future = gated.pool->submit([]() { return 1; });
+
+    token.cancel();
+    gated.open();
+
+    int failed = 0;
+
+    for (auto& future : futures)
+    {
+        failed += cancelledResult(future);
+    }
+
+    bool kept_ran = kept_future.get() == 1;
+    gated.pool->stopPool(true);
+
+    std::cout << "token: " << failed << " of 5 futures failed with job_cancelled_error, a job without the token "
+              << (kept_ran ? "ran" : "DID NOT RUN") << std::endl;
+
+    return failed == 5 && kept_ran;
+}
+
+// with work stealing on, stopPool(false) also cancels a job left in a worker's own deque
+static bool checkStopCancelsLocalDeque()
+{
+    auto pool = std::make_shared<thread_pool>();
+    pool->setWorkStealing(true);
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    pool->setWorkersPriorityNumbers();
+
+    std::promise<std::future<int>> parked;
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+
+    // added from inside a job, the inner job goes to the worker's deque, then the worker is held
+    pool->submit([pool, &parked, opened]() {
+        parked.set_value(pool->submit([]() { return 1; }));
+        opened.wait();
+    });
+
+    std::future<int> future = parked.get_future().get();
+
+    // the worker stops after the gate job, so the inner job is left in its deque
+    std::thread stopper([pool]() { pool->stopPool(false); });
+
+    while (!pool->isTerminated())
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+
+    std::this_thread::sleep_for(50ms);
+    gate.set_value();
+    stopper.join();
+
+    bool failed_at_stop = future.wait_for(0ms) == std::future_status::ready;
+    int failed = failed_at_stop ? cancelledResult(future) : 0;
+    int in_flight = pool->getInFlightJobCount();
+
+    std::cout << "stop: a job in a worker's deque " << (failed == 1 ? "failed with job_cancelled_error" : "WAS NOT CANCELLED") << ", "
+              << in_flight << " jobs left in flight" << std::endl;
+
+    return failed == 1 && in_flight == 0;
+}
+
+// many jobs sharing one id cost nothing extra to push, run or cancel
+static bool checkSharedId()
+{
+    const int job_count = 50000;
+
+    gated_pool gated;
+    std::atomic_int jobs_run { 0 };
+
+    auto started = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < job_count; i++)
+        {
+            gated.pool->addJob(thread_pool::make_job(1ull, [&jobs_run]() { jobs_run++; }));
+        }
+
+        // the first round is cancelled behind the gate, the second one runs
+        if (round == 0)
+        {
+            gated.pool->cancelJob(1);
+            gated.open();
+        }
+    }
+
+    gated.pool->wait_idle();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    gated.pool->stopPool(true);
+
+    std::cout << "shared id: " << jobs_run.load() << " of " << job_count << " uncancelled jobs ran, " << 2 * job_count << " jobs of one id took "
+              << elapsed.count() << "ms" << std::endl;
+
+    return jobs_run.load() == job_count && elapsed < 5s;
+}
+
+int main()
+{
+    std::cout << "Cancel Sample Application" << std::endl;
+
+    bool ok = true;
+
+    ok = checkCancelByHandle() && ok;
+    ok = checkCancelById() && ok;
+    ok = checkCancelByToken() && ok;
+    ok = checkStopCancelsLocalDeque() && ok;
+    ok = checkSharedId() && ok;
+
+    std::cout << (ok ? "all cancel checks passed" : "cancel checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
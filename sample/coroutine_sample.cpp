@@ -0,0 +1,154 @@
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "task.h"
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+// a request handler that hops onto the pool, then awaits a sub-task at HIGH priority
+task<int> lookup(std::shared_ptr<thread_pool> pool, int key)
+{
+    co_await pool->schedule(job_priority::HIGH_PRIORITY);
+    co_return key * key;
+}
+
+task<int> handleRequest(std::shared_ptr<thread_pool> pool, int request_id)
+{
+    co_await pool->schedule(job_priority::NORMAL_PRIORITY);
+
+    int first = co_await lookup(pool, request_id);
+    int second = co_await lookup(pool, request_id + 1);
+
+    co_return first + second;
+}
+
+// a sub-task that fails after hopping onto the pool
+task<int> failingLookup(std::shared_ptr<thread_pool> pool)
+{
+    co_await pool->schedule(job_priority::HIGH_PRIORITY);
+    throw std::runtime_error("lookup failed");
+}
+
+// catches the sub-task's exception at its co_await, then rethrows it to the caller
+task<int> handleFailingRequest(std::shared_ptr<thread_pool> pool, bool& caught)
+{
+    co_await pool->schedule(job_priority::NORMAL_PRIORITY);
+
+    try
+    {
+        co_return co_await failingLookup(pool);
+    }
+    catch (const std::runtime_error&)
+    {
+        caught = true;
+    }
+
+    co_return co_await failingLookup(pool);
+}
+
+task<std::thread::id> workerThreadId(std::shared_ptr<thread_pool> pool)
+{
+    co_await pool->schedule(job_priority::NORMAL_PRIORITY);
+    co_return std::this_thread::get_id();
+}
+
+// one request waited for on this thread, then a thousand in flight on two worker threads
+static bool checkResults(const std::shared_ptr<thread_pool>& pool)
+{
+    int single = sync_wait(handleRequest(pool, 3));
+    bool on_worker = sync_wait(workerThreadId(pool)) != std::this_thread::get_id();
+
+    std::vector<std::future<int>> responses;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        responses.push_back(start_task(handleRequest(pool, i)));
+    }
+
+    long long total = 0;
+
+    for (auto& response : responses)
+    {
+        total += response.get();
+    }
+
+    // sum of i^2 + (i + 1)^2 for i in [0, 1000)
+    std::cout << "request 3 -> " << single << ", 1000 requests, total = " << total << ", resumed " << (on_worker ? "on a worker" : "ON THE CALLER")
+              << std::endl;
+
+    return single == 25 && total == 666667000 && on_worker;
+}
+
+// an exception thrown on a worker reaches the co_await of the awaiting task, and sync_wait() rethrows it
+static bool checkException(const std::shared_ptr<thread_pool>& pool)
+{
+    bool caught = false;
+    std::string error;
+
+    try
+    {
+        sync_wait(handleFailingRequest(pool, caught));
+    }
+    catch (const std::runtime_error& e)
+    {
+        error = e.what();
+    }
+
+    std::cout << "exception: caught at co_await " << (caught ? "yes" : "NO") << ", sync_wait() " << (error.empty() ? "DID NOT THROW" : "threw \"" + error + "\"")
+              << std::endl;
+
+    return caught && error == "lookup failed";
+}
+
+// co_await schedule() on a stopped pool resumes right away and throws
+static bool checkTerminatedPool()
+{
+    auto pool = std::make_shared<thread_pool>();
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    pool->setWorkersPriorityNumbers();
+    pool->stopPool(true);
+
+    bool threw = false;
+
+    try
+    {
+        sync_wait(workerThreadId(pool));
+    }
+    catch (const std::runtime_error&)
+    {
+        threw = true;
+    }
+
+    std::cout << "terminated: schedule() on a stopped pool " << (threw ? "threw" : "DID NOT THROW") << std::endl;
+
+    return threw;
+}
+
+int main()
+{
+    std::cout << "Coroutine Sample Application" << std::endl;
+
+    auto pool = std::make_shared<thread_pool>();
+
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::HIGH_PRIORITY));
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    pool->setWorkersPriorityNumbers();
+
+    bool ok = true;
+
+    ok = checkResults(pool) && ok;
+    ok = checkException(pool) && ok;
+
+    pool->stopPool(true);
+
+    ok = checkTerminatedPool() && ok;
+
+    std::cout << (ok ? "all coroutine checks passed" : "coroutine checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
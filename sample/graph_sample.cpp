@@ -0,0 +1,250 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "job_graph.h"
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+using namespace std::chrono_literals;
+
+static std::shared_ptr<thread_pool> makePool(int worker_count)
+{
+    auto pool = std::make_shared<thread_pool>();
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    return pool;
+}
+
+// load -> (parse_a, parse_b) -> merge: the merge sees both halves, each parse sees the whole load
+static bool checkDiamond(const std::shared_ptr<thread_pool>& pool)
+{
+    std::vector<int> input;
+    int sum_a = 0;
+    int sum_b = 0;
+    int total = 0;
+    std::atomic_int parse_saw_load { 0 };
+
+    job_graph graph;
+
+    auto load = graph.add([&input]() {
+        for (int i = 1; i <= 100; i++)
+        {
+            input.push_back(i);
+        }
+    });
+
+    auto parse_a = graph.add([&input, &sum_a, &parse_saw_load]() {
+        parse_saw_load += input.size() == 100 ? 1 : 0;
+
+        for (int i = 0; i < 50; i++)
+        {
+            sum_a += input[i];
+        }
+    }).after(load);
+
+    auto parse_b = graph.add([&input, &sum_b, &parse_saw_load]() {
+        parse_saw_load += input.size() == 100 ? 1 : 0;
+
+        for (int i = 50; i < 100; i++)
+        {
+            sum_b += input[i];
+        }
+    }).after(load);
+
+    graph.when_all({ parse_a, parse_b }, [&sum_a, &sum_b, &total]() {
+        total = sum_a + sum_b;
+    });
+
+    pool->submitGraph(graph).get();
+
+    std::cout << "merge: " << sum_a << " + " << sum_b << " = " << total << ", " << parse_saw_load.load() << " of 2 parses saw the whole load" << std::endl;
+
+    return total == 5050 && sum_a == 1275 && parse_saw_load.load() == 2;
+}
+
+// a failing node skips everything that depends on it, independent nodes still run, and get() throws
+static bool checkFailure(const std::shared_ptr<thread_pool>& pool)
+{
+    std::atomic_int dependent_ran { 0 };
+    std::atomic_int independent_ran { 0 };
+
+    job_graph graph;
+
+    auto fetch = graph.add([]() {
+        throw std::runtime_error("fetch failed");
+    });
+
+    auto dependent = graph.add([&dependent_ran]() { dependent_ran++; }).after(fetch);
+    graph.add([&dependent_ran]() { dependent_ran++; }).after(dependent);
+    graph.add([&independent_ran]() { independent_ran++; });
+
+    std::string error;
+
+    try
+    {
+        pool->submitGraph(graph).get();
+    }
+    catch (const std::runtime_error& e)
+    {
+        error = e.what();
+    }
+
+    std::cout << "failure: get() " << (error.empty() ? "DID NOT THROW" : "threw \"" + error + "\"") << ", " << dependent_ran.load()
+              << " dependent and " << independent_ran.load() << " independent nodes ran" << std::endl;
+
+    return error == "fetch failed" && dependent_ran.load() == 0 && independent_ran.load() == 1;
+}
+
+// a node job cancelled through its handle before its node runs is skipped, and so are its successors
+static bool checkCancelledNode(const std::shared_ptr<thread_pool>& pool)
+{
+    std::atomic_int ran { 0 };
+
+    job_graph graph;
+
+    auto cancelled_job = thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&ran]() { ran++; });
+    job_handle handle(cancelled_job);
+
+    auto cancelled = graph.add(cancelled_job);
+    graph.add([&ran]() { ran++; }).after(cancelled);
+
+    bool cancel_ok = handle.cancel();
+    bool threw = false;
+
+    try
+    {
+        pool->submitGraph(graph).get();
+    }
+    catch (const job_cancelled_error&)
+    {
+        threw = true;
+    }
+
+    std::cout << "cancelled node: cancel " << (cancel_ok ? "succeeded" : "FAILED") << ", get() " << (threw ? "threw job_cancelled_error" : "DID NOT THROW")
+              << ", " << ran.load() << " nodes ran" << std::endl;
+
+    return cancel_ok && threw && ran.load() == 0;
+}
+
+// the children of one root run at the same time on separate workers, and the join runs after all of them
+static bool checkFanOut(const std::shared_ptr<thread_pool>& pool, int width)
+{
+    std::atomic_int arrived { 0 };
+    std::atomic_int met { 0 };
+    std::atomic_int finished { 0 };
+    int finished_at_join = -1;
+
+    job_graph graph;
+
+    auto root = graph.add([]() {});
+    std::vector<job_graph::node> children;
+
+    for (int i = 0; i < width; i++)
+    {
+        children.push_back(graph.add([&arrived, &met, &finished, width]() {
+            arrived++;
+
+            auto deadline = std::chrono::steady_clock::now() + 2s;
+
+            while (arrived.load() < width && std::chrono::steady_clock::now() < deadline)
+            {
+                std::this_thread::yield();
+            }
+
+            met += arrived.load() == width ? 1 : 0;
+            finished++;
+        }).after(root));
+    }
+
+    graph.when_all(children, [&finished, &finished_at_join]() {
+        finished_at_join = finished.load();
+    });
+
+    pool->submitGraph(graph).get();
+
+    std::cout << "fan-out: " << met.load() << " of " << width << " children ran at once, the join saw " << finished_at_join << " finished" << std::endl;
+
+    return met.load() == width && finished_at_join == width;
+}
+
+// layers of nodes, each after every node of the layer before: no node starts before its predecessors finished
+static bool checkLayeredOrder(const std::shared_ptr<thread_pool>& pool)
+{
+    const int layers = 20;
+    const int width = 8;
+
+    std::vector<std::atomic_int> done(layers);
+    std::atomic_int early { 0 };
+    std::atomic_int ran { 0 };
+
+    job_graph graph;
+    std::vector<job_graph::node> previous;
+
+    for (int layer = 0; layer < layers; layer++)
+    {
+        std::vector<job_graph::node> current;
+
+        for (int i = 0; i < width; i++)
+        {
+            auto node = graph.add([&done, &early, &ran, layer, width]() {
+                if (layer > 0 && done[layer - 1].load() != width)
+                {
+                    early++;
+                }
+
+                ran++;
+                done[layer]++;
+            });
+
+            if (!previous.empty())
+            {
+                node.after(previous);
+            }
+
+            current.push_back(node);
+        }
+
+        previous = current;
+    }
+
+    pool->submitGraph(graph).get();
+
+    std::cout << "layers: " << ran.load() << " of " << layers * width << " nodes ran, " << early.load() << " before their predecessors" << std::endl;
+
+    return ran.load() == layers * width && early.load() == 0;
+}
+
+int main()
+{
+    std::cout << "Job Graph Sample Application" << std::endl;
+
+    // no job ever waits on another job's future, the workers only let nodes run side by side
+    const int worker_count = 4;
+    auto pool = makePool(worker_count);
+
+    bool ok = true;
+
+    ok = checkDiamond(pool) && ok;
+    ok = checkFailure(pool) && ok;
+    ok = checkCancelledNode(pool) && ok;
+    ok = checkFanOut(pool, worker_count) && ok;
+    ok = checkLayeredOrder(pool) && ok;
+
+    pool->stopPool(true);
+
+    std::cout << (ok ? "all graph checks passed" : "graph checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
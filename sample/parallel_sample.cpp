@@ -0,0 +1,47 @@
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "parallel.h"
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+int main()
+{
+    std::cout << "Parallel Algorithms Sample Application" << std::endl;
+
+    auto pool = std::make_shared<thread_pool>();
+
+    for (int i = 0; i < 4; i++)
+    {
+        auto worker = std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY);
+        pool->addWorker(worker);
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    // parallel_for: the calling thread works on chunks together with the pool workers
+    std::vector<double> scores(1000000);
+
+    parallel_for(pool, (size_t)0, scores.size(), [&scores](size_t i) {
+        scores[i] = std::sqrt((double)i);
+    });
+
+    assert(scores[144] == 12.0);
+
+    // parallel_reduce: partial results are combined in index order
+    long long sum = parallel_reduce(pool, 0LL, 1000000LL, 0LL,
+        [](long long i) { return i; },
+        [](long long left, long long right) { return left + right; });
+
+    assert(sum == 499999500000LL);
+
+    std::cout << "scores[144] = " << scores[144] << std::endl;
+    std::cout << "sum of [0, 1000000) = " << sum << std::endl;
+
+    pool->stopPool(true);
+
+    return 0;
+}
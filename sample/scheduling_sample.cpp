@@ -0,0 +1,847 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <thread>
+#include <vector>
+
+#include "deadline_queue.h"
+#include "flow_queue.h"
+#include "job_queue.h"
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+// a job that only carries its number in the job id
+static std::shared_ptr<job> numberedJob(unsigned long long number)
+{
+    return std::make_shared<job>(number, []() {});
+}
+
+// a numbered job due `offset` from a common base time
+static std::shared_ptr<job> deadlineJob(unsigned long long number, std::chrono::steady_clock::time_point base, std::chrono::milliseconds offset)
+{
+    std::shared_ptr<job> new_job = numberedJob(number);
+    new_job->setDeadline(base + offset);
+
+    return new_job;
+}
+
+// a job of a flow, numbered by its flow id
+static std::shared_ptr<job> flowJob(unsigned long long flow_id, int weight)
+{
+    std::shared_ptr<job> new_job = numberedJob(flow_id);
+    new_job->setFlow(flow_id, weight);
+
+    return new_job;
+}
+
+// a pool with one worker, held by a gate job until the gate opens, so the jobs added meanwhile stay queued
+class gated_pool
+{
+public:
+    gated_pool()
+        : pool(std::make_shared<thread_pool>())
+    {
+        this->pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        this->pool->setWorkersPriorityNumbers();
+
+        this->close();
+    }
+
+    // hold the worker with a new gate job; returns once it runs, so it holds no queue slot
+    void close()
+    {
+        this->_gate = std::promise<void>();
+
+        std::promise<void> started;
+        std::future<void> running = started.get_future();
+        std::shared_future<void> opened = this->_gate.get_future().share();
+
+        this->pool->submit([opened, &started]() {
+            started.set_value();
+            opened.wait();
+        });
+
+        running.wait();
+    }
+
+    void open()
+    {
+        this->_gate.set_value();
+    }
+
+    std::shared_ptr<thread_pool> pool;
+
+private:
+    std::promise<void> _gate;
+};
+
+// one producer, more jobs than the ring holds: the spilled jobs come back in push order
+static bool checkQueueOverflowOrder()
+{
+    job_queue queue(8);
+    const int job_count = 100;
+
+    for (int i = 0; i < job_count; i++)
+    {
+        queue.push(numberedJob(i));
+    }
+
+    bool in_order = queue.size() == job_count;
+
+    for (int i = 0; i < job_count; i++)
+    {
+        std::shared_ptr<job> popped = queue.pop();
+        in_order = in_order && popped != nullptr && popped->getJobId() == (unsigned long long)i;
+    }
+
+    in_order = in_order && queue.pop() == nullptr && queue.empty();
+
+    std::cout << "job_queue: " << job_count << " jobs through a ring of " << queue.getRingCapacity() << (in_order ? " in order" : " OUT OF ORDER") << std::endl;
+
+    return in_order;
+}
+
+// producers and consumers at once on a small ring: every job is taken exactly once
+static bool checkQueueExactlyOnce()
+{
+    job_queue queue(16);
+
+    const int producers = 4;
+    const int consumers = 4;
+    const int jobs_per_producer = 20000;
+    const int job_count = producers * jobs_per_producer;
+
+    std::vector<std::atomic_int> taken(job_count);
+    std::atomic_int popped { 0 };
+    std::vector<std::thread> threads;
+
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&queue, p, jobs_per_producer]() {
+            for (int i = 0; i < jobs_per_producer; i++)
+            {
+                queue.push(numberedJob((unsigned long long)p * jobs_per_producer + i));
+            }
+        });
+    }
+
+    for (int c = 0; c < consumers; c++)
+    {
+        threads.emplace_back([&queue, &taken, &popped, job_count]() {
+            while (popped.load() < job_count)
+            {
+                std::shared_ptr<job> next = queue.pop();
+
+                if (next == nullptr)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                taken[next->getJobId()]++;
+                popped++;
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    int wrong = 0;
+
+    for (auto& count : taken)
+    {
+        wrong += count.load() != 1 ? 1 : 0;
+    }
+
+    std::cout << "job_queue: " << popped.load() << " of " << job_count << " jobs popped, " << wrong << " lost or taken twice" << std::endl;
+
+    return wrong == 0 && queue.empty();
+}
+
+// a batch is queued in one call, every job of it runs once and each future gets its own element's result
+static bool checkBulkSubmit()
+{
+    auto pool = std::make_shared<thread_pool>();
+
+    for (int i = 0; i < 4; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    std::vector<int> inputs;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        inputs.push_back(i);
+    }
+
+    auto futures = pool->submit_bulk(job_priority::NORMAL_PRIORITY, inputs.begin(), inputs.end(), [](int value) { return value * value; });
+
+    bool results_ok = futures.size() == inputs.size();
+
+    for (int i = 0; i < (int)futures.size(); i++)
+    {
+        results_ok = results_ok && futures[i].get() == i * i;
+    }
+
+    std::atomic_int batch_runs { 0 };
+    std::vector<std::shared_ptr<job>> batch;
+
+    for (int i = 0; i < 500; i++)
+    {
+        batch.push_back(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&batch_runs]() { batch_runs++; }));
+    }
+
+    pool->addJobs(batch);
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    // a batch for a stopped pool is cancelled as a whole
+    auto late_futures = pool->submit_bulk(job_priority::NORMAL_PRIORITY, inputs.begin(), inputs.begin() + 10, [](int value) { return value; });
+    int late_failed = 0;
+
+    for (auto& future : late_futures)
+    {
+        try
+        {
+            future.get();
+        }
+        catch (const std::exception&)
+        {
+            late_failed++;
+        }
+    }
+
+    std::cout << "bulk: " << futures.size() << " submit_bulk results " << (results_ok ? "right" : "WRONG") << ", " << batch_runs.load()
+              << " of " << batch.size() << " addJobs jobs ran, " << late_failed << " of 10 failed on a stopped pool" << std::endl;
+
+    return results_ok && batch_runs.load() == (int)batch.size() && late_failed == 10;
+}
+
+// jobs leave a deadline_queue earliest deadline first, and in push order on equal deadlines
+static bool checkDeadlineOrder()
+{
+    deadline_queue queue;
+    auto base = std::chrono::steady_clock::now() + std::chrono::hours(1);
+
+    // numbered in the order they must come out
+    queue.push(deadlineJob(4, base, std::chrono::milliseconds(30)));
+    queue.push(deadlineJob(0, base, std::chrono::milliseconds(10)));
+    queue.push(deadlineJob(5, base, std::chrono::milliseconds(40)));
+    queue.push(deadlineJob(1, base, std::chrono::milliseconds(20)));
+    queue.push(deadlineJob(2, base, std::chrono::milliseconds(20)));
+    queue.push(deadlineJob(3, base, std::chrono::milliseconds(20)));
+
+    const int job_count = 6;
+    bool in_order = queue.size() == job_count;
+
+    for (int i = 0; i < job_count; i++)
+    {
+        std::shared_ptr<job> popped = queue.pop();
+        in_order = in_order && popped != nullptr && popped->getJobId() == (unsigned long long)i;
+    }
+
+    in_order = in_order && queue.pop() == nullptr && queue.empty() && queue.getEarliestDeadline() == 0;
+
+    std::cout << "deadline_queue: " << job_count << " jobs " << (in_order ? "earliest deadline first, FIFO on ties" : "OUT OF ORDER") << std::endl;
+
+    return in_order;
+}
+
+// 1 when the future fails with job_cancelled_error
+static int cancelledResult(std::future<int>& future)
+{
+    try
+    {
+        future.get();
+    }
+    catch (const job_cancelled_error&)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// a missed deadline drops a DROP job (cancelled, slot released, counted out) and still runs a RUN job;
+// both count as deadline_missed
+static bool checkDeadlineMissed()
+{
+    gated_pool gated;
+
+    gated.pool->setQueueCapacity(job_priority::NORMAL_PRIORITY, 3, overflow_policy::REJECT);
+
+    auto dropped_first = gated.pool->submit(job_deadline::after(std::chrono::milliseconds(1), deadline_policy::DROP), []() { return 1; });
+    auto dropped_second = gated.pool->submit(job_deadline::after(std::chrono::milliseconds(1), deadline_policy::DROP), []() { return 2; });
+    auto late_run = gated.pool->submit(job_deadline::after(std::chrono::milliseconds(1), deadline_policy::RUN), []() { return 3; });
+
+    // the level is full: a fourth job is rejected right away
+    auto rejected = gated.pool->submit(job_deadline::after(std::chrono::hours(1), deadline_policy::DROP), []() { return 4; });
+    bool full = rejected.wait_for(std::chrono::seconds(0)) == std::future_status::ready && cancelledResult(rejected) == 1;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    gated.open();
+
+    int dropped = cancelledResult(dropped_first) + cancelledResult(dropped_second);
+    bool ran_late = late_run.get() == 3;
+
+    gated.pool->wait_idle();
+    int in_flight = gated.pool->getInFlightJobCount();
+
+    // the dropped jobs gave their slots back: behind a new gate, the level takes three jobs again
+    gated.close();
+
+    int refilled = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        refilled += gated.pool->tryAddJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, []() {})) ? 1 : 0;
+    }
+
+    gated.open();
+    gated.pool->wait_idle();
+
+    uint64_t missed = gated.pool->snapshot().priorities[job_priority::NORMAL_PRIORITY].deadline_missed;
+    gated.pool->stopPool(true);
+
+    std::cout << "deadline: " << dropped << " of 2 DROP jobs cancelled, RUN job " << (ran_late ? "ran" : "DID NOT RUN") << ", " << in_flight
+              << " in flight after, " << refilled << " of 3 slots free again, " << missed << " deadlines missed" << std::endl;
+
+    return full && dropped == 2 && ran_late && in_flight == 0 && refilled == 3 && missed == 3;
+}
+
+// backlogged flows are served in proportion to their weights, a light flow that joins a heavy backlog
+// gets its turn within a round, and a flow's state goes as soon as its last job is taken
+static bool checkFlowFairness()
+{
+    flow_queue queue;
+
+    for (int i = 0; i < 300; i++)
+    {
+        queue.push(flowJob(1, 3));
+        queue.push(flowJob(2, 1));
+    }
+
+    int served[3] = { 0, 0, 0 };
+
+    for (int i = 0; i < 200; i++)
+    {
+        served[queue.pop()->getJobId()]++;
+    }
+
+    bool weighted = served[1] == 150 && served[2] == 50;
+
+    // five jobs of a light flow behind 300 queued jobs: a round of weights 3 + 1 + 1 is 5 pops
+    for (int i = 0; i < 5; i++)
+    {
+        queue.push(flowJob(3, 1));
+    }
+
+    int active_weight = queue.getActiveWeight();
+    int light_served = 0;
+    int pops = 0;
+
+    while (light_served < 5 && pops < 100)
+    {
+        light_served += queue.pop()->getJobId() == 3 ? 1 : 0;
+        pops++;
+    }
+
+    bool light_served_soon = light_served == 5 && pops <= 25;
+
+    while (queue.pop() != nullptr)
+    {
+    }
+
+    bool released = queue.empty() && queue.getActiveWeight() == 0;
+
+    std::cout << "flow_queue: weights 3:1 served " << served[1] << ":" << served[2] << ", a light flow's 5 jobs out within " << pops
+              << " pops (active weight " << active_weight << "), active weight " << queue.getActiveWeight() << " once drained" << std::endl;
+
+    return weighted && light_served_soon && active_weight == 5 && released;
+}
+
+// jobs without a flow take one turn per round of the active flows instead of waiting for them all
+static bool checkUntaggedTurns()
+{
+    gated_pool gated;
+
+    // only the single worker writes it, wait_idle() publishes it
+    std::vector<int> order;
+
+    for (int i = 0; i < 30; i++)
+    {
+        gated.pool->submit(job_flow { 1 }, [&order]() { order.push_back(1); });
+        gated.pool->submit(job_flow { 2 }, [&order]() { order.push_back(2); });
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        gated.pool->submit([&order]() { order.push_back(0); });
+    }
+
+    gated.open();
+    gated.pool->wait_idle();
+    gated.pool->stopPool(true);
+
+    // a round of two flows of weight 1 and the untagged jobs is 3 jobs
+    int untagged_early = 0;
+
+    for (int i = 0; i < 30 && i < (int)order.size(); i++)
+    {
+        untagged_early += order[i] == 0 ? 1 : 0;
+    }
+
+    std::cout << "flows: " << untagged_early << " of 10 untagged jobs ran among the first 30 of " << order.size() << std::endl;
+
+    return order.size() == 70 && untagged_early == 10;
+}
+
+// after a known workload, each level counts every job it got and ran, the histograms hold one sample
+// per job run, and the busy workers report a utilisation in (0, 1]
+static bool checkMetrics()
+{
+    auto pool = std::make_shared<thread_pool>();
+
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::HIGH_PRIORITY));
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    pool->setWorkersPriorityNumbers();
+
+    const int counts[2] = { 50, 200 };
+
+    // about 100us of work each, so the workers are measurably busy
+    auto busy_work = []() {
+        auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(100);
+
+        while (std::chrono::steady_clock::now() < until)
+        {
+        }
+    };
+
+    for (int level = 0; level < 2; level++)
+    {
+        for (int i = 0; i < counts[level]; i++)
+        {
+            pool->submit((job_priority)level, busy_work);
+        }
+    }
+
+    pool->wait_idle();
+
+    pool_metrics_snapshot metrics = pool->snapshot();
+    pool->stopPool(true);
+
+    bool counted = true;
+
+    for (int level = 0; level < 2; level++)
+    {
+        const priority_metrics_snapshot& priority = metrics.priorities[level];
+        uint64_t wait_samples = 0;
+        uint64_t run_samples = 0;
+
+        for (int i = 0; i < histogram_snapshot::bucket_count; i++)
+        {
+            wait_samples += priority.wait_time.buckets[i];
+            run_samples += priority.run_time.buckets[i];
+        }
+
+        counted = counted && priority.enqueued == (uint64_t)counts[level] && priority.executed == (uint64_t)counts[level]
+            && priority.wait_time.count == priority.executed && wait_samples == priority.executed
+            && priority.run_time.count == priority.executed && run_samples == priority.executed && priority.queue_depth == 0;
+    }
+
+    bool utilisation_ok = metrics.workers.size() == 3;
+    double busiest = 0.0;
+
+    for (const worker_metrics_snapshot& worker : metrics.workers)
+    {
+        utilisation_ok = utilisation_ok && worker.utilisation >= 0.0 && worker.utilisation <= 1.0;
+        busiest = std::max(busiest, worker.utilisation);
+    }
+
+    std::cout << "metrics: HIGH " << metrics.priorities[0].enqueued << "/" << metrics.priorities[0].executed << ", NORMAL "
+              << metrics.priorities[1].enqueued << "/" << metrics.priorities[1].executed << " enqueued/executed, histograms "
+              << (counted ? "match" : "DO NOT MATCH") << ", busiest worker utilisation " << busiest << std::endl;
+
+    return counted && utilisation_ok && busiest > 0.0;
+}
+
+// milliseconds from its push until a LOW job starts, while the only LOW worker is held and a NORMAL
+// flood keeps the NORMAL worker busy for flood_ms
+static long long lowJobDelay(std::chrono::milliseconds threshold, std::chrono::milliseconds flood_ms)
+{
+    auto pool = std::make_shared<thread_pool>();
+    pool->setStarvationThreshold(threshold);
+
+    // the LOW worker alone first, so it is the one held by the gate job until the flood ends
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::LOW_PRIORITY));
+    pool->setWorkersPriorityNumbers();
+
+    std::promise<void> started;
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+
+    pool->submit(job_priority::LOW_PRIORITY, [opened, &started]() {
+        started.set_value();
+        opened.wait();
+    });
+
+    started.get_future().wait();
+
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    pool->setWorkersPriorityNumbers();
+
+    auto short_job = []() {
+        auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+
+        while (std::chrono::steady_clock::now() < until)
+        {
+        }
+    };
+
+    auto flood_start = std::chrono::steady_clock::now();
+    auto flood_end = flood_start + flood_ms;
+    auto low_push = flood_start + std::chrono::milliseconds(20);
+
+    std::atomic<long long> low_started { 0 };
+    bool low_pushed = false;
+    long long low_pushed_at = 0;
+
+    while (std::chrono::steady_clock::now() < flood_end)
+    {
+        // a few thousand NORMAL jobs always wait ahead of anything pushed now
+        if (pool->getInFlightJobCount() < 2000)
+        {
+            std::vector<std::shared_ptr<job>> batch;
+
+            for (int i = 0; i < 500; i++)
+            {
+                batch.push_back(thread_pool::make_job(job_priority::NORMAL_PRIORITY, short_job));
+            }
+
+            pool->addJobs(batch);
+        }
+
+        if (!low_pushed && std::chrono::steady_clock::now() >= low_push)
+        {
+            low_pushed_at = metricsClockNow();
+            pool->submit(job_priority::LOW_PRIORITY, [&low_started]() { low_started = metricsClockNow(); });
+            low_pushed = true;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    gate.set_value();
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    return (low_started.load() - low_pushed_at) / 1000000;
+}
+
+// under a sustained NORMAL flood, a short starvation threshold lets a LOW job start within a bound;
+// without one it waits for the flood to end
+static bool checkStarvationAging()
+{
+    const std::chrono::milliseconds flood_ms(400);
+
+    long long aged_delay = lowJobDelay(std::chrono::milliseconds(10), flood_ms);
+    long long starved_delay = lowJobDelay(std::chrono::milliseconds(0), flood_ms);
+
+    std::cout << "aging: a LOW job started " << aged_delay << "ms after its push with a 10ms threshold, " << starved_delay
+              << "ms without one (flood of " << flood_ms.count() << "ms)" << std::endl;
+
+    // the flood still had 380ms to go when the LOW job was pushed
+    return aged_delay < 150 && starved_delay >= 300;
+}
+
+// one blocked worker and room for two: DROP_OLDEST cancels the two oldest of four jobs, and the newest two run
+static bool checkDropOldest()
+{
+    gated_pool gated;
+    gated.pool->setQueueCapacity(job_priority::NORMAL_PRIORITY, 2, overflow_policy::DROP_OLDEST);
+
+    std::vector<std::future<int>> futures;
+
+    for (int i = 0; i < 4; i++)
+    {
+        futures.push_back(gated.pool->submit([i]() { return i; }));
+    }
+
+    gated.open();
+
+    std::vector<std::string> results;
+
+    for (auto& future : futures)
+    {
+        try
+        {
+            results.push_back(std::to_string(future.get()));
+        }
+        catch (const std::exception& e)
+        {
+            results.push_back(e.what());
+        }
+    }
+
+    gated.pool->stopPool(true);
+
+    std::cout << "drop oldest: " << results[0] << ", " << results[1] << ", " << results[2] << ", " << results[3] << std::endl;
+
+    return results == std::vector<std::string> { "job was cancelled", "job was cancelled", "2", "3" };
+}
+
+// one blocked worker and room for two: CALLER_RUNS runs the overflow on the submitting thread
+static bool checkCallerRuns()
+{
+    gated_pool gated;
+    gated.pool->setQueueCapacity(job_priority::NORMAL_PRIORITY, 2, overflow_policy::CALLER_RUNS);
+
+    std::vector<std::future<std::thread::id>> futures;
+
+    for (int i = 0; i < 4; i++)
+    {
+        futures.push_back(gated.pool->submit([]() { return std::this_thread::get_id(); }));
+    }
+
+    // the overflow already ran, the queued jobs wait for the gate
+    bool overflow_done = futures[2].wait_for(std::chrono::seconds(0)) == std::future_status::ready
+        && futures[3].wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    bool queued_waiting = futures[0].wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+
+    gated.open();
+
+    // the two queued jobs on the worker, the overflow on this thread
+    std::vector<bool> on_caller;
+
+    for (auto& future : futures)
+    {
+        on_caller.push_back(future.get() == std::this_thread::get_id());
+    }
+
+    gated.pool->stopPool(true);
+
+    bool overflow_on_caller = on_caller == std::vector<bool> { false, false, true, true };
+
+    std::cout << "caller runs: the overflow " << (overflow_on_caller ? "ran on the submitting thread" : "DID NOT RUN ON THE SUBMITTING THREAD") << ", "
+              << (overflow_done ? "done at once" : "NOT DONE AT ONCE") << std::endl;
+
+    return overflow_on_caller && overflow_done && queued_waiting;
+}
+
+// try_submit() gives nullopt while the level is full and a future once there is room
+static bool checkTrySubmit()
+{
+    gated_pool gated;
+    gated.pool->setQueueCapacity(job_priority::NORMAL_PRIORITY, 2, overflow_policy::BLOCK);
+
+    auto first = gated.pool->try_submit([]() { return 1; });
+    auto second = gated.pool->try_submit([]() { return 2; });
+    auto full = gated.pool->try_submit([]() { return 3; });
+
+    gated.open();
+    gated.pool->wait_idle();
+
+    auto after = gated.pool->try_submit([]() { return 4; });
+
+    bool ran = first.has_value() && second.has_value() && after.has_value() && first->get() == 1 && second->get() == 2 && after->get() == 4;
+    gated.pool->stopPool(true);
+
+    std::cout << "try_submit: " << (full.has_value() ? "QUEUED" : "nullopt") << " when full, " << (ran ? "a value" : "NO VALUE") << " with room" << std::endl;
+
+    return !full.has_value() && ran;
+}
+
+// hold the worker that picks it up with a job of the level until the gate opens; returns once it runs
+static void holdWorker(const std::shared_ptr<thread_pool>& pool, job_priority priority, std::shared_future<void> opened)
+{
+    std::promise<void> started;
+    std::future<void> running = started.get_future();
+
+    pool->submit(priority, [opened, &started]() {
+        started.set_value();
+        opened.wait();
+    });
+
+    running.wait();
+}
+
+// a pool of six levels with one worker each runs the jobs of every level
+static bool checkManyLevels()
+{
+    const int levels = 6;
+    const int jobs_per_level = 20;
+
+    auto pool = std::make_shared<thread_pool>(levels);
+
+    for (int level = 0; level < levels; level++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>((job_priority)level));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    std::vector<std::future<int>> futures;
+
+    for (int level = 0; level < levels; level++)
+    {
+        for (int i = 0; i < jobs_per_level; i++)
+        {
+            futures.push_back(pool->submit((job_priority)level, [level]() { return level; }));
+        }
+    }
+
+    int wrong = 0;
+
+    for (int i = 0; i < (int)futures.size(); i++)
+    {
+        wrong += futures[i].get() != i / jobs_per_level ? 1 : 0;
+    }
+
+    pool_metrics_snapshot metrics = pool->snapshot();
+    pool->stopPool(true);
+
+    bool every_level = (int)metrics.priorities.size() == levels;
+
+    for (int level = 0; every_level && level < levels; level++)
+    {
+        every_level = metrics.priorities[level].executed == (uint64_t)jobs_per_level;
+    }
+
+    std::cout << "levels: " << pool->getPriorityLevels() << " levels, " << futures.size() - wrong << " of " << futures.size() << " jobs ran, "
+              << (every_level ? "every level" : "NOT EVERY LEVEL") << " counted its jobs as executed" << std::endl;
+
+    return pool->getPriorityLevels() == levels && wrong == 0 && every_level;
+}
+
+// a NORMAL flood never runs on the worker reserved for HIGH, and a HIGH job pushed into the flood starts at once
+static bool checkReservedWorkers()
+{
+    auto pool = std::make_shared<thread_pool>();
+
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    pool->setWorkersPriorityNumbers();
+    pool->setReservedWorkers(job_priority::HIGH_PRIORITY, 1);
+
+    std::atomic_int on_reserved { 0 };
+
+    // 2000 jobs of 200us keep both NORMAL workers busy for about 200ms
+    std::vector<std::shared_ptr<job>> flood;
+
+    for (int i = 0; i < 2000; i++)
+    {
+        flood.push_back(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&on_reserved]() {
+            on_reserved += thread_worker::current()->isReserved() ? 1 : 0;
+
+            auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(200);
+
+            while (std::chrono::steady_clock::now() < until)
+            {
+            }
+        }));
+    }
+
+    pool->addJobs(flood);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    long long pushed_at = metricsClockNow();
+    auto high = pool->submit(job_priority::HIGH_PRIORITY, []() {
+        return std::make_pair(metricsClockNow(), thread_worker::current()->isReserved());
+    });
+
+    auto [started_at, high_on_reserved] = high.get();
+    long long delay_ms = (started_at - pushed_at) / 1000000;
+    int still_queued = pool->getInFlightJobCount();
+
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    std::cout << "reserved: " << on_reserved.load() << " NORMAL jobs ran on the reserved worker, a HIGH job started after " << delay_ms << "ms "
+              << (high_on_reserved ? "on the reserved worker" : "ON A SHARED WORKER") << " with " << still_queued << " jobs still in flight" << std::endl;
+
+    return on_reserved.load() == 0 && high_on_reserved && delay_ms < 50 && still_queued > 0;
+}
+
+// a worker follows its level's custom borrow list: it takes the listed level's jobs and leaves the others
+static bool checkBorrowLevels()
+{
+    auto pool = std::make_shared<thread_pool>(4);
+    pool->setBorrowLevels((job_priority)0, { (job_priority)2 });
+
+    // the workers of levels 1 to 3 are held, so only the level 0 worker can take their jobs
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+
+    for (int level = 1; level < 4; level++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>((job_priority)level));
+        pool->setWorkersPriorityNumbers();
+        holdWorker(pool, (job_priority)level, opened);
+    }
+
+    pool->addWorker(std::make_shared<thread_worker>((job_priority)0));
+    pool->setWorkersPriorityNumbers();
+
+    auto unlisted_more_urgent = pool->submit((job_priority)1, []() { return 1; });
+    auto listed = pool->submit((job_priority)2, []() { return 2; });
+    auto unlisted_less_urgent = pool->submit((job_priority)3, []() { return 3; });
+
+    bool borrowed = listed.wait_for(std::chrono::seconds(2)) == std::future_status::ready && listed.get() == 2;
+
+    // give the level 0 worker time to take what it should not
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    bool left = unlisted_more_urgent.wait_for(std::chrono::seconds(0)) != std::future_status::ready
+        && unlisted_less_urgent.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+
+    gate.set_value();
+
+    bool all_ran = unlisted_more_urgent.get() == 1 && unlisted_less_urgent.get() == 3;
+    bool listed_back = pool->getBorrowLevels((job_priority)0) == std::vector<job_priority> { (job_priority)2 };
+
+    pool->stopPool(true);
+
+    std::cout << "borrow: the listed level " << (borrowed ? "was borrowed" : "WAS NOT BORROWED") << ", the others "
+              << (left ? "were left alone" : "WERE BORROWED") << std::endl;
+
+    return borrowed && left && all_ran && listed_back;
+}
+
+int main()
+{
+    std::cout << "Scheduling Sample Application" << std::endl;
+
+    bool ok = true;
+
+    ok = checkQueueOverflowOrder() && ok;
+    ok = checkQueueExactlyOnce() && ok;
+    ok = checkBulkSubmit() && ok;
+    ok = checkDeadlineOrder() && ok;
+    ok = checkDeadlineMissed() && ok;
+    ok = checkFlowFairness() && ok;
+    ok = checkUntaggedTurns() && ok;
+    ok = checkMetrics() && ok;
+    ok = checkStarvationAging() && ok;
+    ok = checkDropOldest() && ok;
+    ok = checkCallerRuns() && ok;
+    ok = checkTrySubmit() && ok;
+    ok = checkManyLevels() && ok;
+    ok = checkReservedWorkers() && ok;
+    ok = checkBorrowLevels() && ok;
+
+    std::cout << (ok ? "all scheduling checks passed" : "scheduling checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
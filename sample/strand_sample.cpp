@@ -0,0 +1,294 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "strand.h"
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+using namespace std::chrono_literals;
+
+static std::shared_ptr<thread_pool> makePool(int worker_count)
+{
+    auto pool = std::make_shared<thread_pool>();
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    return pool;
+}
+
+// 1 when the future fails with job_cancelled_error
+static int cancelledResult(std::future<int>& future)
+{
+    try
+    {
+        future.get();
+    }
+    catch (const job_cancelled_error&)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// several producers post to a few strands: each strand runs one job at a time, on its own strand
+// only, and every producer's jobs in post order
+static bool checkOrderAndExclusion()
+{
+    const int strand_count = 4;
+    const int producers = 4;
+    const int jobs_per_producer = 5000;
+
+    auto pool = makePool(4);
+
+    std::vector<std::unique_ptr<strand>> strands;
+    std::vector<std::atomic_bool> in_use(strand_count);
+
+    // last sequence number seen per strand and producer; only the strand's running job touches its row
+    std::vector<std::vector<int>> last_seen(strand_count, std::vector<int>(producers, -1));
+
+    std::atomic_int overlaps { 0 };
+    std::atomic_int out_of_order { 0 };
+    std::atomic_int not_on_strand { 0 };
+
+    for (int s = 0; s < strand_count; s++)
+    {
+        strands.push_back(std::make_unique<strand>(pool));
+    }
+
+    std::vector<std::thread> threads;
+
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < jobs_per_producer; i++)
+            {
+                int s = i % strand_count;
+                strand* target = strands[s].get();
+
+                target->post([&, s, p, i, target]() {
+                    if (in_use[s].exchange(true))
+                    {
+                        overlaps++;
+                    }
+
+                    if (!target->runningInThisThread() || strands[(s + 1) % strand_count]->runningInThisThread())
+                    {
+                        not_on_strand++;
+                    }
+
+                    if (last_seen[s][p] >= i)
+                    {
+                        out_of_order++;
+                    }
+
+                    last_seen[s][p] = i;
+                    in_use[s] = false;
+                });
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    bool outside = strands[0]->runningInThisThread();
+
+    std::cout << "order: " << producers * jobs_per_producer << " jobs on " << strand_count << " strands, " << overlaps.load() << " overlapping, "
+              << out_of_order.load() << " out of post order, " << not_on_strand.load() << " not seen on their strand" << std::endl;
+
+    return overlaps.load() == 0 && out_of_order.load() == 0 && not_on_strand.load() == 0 && !outside;
+}
+
+// jobs of different strands run at the same time: each waits until all of them have started
+static bool checkParallelStrands()
+{
+    const int strand_count = 4;
+
+    auto pool = makePool(strand_count);
+
+    std::vector<std::unique_ptr<strand>> strands;
+    std::atomic_int arrived { 0 };
+    std::atomic_int met { 0 };
+
+    for (int s = 0; s < strand_count; s++)
+    {
+        strands.push_back(std::make_unique<strand>(pool));
+        strands.back()->post([&arrived, &met, strand_count]() {
+            arrived++;
+
+            auto deadline = std::chrono::steady_clock::now() + 2s;
+
+            while (arrived.load() < strand_count && std::chrono::steady_clock::now() < deadline)
+            {
+                std::this_thread::yield();
+            }
+
+            met += arrived.load() == strand_count ? 1 : 0;
+        });
+    }
+
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    std::cout << "parallel: " << met.load() << " of " << strand_count << " strand jobs saw all strands running at once" << std::endl;
+
+    return met.load() == strand_count;
+}
+
+// a job cancelled while queued in the strand is skipped, the ones around it still run in order
+static bool checkCancelQueued()
+{
+    auto pool = makePool(1);
+    strand serial(pool);
+
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::vector<int> ran;
+
+    serial.post([opened]() { opened.wait(); });
+    serial.post([&ran]() { ran.push_back(1); });
+    job_handle handle = serial.post([&ran]() { ran.push_back(2); });
+    serial.post([&ran]() { ran.push_back(3); });
+
+    bool cancelled = handle.cancel();
+
+    gate.set_value();
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    bool skipped = ran == std::vector<int> { 1, 3 };
+
+    std::cout << "cancel: cancel " << (cancelled ? "succeeded" : "FAILED") << ", the cancelled job " << (skipped ? "was skipped" : "WAS NOT SKIPPED")
+              << std::endl;
+
+    return cancelled && skipped;
+}
+
+// jobs still queued in a strand when the pool stops are cancelled, and so are jobs posted afterwards
+static bool checkStopCancelsStrand()
+{
+    auto pool = makePool(1);
+    strand serial(pool);
+
+    // a job on the pool itself holds the only worker, so the strand's drain job stays queued
+    std::promise<void> started;
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+
+    pool->submit([opened, &started]() {
+        started.set_value();
+        opened.wait();
+    });
+
+    started.get_future().wait();
+
+    std::vector<std::future<int>> futures;
+
+    for (int i = 0; i < 5; i++)
+    {
+        futures.push_back(serial.submit([i]() { return i; }));
+    }
+
+    std::thread stopper([pool]() { pool->stopPool(false); });
+
+    while (!pool->isTerminated())
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+
+    gate.set_value();
+    stopper.join();
+
+    futures.push_back(serial.submit([]() { return 5; }));
+
+    int failed = 0;
+
+    for (auto& future : futures)
+    {
+        failed += cancelledResult(future);
+    }
+
+    std::cout << "stop: " << failed << " of 6 strand futures failed with job_cancelled_error, " << serial.getQueuedCount() << " jobs left queued"
+              << std::endl;
+
+    return failed == 6 && serial.getQueuedCount() == 0;
+}
+
+// a key always maps to the same strand, keys spread over the strands, and one key's jobs run in order
+static bool checkKeyedStrand()
+{
+    auto pool = makePool(4);
+    keyed_strand accounts(pool, 16);
+
+    const int key_count = 256;
+    bool stable = true;
+    std::set<strand*> used;
+
+    for (int key = 0; key < key_count; key++)
+    {
+        strand* first = &accounts.get(key);
+        stable = stable && first == &accounts.get(key) && first == &accounts.get(key);
+        used.insert(first);
+    }
+
+    // only the key's strand touches its entry
+    std::vector<int> last_seen(key_count, -1);
+    std::atomic_int out_of_order { 0 };
+
+    for (int i = 0; i < 100; i++)
+    {
+        for (int key = 0; key < key_count; key++)
+        {
+            accounts.post(key, [&last_seen, &out_of_order, key, i]() {
+                if (last_seen[key] != i - 1)
+                {
+                    out_of_order++;
+                }
+
+                last_seen[key] = i;
+            });
+        }
+    }
+
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    std::cout << "keyed: " << key_count << " keys " << (stable ? "stably" : "NOT STABLY") << " mapped onto " << used.size() << " of "
+              << accounts.getStrandCount() << " strands, " << out_of_order.load() << " jobs out of order" << std::endl;
+
+    return stable && (int)used.size() > accounts.getStrandCount() / 2 && out_of_order.load() == 0;
+}
+
+int main()
+{
+    std::cout << "Strand Sample Application" << std::endl;
+
+    bool ok = true;
+
+    ok = checkOrderAndExclusion() && ok;
+    ok = checkParallelStrands() && ok;
+    ok = checkCancelQueued() && ok;
+    ok = checkStopCancelsStrand() && ok;
+    ok = checkKeyedStrand() && ok;
+
+    std::cout << (ok ? "all strand checks passed" : "strand checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+#include "task_group.h"
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+// every job of the tree runs run() on the group it belongs to, while the main thread helps in wait()
+static void spawnTree(task_group& group, int depth, std::atomic<long long>& runs)
+{
+    runs++;
+
+    if (depth == 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        group.run([&group, depth, &runs]() { spawnTree(group, depth - 1, runs); });
+    }
+}
+
+long long fib(const std::shared_ptr<thread_pool>& pool, int n)
+{
+    if (n < 15)
+    {
+        return n < 2 ? n : fib(pool, n - 1) + fib(pool, n - 2);
+    }
+
+    long long a = 0;
+    long long b = 0;
+
+    task_group group(pool);
+    group.run([&]() { a = fib(pool, n - 1); });
+    group.run([&]() { b = fib(pool, n - 2); });
+    group.wait();
+
+    return a + b;
+}
+
+int main()
+{
+    std::cout << "Task Group Sample Application" << std::endl;
+
+    auto pool = std::make_shared<thread_pool>();
+
+    for (int i = 0; i < 3; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    bool ok = true;
+
+    // recursive fork/join on a fixed-size pool
+    long long fib_30 = fib(pool, 30);
+    std::cout << "fib(30) = " << fib_30 << std::endl;
+    ok = ok && fib_30 == 832040;
+
+    // jobs calling run() on their own group: each job runs exactly once, and wait() returns only
+    // after the last of them (3^0 + 3^1 + ... + 3^6 jobs per round)
+    const long long expected_runs = 1093;
+
+    for (int round = 0; round < 200 && ok; round++)
+    {
+        std::atomic<long long> runs { 0 };
+
+        {
+            task_group group(pool);
+            group.run([&group, &runs]() { spawnTree(group, 6, runs); });
+            group.wait();
+
+            if (runs.load() != expected_runs)
+            {
+                std::cout << "round " << round << ": " << runs.load() << " runs after wait(), expected " << expected_runs << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    pool->stopPool(true);
+
+    std::cout << (ok ? "all task group checks passed" : "task group checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+using namespace std::chrono_literals;
+
+// occupy the only NORMAL worker and the single queue slot of NORMAL until gate opens
+static void fillNormalLevel(const std::shared_ptr<thread_pool>& pool, std::atomic_bool& gate)
+{
+    std::atomic_bool started { false };
+
+    pool->addJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&gate, &started]() {
+        started = true;
+        while (!gate)
+        {
+            std::this_thread::sleep_for(1ms);
+        }
+    }));
+
+    while (!started)
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+
+    pool->addJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, []() {}));
+}
+
+int main()
+{
+    std::cout << "Timer Sample Application" << std::endl;
+
+    bool ok = true;
+
+    // a periodic run rejected by a full level does not stop the timer
+    {
+        auto pool = std::make_shared<thread_pool>();
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        pool->setWorkersPriorityNumbers();
+        pool->setQueueCapacity(job_priority::NORMAL_PRIORITY, 1, overflow_policy::REJECT);
+
+        std::atomic_bool gate { false };
+        std::atomic_int ticks { 0 };
+
+        fillNormalLevel(pool, gate);
+
+        timer_handle ticker = pool->submit_every(5ms, [&ticks]() { ticks++; });
+
+        // every run due meanwhile is rejected
+        std::this_thread::sleep_for(30ms);
+        int rejected_ticks = ticks.load();
+
+        gate = true;
+        std::this_thread::sleep_for(200ms);
+
+        ticker.cancel();
+        pool->stopPool(true);
+
+        std::cout << "REJECT: " << rejected_ticks << " runs while full, " << ticks.load() << " runs after" << std::endl;
+        ok = ok && rejected_ticks == 0 && ticks.load() > 0;
+    }
+
+    // a full BLOCK level does not hold up the timers of other levels
+    {
+        auto pool = std::make_shared<thread_pool>();
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::HIGH_PRIORITY));
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        pool->setWorkersPriorityNumbers();
+        pool->setBorrowLevels(job_priority::HIGH_PRIORITY, { job_priority::HIGH_PRIORITY });
+        pool->setQueueCapacity(job_priority::NORMAL_PRIORITY, 1, overflow_policy::BLOCK);
+
+        std::atomic_bool gate { false };
+        std::atomic_bool high_fired { false };
+
+        fillNormalLevel(pool, gate);
+
+        timer_handle ticker = pool->submit_every(job_priority::NORMAL_PRIORITY, 2ms, []() {});
+
+        std::this_thread::sleep_for(10ms);
+        pool->submit_after(job_priority::HIGH_PRIORITY, 10ms, [&high_fired]() { high_fired = true; });
+
+        std::this_thread::sleep_for(200ms);
+        bool fired_while_full = high_fired.load();
+
+        gate = true;
+        ticker.cancel();
+        pool->stopPool(true);
+
+        std::cout << "BLOCK: HIGH timer " << (fired_while_full ? "fired" : "stalled") << " while NORMAL was full" << std::endl;
+        ok = ok && fired_while_full;
+    }
+
+    // one-shot timers fire in deadline order and never before their deadline, including those placed
+    // in level 1 (over 64ms) and level 2 (over 4096ms) that cascade down before they are due
+    {
+        auto pool = std::make_shared<thread_pool>();
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        pool->setWorkersPriorityNumbers();
+
+        const std::vector<int> delays { 4200, 130, 1, 70, 9, 300, 65, 33, 180, 2 };
+
+        std::mutex fired_mutex;
+        std::vector<int> fired_order;
+        std::atomic_int early { 0 };
+
+        for (int delay : delays)
+        {
+            auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+            pool->submit_after(std::chrono::milliseconds(delay), [&, delay, due]() {
+                if (std::chrono::steady_clock::now() < due)
+                {
+                    early++;
+                }
+
+                std::scoped_lock lock(fired_mutex);
+                fired_order.push_back(delay);
+            });
+        }
+
+        while (pool->getTimerCount() > 0)
+        {
+            std::this_thread::sleep_for(10ms);
+        }
+        std::this_thread::sleep_for(50ms);
+
+        pool->stopPool(true);
+
+        std::vector<int> expected = delays;
+        std::sort(expected.begin(), expected.end());
+
+        std::cout << "ordering: " << fired_order.size() << " of " << delays.size() << " fired, " << early.load() << " early" << std::endl;
+        ok = ok && fired_order == expected && early.load() == 0;
+    }
+
+    // cancelled timers never fire, also a periodic timer cancelled from inside its own run and one
+    // beyond the 2^24 ticks the wheel covers
+    {
+        auto pool = std::make_shared<thread_pool>();
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        pool->setWorkersPriorityNumbers();
+
+        std::atomic_bool one_shot_fired { false };
+        timer_handle one_shot = pool->submit_after(20ms, [&one_shot_fired]() { one_shot_fired = true; });
+        bool one_shot_cancelled = one_shot.cancel();
+
+        timer_handle far = pool->submit_after(std::chrono::hours(10), []() {});
+        bool far_pending = far.isPending() && pool->getTimerCount() == 1;
+        bool far_cancelled = far.cancel();
+
+        std::atomic_int periodic_runs { 0 };
+        timer_handle periodic;
+        std::mutex periodic_mutex;
+        {
+            std::scoped_lock lock(periodic_mutex);
+            periodic = pool->submit_every(2ms, [&]() {
+                if (++periodic_runs == 3)
+                {
+                    std::scoped_lock lock(periodic_mutex);
+                    periodic.cancel();
+                }
+            });
+        }
+
+        std::this_thread::sleep_for(100ms);
+
+        bool fired_after_cancel = one_shot_fired.load() || periodic_runs.load() != 3;
+        bool cancel_again = false;
+        {
+            std::scoped_lock lock(periodic_mutex);
+            cancel_again = one_shot.cancel() || periodic.cancel();
+        }
+        size_t timers_left = pool->getTimerCount();
+
+        pool->stopPool(true);
+
+        std::cout << "cancel: " << periodic_runs.load() << " periodic runs, " << timers_left << " timers left" << std::endl;
+        ok = ok && one_shot_cancelled && far_pending && far_cancelled && !fired_after_cancel && !cancel_again && timers_left == 0;
+    }
+
+    // a periodic run slower than its period skips the ticks it missed instead of running them in a burst
+    {
+        auto pool = std::make_shared<thread_pool>();
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        pool->setWorkersPriorityNumbers();
+
+        std::atomic_int runs { 0 };
+        std::atomic_int running { 0 };
+        std::atomic_bool overlapped { false };
+
+        timer_handle slow = pool->submit_every(5ms, [&]() {
+            if (++running > 1)
+            {
+                overlapped = true;
+            }
+            runs++;
+            std::this_thread::sleep_for(25ms);
+            running--;
+        });
+
+        std::this_thread::sleep_for(250ms);
+        slow.cancel();
+        pool->stopPool(true);
+
+        // 250ms of 25ms runs: about 10, where firing every missed tick would make 50
+        std::cout << "catch-up: " << runs.load() << " slow runs in 250ms" << (overlapped ? ", overlapped" : "") << std::endl;
+        ok = ok && !overlapped && runs.load() > 0 && runs.load() <= 12;
+    }
+
+    std::cout << (ok ? "all timer checks passed" : "timer checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,371 @@
+#include <cctype>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "job_tracer.h"
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+// just enough JSON to read a trace back: objects, arrays, strings, numbers and literals
+struct json_value
+{
+    enum class kind
+    {
+        NUL,
+        BOOLEAN,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    kind type = kind::NUL;
+    double number = 0.0;
+    std::string text;
+    std::vector<json_value> items;
+    std::map<std::string, json_value> members;
+
+    const json_value* find(const std::string& name) const
+    {
+        auto iter = this->members.find(name);
+
+        return iter == this->members.end() ? nullptr : &iter->second;
+    }
+};
+
+class json_parser
+{
+public:
+    explicit json_parser(const std::string& text)
+        : _text(text), _pos(0)
+    {
+    }
+
+    // false when the text is not one complete JSON document
+    bool parse(json_value& value)
+    {
+        return this->parseValue(value) && (this->skipSpace(), this->_pos == this->_text.size());
+    }
+
+private:
+    void skipSpace()
+    {
+        while (this->_pos < this->_text.size() && std::isspace((unsigned char)this->_text[this->_pos]))
+        {
+            this->_pos++;
+        }
+    }
+
+    bool consume(char c)
+    {
+        this->skipSpace();
+
+        if (this->_pos < this->_text.size() && this->_text[this->_pos] == c)
+        {
+            this->_pos++;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool parseValue(json_value& value)
+    {
+        this->skipSpace();
+
+        if (this->_pos >= this->_text.size())
+        {
+            return false;
+        }
+
+        char c = this->_text[this->_pos];
+
+        if (c == '{')
+        {
+            return this->parseObject(value);
+        }
+
+        if (c == '[')
+        {
+            return this->parseArray(value);
+        }
+
+        if (c == '"')
+        {
+            value.type = json_value::kind::STRING;
+            return this->parseString(value.text);
+        }
+
+        for (const char* literal : { "true", "false", "null" })
+        {
+            if (this->_text.compare(this->_pos, std::string(literal).size(), literal) == 0)
+            {
+                value.type = literal[0] == 'n' ? json_value::kind::NUL : json_value::kind::BOOLEAN;
+                this->_pos += std::string(literal).size();
+                return true;
+            }
+        }
+
+        return this->parseNumber(value);
+    }
+
+    bool parseObject(json_value& value)
+    {
+        value.type = json_value::kind::OBJECT;
+        this->_pos++;
+
+        if (this->consume('}'))
+        {
+            return true;
+        }
+
+        do
+        {
+            std::string name;
+            json_value member;
+
+            this->skipSpace();
+
+            if (!this->parseString(name) || !this->consume(':') || !this->parseValue(member))
+            {
+                return false;
+            }
+
+            value.members[name] = std::move(member);
+        } while (this->consume(','));
+
+        return this->consume('}');
+    }
+
+    bool parseArray(json_value& value)
+    {
+        value.type = json_value::kind::ARRAY;
+        this->_pos++;
+
+        if (this->consume(']'))
+        {
+            return true;
+        }
+
+        do
+        {
+            json_value item;
+
+            if (!this->parseValue(item))
+            {
+                return false;
+            }
+
+            value.items.push_back(std::move(item));
+        } while (this->consume(','));
+
+        return this->consume(']');
+    }
+
+    bool parseString(std::string& text)
+    {
+        if (this->_pos >= this->_text.size() || this->_text[this->_pos] != '"')
+        {
+            return false;
+        }
+
+        for (this->_pos++; this->_pos < this->_text.size(); this->_pos++)
+        {
+            char c = this->_text[this->_pos];
+
+            if (c == '"')
+            {
+                this->_pos++;
+                return true;
+            }
+
+            if (c == '\\')
+            {
+                // the tracer only escapes quotes and backslashes
+                if (++this->_pos >= this->_text.size())
+                {
+                    return false;
+                }
+
+                c = this->_text[this->_pos];
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                return false;
+            }
+
+            text += c;
+        }
+
+        return false;
+    }
+
+    bool parseNumber(json_value& value)
+    {
+        size_t start = this->_pos;
+
+        while (this->_pos < this->_text.size() && (std::isdigit((unsigned char)this->_text[this->_pos]) || std::string("+-.eE").find(this->_text[this->_pos]) != std::string::npos))
+        {
+            this->_pos++;
+        }
+
+        if (start == this->_pos)
+        {
+            return false;
+        }
+
+        try
+        {
+            size_t used = 0;
+            value.number = std::stod(this->_text.substr(start, this->_pos - start), &used);
+            value.type = json_value::kind::NUMBER;
+
+            return used == this->_pos - start;
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+
+private:
+    const std::string& _text;
+    size_t _pos;
+};
+
+// a known number of jobs traced into a string: the document parses, every job has one begin and one
+// end on the same thread, and each thread's timestamps never go back
+static bool checkChromeTrace()
+{
+    const int job_count = 200;
+
+    auto pool = std::make_shared<thread_pool>();
+
+    for (int i = 0; i < 3; i++)
+    {
+        pool->addWorker(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+    }
+
+    pool->setWorkersPriorityNumbers();
+
+    job_tracer::enable();
+
+    std::vector<std::shared_ptr<job>> jobs;
+
+    for (int i = 0; i < job_count; i++)
+    {
+        jobs.push_back(thread_pool::make_job(job_priority::NORMAL_PRIORITY, []() {}));
+        pool->addJob(jobs.back());
+    }
+
+    pool->wait_idle();
+    job_tracer::disable();
+
+    std::ostringstream output;
+    job_tracer::writeChromeTrace(output);
+    pool->stopPool(true);
+
+    std::string text = output.str();
+    json_value document;
+    bool parsed = json_parser(text).parse(document);
+
+    const json_value* events = parsed ? document.find("traceEvents") : nullptr;
+    bool valid = events != nullptr && events->type == json_value::kind::ARRAY;
+
+    // begin and end count per trace id, and the thread of the begin
+    std::map<unsigned long long, int> begins;
+    std::map<unsigned long long, int> ends;
+    std::map<unsigned long long, double> begin_threads;
+    std::map<double, double> last_timestamps;
+    int backwards = 0;
+
+    for (size_t i = 0; valid && i < events->items.size(); i++)
+    {
+        const json_value& event = events->items[i];
+        const json_value* phase = event.find("ph");
+        const json_value* thread = event.find("tid");
+
+        valid = phase != nullptr && phase->type == json_value::kind::STRING && thread != nullptr && thread->type == json_value::kind::NUMBER
+            && event.find("pid") != nullptr;
+
+        if (!valid || phase->text == "M")
+        {
+            continue;
+        }
+
+        const json_value* name = event.find("name");
+        const json_value* timestamp = event.find("ts");
+        valid = name != nullptr && timestamp != nullptr && timestamp->type == json_value::kind::NUMBER;
+
+        if (!valid)
+        {
+            continue;
+        }
+
+        auto last = last_timestamps.find(thread->number);
+
+        if (last != last_timestamps.end() && timestamp->number < last->second)
+        {
+            backwards++;
+        }
+
+        last_timestamps[thread->number] = timestamp->number;
+
+        if (name->text != "job")
+        {
+            continue;
+        }
+
+        const json_value* args = event.find("args");
+        const json_value* trace_id = args != nullptr ? args->find("job") : nullptr;
+        valid = trace_id != nullptr && trace_id->type == json_value::kind::NUMBER;
+
+        if (!valid)
+        {
+            continue;
+        }
+
+        unsigned long long id = (unsigned long long)trace_id->number;
+
+        if (phase->text == "B")
+        {
+            begins[id]++;
+            begin_threads[id] = thread->number;
+        }
+        else if (phase->text == "E")
+        {
+            // the end follows the begin on the same thread
+            ends[id] += begin_threads.count(id) != 0 && begin_threads[id] == thread->number ? 1 : 0;
+        }
+    }
+
+    int paired = 0;
+
+    for (auto& traced_job : jobs)
+    {
+        unsigned long long id = traced_job->getTraceId();
+        paired += begins[id] == 1 && ends[id] == 1 ? 1 : 0;
+    }
+
+    bool no_extra = (int)begins.size() == job_count && (int)ends.size() == job_count;
+
+    std::cout << "trace: " << text.size() << " bytes of " << (valid ? "valid" : "INVALID") << " Chrome trace JSON, " << paired << " of " << job_count
+              << " jobs with one begin/end pair, " << backwards << " timestamps going back" << std::endl;
+
+    return valid && paired == job_count && no_extra && backwards == 0;
+}
+
+int main()
+{
+    std::cout << "Trace Sample Application" << std::endl;
+
+    bool ok = checkChromeTrace();
+
+    std::cout << (ok ? "all trace checks passed" : "trace checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
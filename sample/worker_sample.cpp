@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+#include "thread_worker.h"
+
+using namespace std::chrono_literals;
+
+// add `count` workers of the priority to the pool, returning them so their state can be looked at
+static std::vector<std::shared_ptr<thread_worker>> addWorkers(const std::shared_ptr<thread_pool>& pool, job_priority priority, int count)
+{
+    std::vector<std::shared_ptr<thread_worker>> workers;
+
+    for (int i = 0; i < count; i++)
+    {
+        workers.push_back(std::make_shared<thread_worker>(priority));
+        pool->addWorker(workers.back());
+    }
+
+    return workers;
+}
+
+static bool waitUntilParked(const std::vector<std::shared_ptr<thread_worker>>& workers)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        bool parked = true;
+
+        for (auto& worker : workers)
+        {
+            parked = parked && worker->isIdle();
+        }
+
+        if (parked)
+        {
+            return true;
+        }
+
+        std::this_thread::sleep_for(1ms);
+    }
+
+    return false;
+}
+
+// workers that left park() since `since`: running now, or parked again after a wake-up
+static int countWoken(const std::vector<std::shared_ptr<thread_worker>>& workers, long long since)
+{
+    int woken = 0;
+
+    for (auto& worker : workers)
+    {
+        long long idle_since = worker->getIdleSince();
+        woken += idle_since == 0 || idle_since > since ? 1 : 0;
+    }
+
+    return woken;
+}
+
+// one push wakes one parked worker, and only one that can run the job's priority
+static bool checkSingleWakeUp()
+{
+    auto pool = std::make_shared<thread_pool>();
+
+    // HIGH workers borrow NORMAL jobs only, so they cannot run a LOW job
+    auto high_workers = addWorkers(pool, job_priority::HIGH_PRIORITY, 4);
+    auto low_workers = addWorkers(pool, job_priority::LOW_PRIORITY, 4);
+    pool->setWorkersPriorityNumbers();
+
+    std::vector<std::shared_ptr<thread_worker>> all_workers = high_workers;
+    all_workers.insert(all_workers.end(), low_workers.begin(), low_workers.end());
+
+    bool parked = waitUntilParked(all_workers);
+    long long pushed_at = metricsClockNow();
+
+    auto result = pool->submit(job_priority::LOW_PRIORITY, []() { std::this_thread::sleep_for(100ms); });
+
+    std::this_thread::sleep_for(50ms);
+
+    int high_woken = countWoken(high_workers, pushed_at);
+    int low_woken = countWoken(low_workers, pushed_at);
+
+    result.get();
+    pool->stopPool(true);
+
+    std::cout << "wake-up: one LOW job woke " << low_woken << " LOW and " << high_woken << " HIGH workers" << std::endl;
+
+    return parked && low_woken == 1 && high_woken == 0;
+}
+
+// a busy-spinning LOW worker that borrows every level stands in for one parked worker, not one per level:
+// a NORMAL and a HIGH job pushed back to back run side by side instead of one after the other on the spinner
+static bool checkSpinnerStandsInOnce()
+{
+    auto pool = std::make_shared<thread_pool>();
+    addWorkers(pool, job_priority::HIGH_PRIORITY, 1);
+    addWorkers(pool, job_priority::NORMAL_PRIORITY, 1);
+    addWorkers(pool, job_priority::LOW_PRIORITY, 1);
+    pool->setWorkersPriorityNumbers();
+    pool->setWaitStrategy(job_priority::LOW_PRIORITY, wait_strategy::busySpin());
+
+    // let the parking workers park and the spinner start spinning
+    std::this_thread::sleep_for(50ms);
+
+    auto started = std::chrono::steady_clock::now();
+
+    auto normal_result = pool->submit(job_priority::NORMAL_PRIORITY, []() { std::this_thread::sleep_for(200ms); });
+    auto high_result = pool->submit(job_priority::HIGH_PRIORITY, []() { std::this_thread::sleep_for(200ms); });
+
+    normal_result.get();
+    high_result.get();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+
+    pool->stopPool(true);
+
+    std::cout << "spinning: a NORMAL and a HIGH job of 200ms each took " << elapsed.count() << "ms next to a spinning LOW worker" << std::endl;
+
+    return elapsed < 330ms;
+}
+
+// jobs spawned from inside a job go to the worker's own deque, and idle workers steal them
+static bool checkWorkStealing()
+{
+    auto pool = std::make_shared<thread_pool>();
+    auto workers = addWorkers(pool, job_priority::NORMAL_PRIORITY, 4);
+    pool->setWorkersPriorityNumbers();
+    pool->setWorkStealing(true);
+
+    const int child_count = 64;
+
+    std::mutex threads_mutex;
+    std::vector<std::thread::id> child_threads;
+    std::atomic_int children_run { 0 };
+
+    pool->submit([&]() {
+        for (int i = 0; i < child_count; i++)
+        {
+            pool->addJob(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&]() {
+                std::this_thread::sleep_for(2ms);
+
+                std::scoped_lock lock(threads_mutex);
+                child_threads.push_back(std::this_thread::get_id());
+                children_run++;
+            }));
+        }
+    }).get();
+
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    std::sort(child_threads.begin(), child_threads.end());
+    int thread_count = (int)(std::unique(child_threads.begin(), child_threads.end()) - child_threads.begin());
+
+    std::cout << "work stealing: " << children_run.load() << " of " << child_count << " spawned jobs ran on " << thread_count << " workers" << std::endl;
+
+    return children_run.load() == child_count && thread_count > 1;
+}
+
+// jobs left in a deque whose owner leaves are moved to the shared queues and wake a parked worker
+static bool checkLeftJobsWakeWorker()
+{
+    auto manager = std::make_shared<job_manager>();
+
+    // stealing off: the parked worker cannot see the deque's jobs, only the shared queues
+    manager->setWorkStealing(false);
+
+    auto worker = std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY);
+    worker->setJobManager(manager);
+    worker->startWorker();
+
+    auto leaving_queue = std::make_shared<work_stealing_deque>(job_priority::NORMAL_PRIORITY);
+    manager->registerLocalQueue(leaving_queue);
+
+    const int job_count = 10;
+    std::atomic_int jobs_run { 0 };
+
+    for (int i = 0; i < job_count; i++)
+    {
+        manager->push_local_job(leaving_queue.get(), std::make_shared<job>(job_priority::NORMAL_PRIORITY, [&jobs_run]() { jobs_run++; }));
+    }
+
+    bool parked = waitUntilParked({ worker });
+
+    manager->unregisterLocalQueue(leaving_queue);
+
+    bool idle = manager->waitIdle(std::chrono::steady_clock::now() + 1s);
+
+    worker->stopWorker();
+    worker->setJobManager(nullptr);
+
+    std::cout << "left deque jobs: " << jobs_run.load() << " of " << job_count << " ran after their owner left" << std::endl;
+
+    return parked && idle && jobs_run.load() == job_count;
+}
+
+// a backlog spawns workers up to max_workers, and the spawned ones retire once parked past idle_timeout
+static bool checkAutoscale()
+{
+    auto pool = std::make_shared<thread_pool>();
+    addWorkers(pool, job_priority::NORMAL_PRIORITY, 1);
+    pool->setWorkersPriorityNumbers();
+
+    autoscale_policy policy;
+    policy.min_workers = 1;
+    policy.max_workers = 4;
+    policy.queue_depth_threshold = 2;
+    policy.idle_timeout = 100ms;
+    pool->setAutoscalePolicy(job_priority::NORMAL_PRIORITY, policy);
+
+    std::atomic_int jobs_run { 0 };
+
+    for (int i = 0; i < 60; i++)
+    {
+        pool->submit([&jobs_run]() {
+            std::this_thread::sleep_for(10ms);
+            jobs_run++;
+        });
+    }
+
+    int peak_workers = 0;
+
+    while (pool->getInFlightJobCount() > 0)
+    {
+        peak_workers = std::max(peak_workers, pool->getWorkerNumbers());
+        std::this_thread::sleep_for(5ms);
+    }
+
+    // the spawned workers park now and are retired after idle_timeout; the one added by hand stays
+    int workers_after = pool->getWorkerNumbers();
+
+    for (int i = 0; i < 200 && workers_after > 1; i++)
+    {
+        std::this_thread::sleep_for(10ms);
+        workers_after = pool->getWorkerNumbers();
+    }
+
+    pool->stopPool(true);
+
+    std::cout << "autoscale: " << jobs_run.load() << " jobs, up to " << peak_workers << " workers, " << workers_after << " left after idling" << std::endl;
+
+    return jobs_run.load() == 60 && peak_workers > 1 && peak_workers <= policy.max_workers && workers_after == 1;
+}
+
+// wait_idle() returns once the running job is done, not when the queues empty; drain() gives up at its deadline
+static bool checkWaitIdle()
+{
+    auto pool = std::make_shared<thread_pool>();
+    addWorkers(pool, job_priority::NORMAL_PRIORITY, 1);
+    pool->setWorkersPriorityNumbers();
+
+    std::atomic_bool finished { false };
+
+    pool->submit([&finished]() {
+        std::this_thread::sleep_for(100ms);
+        finished = true;
+    });
+
+    pool->wait_idle();
+    bool finished_on_idle = finished.load();
+
+    pool->submit([]() { std::this_thread::sleep_for(300ms); });
+
+    bool drained_early = pool->drain(std::chrono::steady_clock::now() + 50ms);
+    bool drained = pool->drain(std::chrono::steady_clock::now() + 2s);
+
+    pool->stopPool(true);
+
+    std::cout << "wait_idle: running job " << (finished_on_idle ? "finished" : "STILL RUNNING") << " on return, drain "
+              << (drained_early ? "returned idle" : "timed out") << " before the job ended and " << (drained ? "returned idle" : "timed out") << " after" << std::endl;
+
+    return finished_on_idle && !drained_early && drained;
+}
+
+// NUMA node queues: a job pushed by a worker waits in its node's queue, and a worker takes its own
+// node's jobs before any other node's. Two nodes are set up by hand, so this runs on any machine.
+static bool checkNumaNodeQueues()
+{
+    auto pool = std::make_shared<thread_pool>();
+    pool->getJobManager().lock()->setNumaNodes(2);
+
+    std::vector<std::shared_ptr<thread_worker>> workers;
+
+    for (int node = 0; node < 2; node++)
+    {
+        workers.push_back(std::make_shared<thread_worker>(job_priority::NORMAL_PRIORITY));
+        workers.back()->setNumaNode(node);
+        pool->addWorker(workers.back());
+    }
+
+    pool->setWorkersPriorityNumbers();
+    pool->setNumaAware(true);
+
+    const int children_per_node = 5;
+
+    std::atomic_int gates_running { 0 };
+    std::atomic_int children_run { 0 };
+    std::atomic_int first_child_node[2] = { -1, -1 };
+
+    // one gate job per worker, both queued before either worker wakes: each pushes its children into
+    // its node's queue, then waits for the other
+    std::vector<std::shared_ptr<job>> gates;
+
+    for (int i = 0; i < 2; i++)
+    {
+        gates.push_back(thread_pool::make_job(job_priority::NORMAL_PRIORITY, [&]() {
+            int node = thread_worker::current()->getNumaNode();
+
+            for (int c = 0; c < children_per_node; c++)
+            {
+                // slow enough that neither worker drains the other node's queue before both gates end
+                pool->submit([&, node]() {
+                    std::this_thread::sleep_for(20ms);
+
+                    int running_node = thread_worker::current()->getNumaNode();
+                    int no_child_yet = -1;
+
+                    first_child_node[running_node].compare_exchange_strong(no_child_yet, node);
+                    children_run++;
+                });
+            }
+
+            gates_running++;
+
+            while (gates_running.load() < 2)
+            {
+                std::this_thread::sleep_for(1ms);
+            }
+        }));
+    }
+
+    bool parked = waitUntilParked(workers);
+
+    pool->addJobs(gates);
+    pool->wait_idle();
+    pool->stopPool(true);
+
+    std::cout << "NUMA: " << children_run.load() << " of " << 2 * children_per_node << " node jobs ran, first ones from nodes "
+              << first_child_node[0].load() << " and " << first_child_node[1].load() << " on workers of nodes 0 and 1" << std::endl;
+
+    return parked && children_run.load() == 2 * children_per_node && first_child_node[0].load() == 0 && first_child_node[1].load() == 1;
+}
+
+int main()
+{
+    std::cout << "Worker Sample Application" << std::endl;
+
+    bool ok = true;
+
+    ok = checkWorkStealing() && ok;
+    ok = checkLeftJobsWakeWorker() && ok;
+    ok = checkSingleWakeUp() && ok;
+    ok = checkSpinnerStandsInOnce() && ok;
+    ok = checkAutoscale() && ok;
+    ok = checkWaitIdle() && ok;
+    ok = checkNumaNodeQueues() && ok;
+
+    std::cout << (ok ? "all worker checks passed" : "worker checks FAILED") << std::endl;
+
+    return ok ? 0 : 1;
+}
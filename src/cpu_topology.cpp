@@ -0,0 +1,227 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace
+{
+	bool readLine(const std::string& path, std::string& line)
+	{
+		std::ifstream file(path);
+
+		return file && std::getline(file, line) && !line.empty();
+	}
+
+	const std::vector<int> no_cpus;
+}
+
+cpu_topology::cpu_topology(const std::string& sysfs_root)
+{
+	std::string line;
+	std::vector<int> cpus;
+
+	if (readLine(sysfs_root + "/cpu/online", line))
+	{
+		cpus = parseCpuList(line);
+	}
+
+	if (cpus.empty())
+	{
+		for (int cpu = 0; cpu < (int)std::max(1u, std::thread::hardware_concurrency()); cpu++)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+
+	int max_cpu = *std::max_element(cpus.begin(), cpus.end());
+	this->_cpu_nodes.assign(max_cpu + 1, 0);
+
+	// nodes without CPUs (memory-only nodes) are kept so node numbers stay the kernel's
+	std::vector<int> nodes;
+
+	if (readLine(sysfs_root + "/node/online", line))
+	{
+		nodes = parseCpuList(line);
+	}
+
+	for (int node : nodes)
+	{
+		if (node >= (int)this->_node_cpus.size())
+		{
+			this->_node_cpus.resize(node + 1);
+		}
+
+		if (!readLine(sysfs_root + "/node/node" + std::to_string(node) + "/cpulist", line))
+		{
+			continue;
+		}
+
+		for (int cpu : parseCpuList(line))
+		{
+			if (std::binary_search(cpus.begin(), cpus.end(), cpu))
+			{
+				this->_node_cpus[node].push_back(cpu);
+				this->_cpu_nodes[cpu] = node;
+			}
+		}
+	}
+
+	if (this->_node_cpus.empty())
+	{
+		this->_node_cpus.push_back(cpus);
+	}
+
+	// SMT siblings share a physical core; the lowest sibling names the core
+	std::map<std::pair<int, int>, std::vector<int>> cores;
+
+	for (int cpu : cpus)
+	{
+		std::vector<int> siblings;
+
+		if (readLine(sysfs_root + "/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list", line))
+		{
+			siblings = parseCpuList(line);
+		}
+
+		int core = siblings.empty() ? cpu : siblings.front();
+		cores[{ this->_cpu_nodes[cpu], core }].push_back(cpu);
+	}
+
+	for (auto& [key, core_cpus] : cores)
+	{
+		this->_physical_cores.push_back(std::move(core_cpus));
+	}
+}
+
+const cpu_topology& cpu_topology::system()
+{
+	static const cpu_topology topology;
+	return topology;
+}
+
+int cpu_topology::getCpuCount() const
+{
+	int count = 0;
+
+	for (auto& cpus : this->_node_cpus)
+	{
+		count += (int)cpus.size();
+	}
+
+	return count;
+}
+
+int cpu_topology::getNodeCount() const
+{
+	return (int)this->_node_cpus.size();
+}
+
+const std::vector<int>& cpu_topology::getNodeCpus(int node) const
+{
+	if (node < 0 || node >= (int)this->_node_cpus.size())
+	{
+		return no_cpus;
+	}
+
+	return this->_node_cpus[node];
+}
+
+int cpu_topology::getNodeOfCpu(int cpu) const
+{
+	if (cpu < 0 || cpu >= (int)this->_cpu_nodes.size())
+	{
+		return 0;
+	}
+
+	return this->_cpu_nodes[cpu];
+}
+
+const std::vector<std::vector<int>>& cpu_topology::getPhysicalCores() const
+{
+	return this->_physical_cores;
+}
+
+int cpu_topology::getCurrentNode() const
+{
+	return this->getNodeOfCpu(getCurrentCpu());
+}
+
+std::vector<int> cpu_topology::parseCpuList(const std::string& cpu_list)
+{
+	std::vector<int> cpus;
+	std::stringstream stream(cpu_list);
+	std::string range;
+
+	while (std::getline(stream, range, ','))
+	{
+		int first = 0;
+		int last = 0;
+		char dash = 0;
+
+		std::stringstream range_stream(range);
+
+		if (!(range_stream >> first))
+		{
+			continue;
+		}
+
+		last = first;
+
+		if (range_stream >> dash && dash == '-')
+		{
+			range_stream >> last;
+		}
+
+		for (int cpu = first; cpu <= last; cpu++)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+
+	std::sort(cpus.begin(), cpus.end());
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+	return cpus;
+}
+
+int cpu_topology::getCurrentCpu()
+{
+#if defined(__linux__)
+	return sched_getcpu();
+#else
+	return -1;
+#endif
+}
+
+bool cpu_topology::pinCurrentThread(const std::vector<int>& cpus)
+{
+#if defined(__linux__)
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+
+	for (int cpu : cpus)
+	{
+		if (cpu >= 0 && cpu < CPU_SETSIZE)
+		{
+			CPU_SET(cpu, &cpu_set);
+		}
+	}
+
+	if (CPU_COUNT(&cpu_set) == 0)
+	{
+		return false;
+	}
+
+	return sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
+#else
+	(void)cpus;
+	return false;
+#endif
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// CPU and NUMA layout of the machine, read from Linux sysfs (/sys/devices/system/{cpu,node}).
+// Without sysfs (other platforms, restricted containers) every CPU reported by
+// std::thread::hardware_concurrency() is its own core on a single node 0.
+class cpu_topology
+{
+public:
+	explicit cpu_topology(const std::string& sysfs_root = "/sys/devices/system");
+
+	// the topology of this machine, read once
+	static const cpu_topology& system();
+
+public:
+	int getCpuCount() const;
+	int getNodeCount() const;
+
+	// online CPUs of a node, empty for an unknown node
+	const std::vector<int>& getNodeCpus(int node) const;
+
+	// node of an online CPU, 0 for an unknown one
+	int getNodeOfCpu(int cpu) const;
+
+	// one entry per physical core holding its SMT siblings, grouped by node
+	const std::vector<std::vector<int>>& getPhysicalCores() const;
+
+	// node of the CPU the calling thread runs on right now, 0 when unknown
+	int getCurrentNode() const;
+
+public:
+	// "0-3,8,10-11" -> { 0, 1, 2, 3, 8, 10, 11 }
+	static std::vector<int> parseCpuList(const std::string& cpu_list);
+
+	// CPU the calling thread runs on, -1 when the platform cannot tell
+	static int getCurrentCpu();
+
+	// restrict the calling thread to the given CPUs; false when unsupported or rejected
+	static bool pinCurrentThread(const std::vector<int>& cpus);
+
+private:
+	std::vector<std::vector<int>> _node_cpus;
+	std::vector<int> _cpu_nodes;
+	std::vector<std::vector<int>> _physical_cores;
+};
@@ -0,0 +1,75 @@
+#include "deadline_queue.h"
+
+#include <algorithm>
+
+deadline_queue::deadline_queue()
+	: _sequence(0), _count(0), _earliest_deadline(0)
+{
+}
+
+deadline_queue::~deadline_queue()
+{
+}
+
+void deadline_queue::push(std::shared_ptr<job> new_job)
+{
+	long long deadline = new_job->getDeadline();
+
+	std::lock_guard<std::mutex> locker(this->_mutex);
+
+	this->_heap.push_back({ deadline, this->_sequence++, std::move(new_job) });
+	std::push_heap(this->_heap.begin(), this->_heap.end(), isLater);
+
+	this->_earliest_deadline.store(this->_heap.front().deadline, std::memory_order_relaxed);
+	this->_count.fetch_add(1, std::memory_order_seq_cst);
+}
+
+std::shared_ptr<job> deadline_queue::pop()
+{
+	if (this->_count.load(std::memory_order_acquire) <= 0)
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> locker(this->_mutex);
+
+	if (this->_heap.empty())
+	{
+		return nullptr;
+	}
+
+	std::pop_heap(this->_heap.begin(), this->_heap.end(), isLater);
+
+	std::shared_ptr<job> out_job = std::move(this->_heap.back().item);
+	this->_heap.pop_back();
+
+	this->_earliest_deadline.store(this->_heap.empty() ? 0 : this->_heap.front().deadline, std::memory_order_relaxed);
+	this->_count.fetch_sub(1, std::memory_order_relaxed);
+
+	return out_job;
+}
+
+int deadline_queue::size()
+{
+	return std::max(this->_count.load(std::memory_order_acquire), 0);
+}
+
+bool deadline_queue::empty()
+{
+	return this->size() == 0;
+}
+
+long long deadline_queue::getEarliestDeadline()
+{
+	return this->_earliest_deadline.load(std::memory_order_relaxed);
+}
+
+bool deadline_queue::isLater(const entry& left, const entry& right)
+{
+	if (left.deadline != right.deadline)
+	{
+		return left.deadline > right.deadline;
+	}
+
+	return left.sequence > right.sequence;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "job.h"
+
+// Earliest-deadline-first queue of jobs: a binary min-heap on (deadline, push order) under a mutex,
+// so push and pop are O(log n) and jobs with equal deadlines leave in FIFO order. The job count and
+// the earliest deadline are kept in atomics, so an empty queue is skipped without taking the lock.
+class deadline_queue
+{
+public:
+	deadline_queue();
+	~deadline_queue();
+
+	deadline_queue(const deadline_queue&) = delete;
+	deadline_queue& operator=(const deadline_queue&) = delete;
+
+public:
+	// job::getDeadline() orders the jobs, it must not change while the job is queued
+	void push(std::shared_ptr<job> new_job);
+	std::shared_ptr<job> pop();
+
+	int size();
+	bool empty();
+
+	// deadline of the job at the top, 0 when empty; may be stale by the time the caller looks at it
+	long long getEarliestDeadline();
+
+private:
+	struct entry
+	{
+		long long deadline;
+		uint64_t sequence;
+		std::shared_ptr<job> item;
+	};
+
+	// heap order for std::push_heap/pop_heap: the earliest deadline ends up at the front
+	static bool isLater(const entry& left, const entry& right);
+
+private:
+	std::mutex _mutex;
+	std::vector<entry> _heap;
+	uint64_t _sequence;
+
+	std::atomic_int _count;
+	std::atomic<long long> _earliest_deadline;
+};
@@ -0,0 +1,93 @@
+#include "flow_queue.h"
+
+#include <algorithm>
+
+flow_queue::flow_queue()
+	: _count(0), _active_weight(0)
+{
+}
+
+flow_queue::~flow_queue()
+{
+}
+
+void flow_queue::push(std::shared_ptr<job> new_job)
+{
+	unsigned long long id = new_job->getFlowId();
+	int weight = std::max(new_job->getFlowWeight(), 1);
+
+	std::lock_guard<std::mutex> locker(this->_mutex);
+
+	auto iter = this->_flows.find(id);
+
+	// a new or idle flow joins at the back of the round
+	if (iter == this->_flows.end())
+	{
+		this->_active_flows.push_back({ id, weight, 0, {} });
+		iter = this->_flows.emplace(id, std::prev(this->_active_flows.end())).first;
+
+		this->_active_weight.fetch_add(weight, std::memory_order_relaxed);
+	}
+	else if (iter->second->weight != weight)
+	{
+		this->_active_weight.fetch_add(weight - iter->second->weight, std::memory_order_relaxed);
+		iter->second->weight = weight;
+	}
+
+	iter->second->jobs.push_back(std::move(new_job));
+	this->_count.fetch_add(1, std::memory_order_seq_cst);
+}
+
+std::shared_ptr<job> flow_queue::pop()
+{
+	if (this->_count.load(std::memory_order_acquire) <= 0)
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> locker(this->_mutex);
+
+	if (this->_active_flows.empty())
+	{
+		return nullptr;
+	}
+
+	flow& current = this->_active_flows.front();
+
+	std::shared_ptr<job> out_job = std::move(current.jobs.front());
+	current.jobs.pop_front();
+	current.served++;
+
+	this->_count.fetch_sub(1, std::memory_order_relaxed);
+
+	if (current.jobs.empty())
+	{
+		// idle: the flow's state goes, it starts a fresh turn when it pushes again
+		this->_active_weight.fetch_sub(current.weight, std::memory_order_relaxed);
+		this->_flows.erase(current.id);
+		this->_active_flows.pop_front();
+	}
+	else if (current.served >= current.weight)
+	{
+		// turn used up: to the back of the round
+		current.served = 0;
+		this->_active_flows.splice(this->_active_flows.end(), this->_active_flows, this->_active_flows.begin());
+	}
+
+	return out_job;
+}
+
+int flow_queue::size()
+{
+	return std::max(this->_count.load(std::memory_order_acquire), 0);
+}
+
+bool flow_queue::empty()
+{
+	return this->size() == 0;
+}
+
+int flow_queue::getActiveWeight()
+{
+	return this->_active_weight.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "job.h"
+
+// Jobs of many flows (tenants) sharing one priority level, served by deficit round robin: the
+// active flows take turns, and a flow of weight w gets w jobs per turn. Push and pop are O(1). A
+// flow's state is created by its first job and released as soon as its last queued job is taken,
+// so idle tenants cost nothing. Guarded by a mutex; the counters are atomics so an empty queue is
+// skipped without taking it.
+class flow_queue
+{
+public:
+	flow_queue();
+	~flow_queue();
+
+	flow_queue(const flow_queue&) = delete;
+	flow_queue& operator=(const flow_queue&) = delete;
+
+public:
+	// the job's flow id and weight (job::setFlow()) pick its flow; the latest weight pushed counts
+	void push(std::shared_ptr<job> new_job);
+	std::shared_ptr<job> pop();
+
+	int size();
+	bool empty();
+
+	// sum of the weights of the flows with queued jobs
+	int getActiveWeight();
+
+private:
+	struct flow
+	{
+		unsigned long long id;
+		int weight;
+
+		// jobs taken in the flow's current turn
+		int served;
+
+		std::deque<std::shared_ptr<job>> jobs;
+	};
+
+private:
+	std::mutex _mutex;
+
+	// active flows in turn order, the front one is being served
+	std::list<flow> _active_flows;
+	std::unordered_map<unsigned long long, std::list<flow>::iterator> _flows;
+
+	std::atomic_int _count;
+	std::atomic_int _active_weight;
+};
@@ -1,33 +1,58 @@
 #include "job.h"
 
+#include <algorithm>
+
+#include "job_manager.h"
+
+cancellation_token::cancellation_token()
+	: _cancelled(std::make_shared<std::atomic_bool>(false))
+{
+}
+
+void cancellation_token::cancel()
+{
+	this->_cancelled->store(true);
+}
+
+bool cancellation_token::isCancelled() const
+{
+	return this->_cancelled->load();
+}
+
 job::job(unsigned long long job_id)
+	: _run_state(run_state::PENDING), _trace_id(0), _job_id_epoch(0), _capacity_index(-1)
 {
 	this->_job_id = job_id;
 	this->_job_priority = job_priority::NORMAL_PRIORITY;
+	this->_enqueue_time = 0;
+	this->_deadline = 0;
+	this->_deadline_policy = deadline_policy::RUN;
+	this->_flow_id = 0;
+	this->_flow_weight = 1;
 	this->_work_function = nullptr;
 }
 
 // Lambda-based constructors
-job::job(unsigned long long job_id, std::function<void()> work_func) :
+job::job(unsigned long long job_id, job_function work_func) :
 	job(job_id)
 {
-	this->_work_function = work_func;
+	this->_work_function = std::move(work_func);
 }
 
-job::job(unsigned long long job_id, job_priority job_priority, std::function<void()> work_func) :
-	job(job_id, work_func)
+job::job(unsigned long long job_id, job_priority job_priority, job_function work_func) :
+	job(job_id, std::move(work_func))
 {
 	this->_job_priority = job_priority;
 }
 
-job::job(std::function<void()> work_func) :
+job::job(job_function work_func) :
 	job(0)
 {
-	this->_work_function = work_func;
+	this->_work_function = std::move(work_func);
 }
 
-job::job(job_priority job_priority, std::function<void()> work_func) :
-	job(work_func)
+job::job(job_priority job_priority, job_function work_func) :
+	job(std::move(work_func))
 {
 	this->_job_priority = job_priority;
 }
@@ -57,11 +82,187 @@ job_priority job::getJobPriority()
 	return this->_job_priority;
 }
 
+void job::setEnqueueTime(long long enqueue_time)
+{
+	this->_enqueue_time = enqueue_time;
+}
+
+long long job::getEnqueueTime()
+{
+	return this->_enqueue_time;
+}
+
+void job::setDeadline(std::chrono::steady_clock::time_point deadline, deadline_policy policy)
+{
+	// same clock as the enqueue times; a deadline at the clock's epoch still counts as one
+	this->_deadline = std::max<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count(), 1);
+	this->_deadline_policy = policy;
+}
+
+void job::setDeadline(const job_deadline& deadline)
+{
+	this->setDeadline(deadline.time, deadline.policy);
+}
+
+long long job::getDeadline()
+{
+	return this->_deadline;
+}
+
+deadline_policy job::getDeadlinePolicy()
+{
+	return this->_deadline_policy;
+}
+
+void job::setFlow(unsigned long long flow_id, int weight)
+{
+	this->_flow_id = flow_id;
+	this->_flow_weight = std::max(weight, 1);
+}
+
+void job::setFlow(const job_flow& flow)
+{
+	this->setFlow(flow.id, flow.weight);
+}
+
+unsigned long long job::getFlowId()
+{
+	return this->_flow_id;
+}
+
+int job::getFlowWeight()
+{
+	return this->_flow_weight;
+}
+
 void job::setJobManager(std::weak_ptr<job_manager> job_manager)
 {
 	this->_job_manager = job_manager;
 }
 
+bool job::cancel()
+{
+	return this->cancelPending();
+}
+
+bool job::isCancelled()
+{
+	return this->_run_state.load() == run_state::CANCELLED;
+}
+
+bool job::isPending()
+{
+	return this->_run_state.load() == run_state::PENDING;
+}
+
+unsigned long long job::getTraceId()
+{
+	static std::atomic<unsigned long long> next_trace_id { 1 };
+
+	unsigned long long trace_id = this->_trace_id.load(std::memory_order_relaxed);
+
+	if (trace_id != 0)
+	{
+		return trace_id;
+	}
+
+	// two threads tracing the job at once agree on the first id stored
+	unsigned long long new_trace_id = next_trace_id.fetch_add(1, std::memory_order_relaxed);
+
+	if (this->_trace_id.compare_exchange_strong(trace_id, new_trace_id, std::memory_order_relaxed))
+	{
+		return new_trace_id;
+	}
+
+	return trace_id;
+}
+
+void job::setCancellationToken(const cancellation_token& token)
+{
+	this->_group_cancelled = token._cancelled;
+}
+
+void job::markQueued()
+{
+	int state = this->_run_state.load();
+
+	// a job pushed again while it runs is pending for the next run; RUNNING -> DONE then leaves it alone
+	while (state != run_state::CANCELLED && state != run_state::PENDING)
+	{
+		if (this->_run_state.compare_exchange_weak(state, run_state::PENDING))
+		{
+			return;
+		}
+	}
+}
+
+bool job::tryStart()
+{
+	if (this->_group_cancelled != nullptr && this->_group_cancelled->load())
+	{
+		this->cancelPending();
+		return false;
+	}
+
+	if (this->_job_id != 0)
+	{
+		std::shared_ptr<job_manager> manager = this->_job_manager.lock();
+
+		if (manager != nullptr && manager->isJobIdCancelled(this->_job_id, this->_job_id_epoch))
+		{
+			this->cancelPending();
+			return false;
+		}
+	}
+
+	int expected = run_state::PENDING;
+
+	return this->_run_state.compare_exchange_strong(expected, run_state::RUNNING);
+}
+
+void job::finishRun()
+{
+	int expected = run_state::RUNNING;
+
+	this->_run_state.compare_exchange_strong(expected, run_state::DONE);
+}
+
+void job::setJobIdEpoch(unsigned long long epoch)
+{
+	this->_job_id_epoch = epoch;
+}
+
+void job::setCapacityIndex(int capacity_index)
+{
+	this->_capacity_index = capacity_index;
+}
+
+int job::takeCapacityIndex()
+{
+	int capacity_index = this->_capacity_index;
+	this->_capacity_index = -1;
+
+	return capacity_index;
+}
+
+bool job::cancelPending()
+{
+	int expected = run_state::PENDING;
+
+	if (!this->_run_state.compare_exchange_strong(expected, run_state::CANCELLED))
+	{
+		return false;
+	}
+
+	this->onCancelled();
+
+	return true;
+}
+
+void job::onCancelled()
+{
+}
+
 std::shared_ptr<job> job::getPtr()
 {
 	return this->shared_from_this();
@@ -76,4 +277,28 @@ void job::work()
 	}
 	// If _work_function is nullptr, this is inheritance pattern
 	// Subclass MUST override work() or behavior is no-op
-}
\ No newline at end of file
+}
+
+job_handle::job_handle(const std::shared_ptr<job>& target)
+	: _job(target), _job_id(target != nullptr ? target->getJobId() : 0)
+{
+}
+
+bool job_handle::cancel()
+{
+	std::shared_ptr<job> target = this->_job.lock();
+
+	return target != nullptr && target->cancel();
+}
+
+bool job_handle::isCancelled() const
+{
+	std::shared_ptr<job> target = this->_job.lock();
+
+	return target != nullptr && target->isCancelled();
+}
+
+unsigned long long job_handle::getJobId() const
+{
+	return this->_job_id;
+}
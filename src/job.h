@@ -1,28 +1,92 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <stdexcept>
 #include <vector>
 #include <functional>
 
-enum job_priority
+#include "job_function.h"
+
+// priority level of a job, 0 is the most urgent. Pools have three levels unless they are built with
+// more (see thread_pool::thread_pool()); the levels below LOW_PRIORITY are job_priority(3), job_priority(4)...
+enum job_priority : int
 {
 	HIGH_PRIORITY,
 	NORMAL_PRIORITY,
 	LOW_PRIORITY,
 };
 
+// what happens to a job dequeued after its deadline, see job::setDeadline()
+enum class deadline_policy : int
+{
+	// run it late (the default)
+	RUN,
+
+	// cancel it: it never runs and its future throws job_cancelled_error
+	DROP,
+};
+
+// deadline of a job submitted with thread_pool::submit(const job_deadline&, ...)
+struct job_deadline
+{
+	std::chrono::steady_clock::time_point time;
+	deadline_policy policy = deadline_policy::RUN;
+
+	template <typename Rep, typename Period>
+	static job_deadline after(std::chrono::duration<Rep, Period> delay, deadline_policy policy = deadline_policy::RUN)
+	{
+		return { std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay), policy };
+	}
+};
+
+// flow (tenant) of a job submitted with thread_pool::submit(const job_flow&, ...), see job::setFlow()
+struct job_flow
+{
+	unsigned long long id;
+	int weight = 1;
+};
+
+// the exception a future reports when its job was cancelled before it ran
+class job_cancelled_error : public std::runtime_error
+{
+public:
+	job_cancelled_error()
+		: std::runtime_error("job was cancelled")
+	{
+	}
+};
+
+// Cancels a group of jobs at once: every job carrying a copy of the token is skipped when it is
+// dequeued after cancel(). Copies share one flag.
+class cancellation_token
+{
+public:
+	cancellation_token();
+
+	void cancel();
+	bool isCancelled() const;
+
+private:
+	friend class job;
+
+	std::shared_ptr<std::atomic_bool> _cancelled;
+};
+
 class thread_worker;
 class job_manager;
+class work_stealing_deque;
 class job : public std::enable_shared_from_this<job>
 {
 public:
 	job(unsigned long long job_id);
 
 	// Lambda-based constructors
-	job(unsigned long long job_id, std::function<void()> work_func);
-	job(unsigned long long job_id, job_priority job_priority, std::function<void()> work_func);
-	job(std::function<void()> work_func);
-	job(job_priority job_priority, std::function<void()> work_func);
+	job(unsigned long long job_id, job_function work_func);
+	job(unsigned long long job_id, job_priority job_priority, job_function work_func);
+	job(job_function work_func);
+	job(job_priority job_priority, job_function work_func);
 
 	virtual ~job();
 
@@ -40,18 +104,120 @@ public:
 public:
 	void setJobManager(std::weak_ptr<job_manager> job_manager);
 
+public:
+	// steady-clock nanoseconds of the last push into a queue, 0 when not recorded
+	void setEnqueueTime(long long enqueue_time);
+	long long getEnqueueTime();
+
+	// earliest-deadline-first scheduling: a job with a deadline waits in its level's deadline queue,
+	// which the level serves earliest deadline first and before its FIFO jobs. Set before the push.
+	void setDeadline(std::chrono::steady_clock::time_point deadline, deadline_policy policy = deadline_policy::RUN);
+	void setDeadline(const job_deadline& deadline);
+
+	// steady-clock nanoseconds, 0 when the job has no deadline
+	long long getDeadline();
+	deadline_policy getDeadlinePolicy();
+
+	// fair queuing: the jobs of a level that carry a flow id (not 0) are served round robin across
+	// flows, `weight` jobs of a flow per turn, so one tenant's flood cannot starve the others.
+	// A deadline takes precedence over the flow. Set before the push.
+	void setFlow(unsigned long long flow_id, int weight = 1);
+	void setFlow(const job_flow& flow);
+	unsigned long long getFlowId();
+	int getFlowWeight();
+
+public:
+	// cancel a job that has not started yet: it is skipped when dequeued and its future (if any)
+	// fails with job_cancelled_error right away. False when it already runs, ran or was cancelled.
+	bool cancel();
+	bool isCancelled();
+
+	// true until the job starts running or is cancelled
+	bool isPending();
+
+	// sequence number of the job in traces (job_tracer), unique per job unlike the job id;
+	// assigned on the job's first traced event
+	unsigned long long getTraceId();
+
+	// join a cancellation group; checked when the job is dequeued
+	void setCancellationToken(const cancellation_token& token);
+
+public:
+	// scheduler side: a push makes the job pending again (unless cancelled), a worker runs it only
+	// when tryStart() wins against cancel(), and calls finishRun() afterwards
+	void markQueued();
+	bool tryStart();
+	void finishRun();
+
+	// job_manager's id-cancel epoch when the job was pushed: a cancelJob() of its id that came later
+	// cancels it in tryStart()
+	void setJobIdEpoch(unsigned long long epoch);
+
+	// priority level whose bounded capacity the queued job holds, -1 when it holds none
+	void setCapacityIndex(int capacity_index);
+	int takeCapacityIndex();
+
 public:
 	std::shared_ptr<job> getPtr();
 
 public:
 	virtual void work();
 
+protected:
+	// called once when the job is cancelled, e.g. to fail its future
+	virtual void onCancelled();
+
+private:
+	enum run_state : int
+	{
+		PENDING,
+		RUNNING,
+		DONE,
+		CANCELLED,
+	};
+
+	bool cancelPending();
+
 private:
 	job_priority _job_priority;
+	long long _enqueue_time;
+	long long _deadline;
+	deadline_policy _deadline_policy;
+	unsigned long long _flow_id;
+	int _flow_weight;
+
+	std::atomic_int _run_state;
+	std::atomic<unsigned long long> _trace_id;
+	std::shared_ptr<std::atomic_bool> _group_cancelled;
+	unsigned long long _job_id_epoch;
+	int _capacity_index;
 
 	std::weak_ptr<job_manager> _job_manager;
 
-	// Lambda work function storage
-	std::function<void()> _work_function;
+	// Lambda work function storage (move-only, small lambdas are stored inline)
+	job_function _work_function;
+
+private:
+	friend class work_stealing_deque;
+
+	// keeps the job alive while a work_stealing_deque stores it as a raw pointer
+	std::shared_ptr<job> _deque_reference;
 };
 
+// handle of a job added to a thread_pool; it does not keep the job alive
+class job_handle
+{
+public:
+	job_handle() = default;
+	explicit job_handle(const std::shared_ptr<job>& target);
+
+	// see job::cancel(); false as well when the job is gone
+	bool cancel();
+	bool isCancelled() const;
+
+	unsigned long long getJobId() const;
+
+private:
+	std::weak_ptr<job> _job;
+	unsigned long long _job_id = 0;
+};
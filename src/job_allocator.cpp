@@ -0,0 +1,313 @@
+#include "job_allocator.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace
+{
+	constexpr size_t slab_size = 64 * 1024;
+	constexpr size_t size_classes[] = { 64, 128, 256, 512, 1024 };
+	constexpr int class_count = (int)(sizeof(size_classes) / sizeof(size_classes[0]));
+
+	constexpr int thread_cache_limit = 64;
+	constexpr int transfer_batch = 32;
+	constexpr size_t reserved_slabs = 1;
+
+	// first block of every slab
+	struct slab_header
+	{
+		size_t block_size;
+		size_t block_count;
+
+		// scratch counters used by trim() while the class mutex is held
+		size_t free_marks;
+		bool releasing;
+	};
+
+	static_assert(sizeof(slab_header) <= 64, "slab header must fit in the smallest block");
+
+	struct free_block
+	{
+		free_block* next;
+	};
+
+	struct size_class_state
+	{
+		std::mutex mutex;
+		free_block* free_list = nullptr;
+		size_t slab_count = 0;
+	};
+
+	struct global_state
+	{
+		size_class_state classes[class_count];
+		std::atomic<size_t> reserved_bytes { 0 };
+	};
+
+	// never destroyed: thread caches may flush into it during static destruction
+	global_state& globalState()
+	{
+		static global_state* state = new global_state();
+		return *state;
+	}
+
+	int classIndex(size_t size)
+	{
+		for (int i = 0; i < class_count; i++)
+		{
+			if (size <= size_classes[i])
+			{
+				return i;
+			}
+		}
+
+		return -1;
+	}
+
+	slab_header* slabOf(void* block)
+	{
+		return reinterpret_cast<slab_header*>(reinterpret_cast<uintptr_t>(block) & ~(uintptr_t)(slab_size - 1));
+	}
+
+	void* allocateSlab()
+	{
+#if defined(_WIN32)
+		return _aligned_malloc(slab_size, slab_size);
+#else
+		return std::aligned_alloc(slab_size, slab_size);
+#endif
+	}
+
+	void freeSlab(void* slab)
+	{
+#if defined(_WIN32)
+		_aligned_free(slab);
+#else
+		std::free(slab);
+#endif
+	}
+
+	// carve a new slab into blocks and prepend them to the class free list (mutex held)
+	bool growClass(int index)
+	{
+		void* memory = allocateSlab();
+
+		if (memory == nullptr)
+		{
+			return false;
+		}
+
+		size_class_state& state = globalState().classes[index];
+		size_t block_size = size_classes[index];
+
+		slab_header* header = static_cast<slab_header*>(memory);
+		header->block_size = block_size;
+		header->block_count = slab_size / block_size - 1;
+		header->free_marks = 0;
+		header->releasing = false;
+
+		char* first = static_cast<char*>(memory) + block_size;
+
+		for (size_t i = 0; i < header->block_count; i++)
+		{
+			free_block* block = reinterpret_cast<free_block*>(first + i * block_size);
+			block->next = state.free_list;
+			state.free_list = block;
+		}
+
+		state.slab_count++;
+		globalState().reserved_bytes.fetch_add(slab_size, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	struct thread_cache
+	{
+		free_block* heads[class_count] = {};
+		int counts[class_count] = {};
+
+		~thread_cache()
+		{
+			this->flush();
+		}
+
+		void flush() noexcept
+		{
+			for (int i = 0; i < class_count; i++)
+			{
+				if (this->counts[i] > 0)
+				{
+					this->release(i, this->counts[i]);
+				}
+			}
+		}
+
+		// move count blocks from the cache to the global free list
+		void release(int index, int count) noexcept
+		{
+			free_block* first = this->heads[index];
+			free_block* last = first;
+
+			for (int i = 1; i < count; i++)
+			{
+				last = last->next;
+			}
+
+			this->heads[index] = last->next;
+			this->counts[index] -= count;
+
+			size_class_state& state = globalState().classes[index];
+			std::lock_guard<std::mutex> locker(state.mutex);
+
+			last->next = state.free_list;
+			state.free_list = first;
+		}
+
+		// move up to transfer_batch blocks from the global free list into the cache
+		bool refill(int index)
+		{
+			size_class_state& state = globalState().classes[index];
+			std::lock_guard<std::mutex> locker(state.mutex);
+
+			if (state.free_list == nullptr && !growClass(index))
+			{
+				return false;
+			}
+
+			for (int i = 0; i < transfer_batch && state.free_list != nullptr; i++)
+			{
+				free_block* block = state.free_list;
+				state.free_list = block->next;
+
+				block->next = this->heads[index];
+				this->heads[index] = block;
+				this->counts[index]++;
+			}
+
+			return true;
+		}
+	};
+
+	thread_local thread_cache local_cache;
+}
+
+void* job_allocator::allocate(size_t size)
+{
+	int index = classIndex(size);
+
+	if (index < 0)
+	{
+		return ::operator new(size);
+	}
+
+	thread_cache& cache = local_cache;
+
+	if (cache.heads[index] == nullptr && !cache.refill(index))
+	{
+		throw std::bad_alloc();
+	}
+
+	free_block* block = cache.heads[index];
+	cache.heads[index] = block->next;
+	cache.counts[index]--;
+
+	return block;
+}
+
+void job_allocator::deallocate(void* memory, size_t size) noexcept
+{
+	if (memory == nullptr)
+	{
+		return;
+	}
+
+	int index = classIndex(size);
+
+	if (index < 0)
+	{
+		::operator delete(memory);
+		return;
+	}
+
+	thread_cache& cache = local_cache;
+
+	free_block* block = static_cast<free_block*>(memory);
+	block->next = cache.heads[index];
+	cache.heads[index] = block;
+	cache.counts[index]++;
+
+	if (cache.counts[index] > thread_cache_limit)
+	{
+		cache.release(index, transfer_batch);
+	}
+}
+
+void job_allocator::flushThreadCache() noexcept
+{
+	local_cache.flush();
+}
+
+void job_allocator::trim() noexcept
+{
+	for (int i = 0; i < class_count; i++)
+	{
+		size_class_state& state = globalState().classes[i];
+		std::vector<slab_header*> released;
+
+		std::lock_guard<std::mutex> locker(state.mutex);
+
+		// count free blocks per slab
+		for (free_block* block = state.free_list; block != nullptr; block = block->next)
+		{
+			slabOf(block)->free_marks++;
+		}
+
+		// drop the blocks of slabs that are completely free
+		free_block* kept = nullptr;
+		free_block* block = state.free_list;
+
+		while (block != nullptr)
+		{
+			free_block* next = block->next;
+			slab_header* header = slabOf(block);
+
+			if (!header->releasing && header->free_marks == header->block_count && state.slab_count - released.size() > reserved_slabs)
+			{
+				header->releasing = true;
+				released.push_back(header);
+			}
+
+			if (!header->releasing)
+			{
+				// any block seen first decides for its slab: mark it kept
+				header->free_marks = 0;
+				block->next = kept;
+				kept = block;
+			}
+
+			block = next;
+		}
+
+		state.free_list = kept;
+		state.slab_count -= released.size();
+
+		for (slab_header* header : released)
+		{
+			freeSlab(header);
+		}
+
+		globalState().reserved_bytes.fetch_sub(released.size() * slab_size, std::memory_order_relaxed);
+	}
+}
+
+size_t job_allocator::getReservedBytes() noexcept
+{
+	return globalState().reserved_bytes.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Slab allocator for jobs and future shared states.
+// Small blocks come from 64KB slabs split into fixed size classes. Each thread keeps a short
+// free-list cache per size class and refills or flushes it in batches against the global lists,
+// so the common allocate/free pair touches no lock. Requests above the largest size class go to
+// the global allocator.
+// The slabs are process-wide: jobs and futures may outlive the pool that created them, and a
+// thread cache may hold blocks of several pools. Pools flush a worker's cache when it parks and
+// trim fully free slabs when every worker is idle.
+class job_allocator
+{
+public:
+	static void* allocate(size_t size);
+	static void deallocate(void* memory, size_t size) noexcept;
+
+	// return the calling thread's cached blocks to the global free lists
+	static void flushThreadCache() noexcept;
+
+	// release slabs whose blocks are all free, keeping a small reserve per size class
+	static void trim() noexcept;
+
+	static size_t getReservedBytes() noexcept;
+};
+
+// std-style allocator backed by job_allocator, for std::allocate_shared and std::promise
+template <typename T>
+class pool_allocator
+{
+public:
+	using value_type = T;
+
+	pool_allocator() noexcept = default;
+
+	template <typename U>
+	pool_allocator(const pool_allocator<U>&) noexcept
+	{
+	}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(job_allocator::allocate(count * sizeof(T)));
+	}
+
+	void deallocate(T* memory, size_t count) noexcept
+	{
+		job_allocator::deallocate(memory, count * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const pool_allocator<U>&) const noexcept
+	{
+		return true;
+	}
+};
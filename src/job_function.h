@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only type-erased void() callable with small-buffer storage.
+// Callables up to inline_size bytes (with a nothrow move) are stored inside the object, so wrapping
+// a typical lambda does not allocate. Larger callables fall back to a single heap allocation.
+class job_function
+{
+public:
+	static constexpr size_t inline_size = 48;
+
+public:
+	job_function() noexcept
+		: _ops(nullptr)
+	{
+	}
+
+	job_function(std::nullptr_t) noexcept
+		: _ops(nullptr)
+	{
+	}
+
+	template <typename F>
+		requires (!std::is_same_v<std::decay_t<F>, job_function>) && std::is_invocable_v<std::decay_t<F>&>
+	job_function(F&& func)
+		: _ops(nullptr)
+	{
+		using stored_type = std::decay_t<F>;
+
+		// an empty std::function or null function pointer makes an empty job_function
+		if constexpr (requires(stored_type& callable) { callable == nullptr; })
+		{
+			if (func == nullptr)
+			{
+				return;
+			}
+		}
+
+		if constexpr (fits_inline<stored_type>())
+		{
+			::new (static_cast<void*>(this->_storage)) stored_type(std::forward<F>(func));
+			this->_ops = &inline_ops<stored_type>;
+		}
+		else
+		{
+			*reinterpret_cast<stored_type**>(this->_storage) = new stored_type(std::forward<F>(func));
+			this->_ops = &heap_ops<stored_type>;
+		}
+	}
+
+	job_function(job_function&& other) noexcept
+		: _ops(nullptr)
+	{
+		this->moveFrom(other);
+	}
+
+	job_function& operator=(job_function&& other) noexcept
+	{
+		if (this != &other)
+		{
+			this->reset();
+			this->moveFrom(other);
+		}
+
+		return *this;
+	}
+
+	job_function& operator=(std::nullptr_t) noexcept
+	{
+		this->reset();
+		return *this;
+	}
+
+	job_function(const job_function&) = delete;
+	job_function& operator=(const job_function&) = delete;
+
+	~job_function()
+	{
+		this->reset();
+	}
+
+public:
+	void operator()()
+	{
+		this->_ops->invoke(this->_storage);
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return this->_ops != nullptr;
+	}
+
+	bool operator==(std::nullptr_t) const noexcept
+	{
+		return this->_ops == nullptr;
+	}
+
+private:
+	struct operations
+	{
+		void (*invoke)(void* storage);
+		void (*move)(void* from, void* to) noexcept;
+		void (*destroy)(void* storage) noexcept;
+	};
+
+	template <typename T>
+	static constexpr bool fits_inline()
+	{
+		return sizeof(T) <= inline_size && alignof(T) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<T>;
+	}
+
+	template <typename T>
+	static constexpr operations inline_ops = {
+		[](void* storage) { std::invoke(*static_cast<T*>(storage)); },
+		[](void* from, void* to) noexcept
+		{
+			::new (to) T(std::move(*static_cast<T*>(from)));
+			static_cast<T*>(from)->~T();
+		},
+		[](void* storage) noexcept { static_cast<T*>(storage)->~T(); },
+	};
+
+	template <typename T>
+	static constexpr operations heap_ops = {
+		[](void* storage) { std::invoke(**static_cast<T**>(storage)); },
+		[](void* from, void* to) noexcept { *static_cast<T**>(to) = *static_cast<T**>(from); },
+		[](void* storage) noexcept { delete *static_cast<T**>(storage); },
+	};
+
+	void moveFrom(job_function& other) noexcept
+	{
+		if (other._ops != nullptr)
+		{
+			other._ops->move(other._storage, this->_storage);
+			this->_ops = other._ops;
+			other._ops = nullptr;
+		}
+	}
+
+	void reset() noexcept
+	{
+		if (this->_ops != nullptr)
+		{
+			this->_ops->destroy(this->_storage);
+			this->_ops = nullptr;
+		}
+	}
+
+private:
+	const operations* _ops;
+	alignas(std::max_align_t) unsigned char _storage[inline_size];
+};
@@ -0,0 +1,407 @@
+#include "job_graph.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+
+#include "job_allocator.h"
+#include "thread_pool.h"
+
+struct job_graph::graph_state
+{
+	std::vector<std::shared_ptr<job>> jobs;
+	std::vector<std::vector<size_t>> successors;
+	std::vector<int> predecessor_counts;
+
+	bool launched = false;
+
+	size_t addNode(std::shared_ptr<job> new_job)
+	{
+		if (this->launched)
+		{
+			throw std::logic_error("job_graph was already submitted");
+		}
+
+		this->jobs.push_back(std::move(new_job));
+		this->successors.emplace_back();
+		this->predecessor_counts.push_back(0);
+
+		return this->jobs.size() - 1;
+	}
+
+	void addEdge(size_t predecessor, size_t successor)
+	{
+		if (this->launched)
+		{
+			throw std::logic_error("job_graph was already submitted");
+		}
+
+		this->successors[predecessor].push_back(successor);
+		this->predecessor_counts[successor]++;
+	}
+
+	// Kahn's algorithm: every node is reachable from a root only when there is no cycle
+	bool isAcyclic()
+	{
+		std::vector<int> counts = this->predecessor_counts;
+		std::vector<size_t> ready;
+
+		for (size_t i = 0; i < counts.size(); i++)
+		{
+			if (counts[i] == 0)
+			{
+				ready.push_back(i);
+			}
+		}
+
+		size_t visited = 0;
+
+		while (!ready.empty())
+		{
+			size_t index = ready.back();
+			ready.pop_back();
+			visited++;
+
+			for (size_t successor : this->successors[index])
+			{
+				if (--counts[successor] == 0)
+				{
+					ready.push_back(successor);
+				}
+			}
+		}
+
+		return visited == counts.size();
+	}
+};
+
+namespace
+{
+	// one submission of a graph; node jobs keep it alive until the last of them has run
+	struct graph_run
+	{
+		std::weak_ptr<thread_pool> pool;
+
+		std::vector<std::shared_ptr<job>> jobs;
+		std::vector<std::vector<size_t>> successors;
+
+		std::unique_ptr<std::atomic_int[]> pending;
+		std::unique_ptr<std::atomic_bool[]> poisoned;
+		std::atomic<size_t> remaining { 0 };
+
+		std::mutex error_mutex;
+		std::exception_ptr first_error;
+
+		std::promise<void> promise;
+
+		void recordError(std::exception_ptr error)
+		{
+			std::lock_guard<std::mutex> locker(this->error_mutex);
+
+			if (this->first_error == nullptr)
+			{
+				this->first_error = error;
+			}
+		}
+
+		// count a node as done and resolve the graph future after the last one
+		void completeNode()
+		{
+			if (this->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			{
+				return;
+			}
+
+			std::lock_guard<std::mutex> locker(this->error_mutex);
+
+			if (this->first_error != nullptr)
+			{
+				this->promise.set_exception(this->first_error);
+			}
+			else
+			{
+				this->promise.set_value();
+			}
+		}
+	};
+
+	class graph_node_job : public job
+	{
+	public:
+		graph_node_job(std::shared_ptr<graph_run> run, size_t index)
+			: job(run->jobs[index]->getJobPriority(), nullptr), _run(std::move(run)), _index(index)
+		{
+			this->setJobId(this->_run->jobs[index]->getJobId());
+		}
+
+		void work() override;
+
+		size_t getIndex() const
+		{
+			return this->_index;
+		}
+
+	protected:
+		// cancelled (by id, or by a full bounded queue) counts as failed, so the graph still settles
+		void onCancelled() override;
+
+	private:
+		std::shared_ptr<graph_run> _run;
+		size_t _index;
+	};
+
+	std::shared_ptr<job> makeNodeJob(const std::shared_ptr<graph_run>& run, size_t index)
+	{
+		return std::allocate_shared<graph_node_job>(pool_allocator<graph_node_job>(), run, index);
+	}
+
+	// release the successors of a finished node; skipped nodes are finished here too, iteratively,
+	// so a long failed chain does not recurse
+	void finishNode(const std::shared_ptr<graph_run>& run, size_t index, bool failed)
+	{
+		std::vector<std::pair<size_t, bool>> finished = { { index, failed } };
+
+		while (!finished.empty())
+		{
+			std::vector<std::shared_ptr<job>> ready;
+
+			while (!finished.empty())
+			{
+				auto [finished_index, finished_failed] = finished.back();
+				finished.pop_back();
+
+				for (size_t successor : run->successors[finished_index])
+				{
+					if (finished_failed)
+					{
+						run->poisoned[successor].store(true, std::memory_order_relaxed);
+					}
+
+					if (run->pending[successor].fetch_sub(1, std::memory_order_acq_rel) != 1)
+					{
+						continue;
+					}
+
+					if (run->poisoned[successor].load(std::memory_order_relaxed))
+					{
+						finished.push_back({ successor, true });
+					}
+					else
+					{
+						ready.push_back(makeNodeJob(run, successor));
+					}
+				}
+
+				// successors are counted before this node, so the graph cannot resolve early
+				run->completeNode();
+			}
+
+			if (ready.empty())
+			{
+				break;
+			}
+
+			std::shared_ptr<thread_pool> pool = run->pool.lock();
+
+			if (pool != nullptr && !pool->isTerminated())
+			{
+				pool->addJobs(ready);
+				break;
+			}
+
+			// nowhere to run them: fail the ready nodes and their successors
+			run->recordError(std::make_exception_ptr(std::runtime_error("thread_pool is terminated")));
+
+			for (auto& ready_job : ready)
+			{
+				finished.push_back({ static_cast<graph_node_job*>(ready_job.get())->getIndex(), true });
+			}
+		}
+	}
+}
+
+void graph_node_job::work()
+{
+	std::shared_ptr<job>& node_job = this->_run->jobs[this->_index];
+	bool failed = false;
+
+	try
+	{
+		// a node job cancelled through its handle, token or id since it was added is skipped
+		if (node_job->tryStart())
+		{
+			node_job->work();
+			node_job->finishRun();
+		}
+		else
+		{
+			this->_run->recordError(std::make_exception_ptr(job_cancelled_error()));
+			failed = true;
+		}
+	}
+	catch (...)
+	{
+		this->_run->recordError(std::current_exception());
+		failed = true;
+	}
+
+	// the node's own job is not needed any more, free its captures now
+	node_job.reset();
+
+	finishNode(this->_run, this->_index, failed);
+}
+
+void graph_node_job::onCancelled()
+{
+	this->_run->recordError(std::make_exception_ptr(job_cancelled_error()));
+	this->_run->jobs[this->_index].reset();
+
+	finishNode(this->_run, this->_index, true);
+}
+
+job_graph::node::node()
+	: _state(nullptr), _index(0)
+{
+}
+
+job_graph::node::node(graph_state* state, size_t index)
+	: _state(state), _index(index)
+{
+}
+
+job_graph::node& job_graph::node::after(const node& predecessor)
+{
+	if (this->_state == nullptr || predecessor._state != this->_state)
+	{
+		throw std::invalid_argument("job_graph nodes must belong to the same graph");
+	}
+
+	this->_state->addEdge(predecessor._index, this->_index);
+
+	return *this;
+}
+
+job_graph::node& job_graph::node::after(std::initializer_list<node> predecessors)
+{
+	for (const node& predecessor : predecessors)
+	{
+		this->after(predecessor);
+	}
+
+	return *this;
+}
+
+job_graph::node& job_graph::node::after(const std::vector<node>& predecessors)
+{
+	for (const node& predecessor : predecessors)
+	{
+		this->after(predecessor);
+	}
+
+	return *this;
+}
+
+size_t job_graph::node::getIndex() const
+{
+	return this->_index;
+}
+
+job_graph::job_graph()
+	: _state(std::make_unique<graph_state>())
+{
+}
+
+job_graph::~job_graph()
+{
+}
+
+job_graph::job_graph(job_graph&& other) noexcept = default;
+job_graph& job_graph::operator=(job_graph&& other) noexcept = default;
+
+job_graph::node job_graph::add(job_function work_function)
+{
+	return this->add(job_priority::NORMAL_PRIORITY, std::move(work_function));
+}
+
+job_graph::node job_graph::add(job_priority priority, job_function work_function)
+{
+	return this->add(std::allocate_shared<job>(pool_allocator<job>(), priority, std::move(work_function)));
+}
+
+job_graph::node job_graph::add(std::shared_ptr<job> new_job)
+{
+	if (new_job == nullptr)
+	{
+		throw std::invalid_argument("job_graph node needs a job");
+	}
+
+	return node(this->_state.get(), this->_state->addNode(std::move(new_job)));
+}
+
+job_graph::node job_graph::when_all(const std::vector<node>& predecessors, job_function work_function, job_priority priority)
+{
+	node joined = this->add(priority, std::move(work_function));
+	joined.after(predecessors);
+
+	return joined;
+}
+
+size_t job_graph::size() const
+{
+	return this->_state->jobs.size();
+}
+
+std::future<void> job_graph::launch(const std::shared_ptr<thread_pool>& pool)
+{
+	std::promise<void> failed;
+
+	if (this->_state->launched)
+	{
+		failed.set_exception(std::make_exception_ptr(std::logic_error("job_graph was already submitted")));
+		return failed.get_future();
+	}
+
+	if (!this->_state->isAcyclic())
+	{
+		failed.set_exception(std::make_exception_ptr(std::invalid_argument("job_graph has a dependency cycle")));
+		return failed.get_future();
+	}
+
+	this->_state->launched = true;
+
+	size_t node_count = this->_state->jobs.size();
+
+	auto run = std::make_shared<graph_run>();
+	run->pool = pool;
+	run->jobs = std::move(this->_state->jobs);
+	run->successors = std::move(this->_state->successors);
+	run->pending = std::make_unique<std::atomic_int[]>(node_count);
+	run->poisoned = std::make_unique<std::atomic_bool[]>(node_count);
+	run->remaining = node_count;
+
+	std::future<void> future = run->promise.get_future();
+
+	if (node_count == 0)
+	{
+		run->promise.set_value();
+		return future;
+	}
+
+	std::vector<std::shared_ptr<job>> roots;
+
+	for (size_t i = 0; i < node_count; i++)
+	{
+		run->pending[i].store(this->_state->predecessor_counts[i], std::memory_order_relaxed);
+		run->poisoned[i].store(false, std::memory_order_relaxed);
+
+		if (this->_state->predecessor_counts[i] == 0)
+		{
+			roots.push_back(makeNodeJob(run, i));
+		}
+	}
+
+	pool->addJobs(roots);
+
+	return future;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <future>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "job.h"
+
+class thread_pool;
+
+// Dependency graph of jobs, submitted to a thread_pool as a whole.
+// Each node counts its unfinished predecessors; the node that finishes last pushes its successor
+// onto the pool, so no worker ever blocks waiting on a dependency. A node that throws fails its
+// successors without running them, and the future returned by thread_pool::submitGraph() carries
+// the first failure once every node has finished or been skipped.
+//
+//	job_graph graph;
+//	auto load = graph.add([] { ... });
+//	auto left = graph.add([] { ... }).after(load);
+//	auto right = graph.add(job_priority::HIGH_PRIORITY, [] { ... }).after(load);
+//	graph.when_all({ left, right }, [] { ... });
+//	pool->submitGraph(graph).get();
+//
+// A graph is a one-shot builder: it can be submitted once.
+class job_graph
+{
+private:
+	struct graph_state;
+
+public:
+	class node
+	{
+	public:
+		node();
+
+		// run this node only after the predecessor(s) finished successfully
+		node& after(const node& predecessor);
+		node& after(std::initializer_list<node> predecessors);
+		node& after(const std::vector<node>& predecessors);
+
+		size_t getIndex() const;
+
+	private:
+		friend class job_graph;
+		node(graph_state* state, size_t index);
+
+		graph_state* _state;
+		size_t _index;
+	};
+
+public:
+	job_graph();
+	~job_graph();
+
+	job_graph(job_graph&& other) noexcept;
+	job_graph& operator=(job_graph&& other) noexcept;
+
+	job_graph(const job_graph&) = delete;
+	job_graph& operator=(const job_graph&) = delete;
+
+public:
+	node add(job_function work_function);
+	node add(job_priority priority, job_function work_function);
+
+	// an existing job (or job subclass) as a node, run with its own priority
+	node add(std::shared_ptr<job> new_job);
+
+	// a node that runs after all predecessors finished
+	node when_all(const std::vector<node>& predecessors, job_function work_function, job_priority priority = job_priority::NORMAL_PRIORITY);
+
+	size_t size() const;
+
+private:
+	friend class thread_pool;
+
+	// push the root nodes onto the pool; the future completes when every node has finished
+	std::future<void> launch(const std::shared_ptr<thread_pool>& pool);
+
+private:
+	std::unique_ptr<graph_state> _state;
+};
@@ -1,116 +1,1371 @@
 #include "job_manager.h"
 
-job_manager::job_manager()
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <thread>
+
+#include "cpu_topology.h"
+#include "job_tracer.h"
+#include "thread_worker.h"
+
+job_manager::job_manager(int priority_levels)
+	: _ready_levels(0), _numa_node_count(0), _numa_routing(false), _node_worker_counts(), _idle_worker_count(0), _idle_chunk_count(0), _idle_slot_count(0), _wake_cursor(0), _capacity_waiters(0), _capacity_waiters_released(false), _job_id_epoch(0), _job_id_cancel_count(0), _in_flight_jobs(0), _idle_waiters(0), _idle_waiters_released(false), _metrics_enabled(true), _aging_threshold_ns(0), _enqueue_time_required(false), _work_stealing(false)
+{
+	this->_workerWakeUpNotification = nullptr;
+
+	priority_levels = std::clamp(priority_levels, 1, max_priority_levels);
+
+	for (int i = 0; i < priority_levels; i++)
+	{
+		this->_priority_job_queues.push_back(std::make_unique<job_queue>());
+		this->_aged_job_queues.push_back(std::make_unique<job_queue>(256));
+		this->_deadline_job_queues.push_back(std::make_unique<deadline_queue>());
+		this->_deadline_miss_counts.push_back(std::make_unique<std::atomic<uint64_t>>(0));
+		this->_flow_job_queues.push_back(std::make_unique<flow_queue>());
+		this->_flow_turns.push_back(std::make_unique<std::atomic<unsigned int>>(0));
+		this->_local_job_counts.push_back(std::make_unique<std::atomic_int>(0));
+		this->_promoted_counts.push_back(std::make_unique<std::atomic<uint64_t>>(0));
+		this->_wait_strategies.push_back(std::make_unique<wait_strategy_setting>());
+		this->_spinning_counts.push_back(std::make_unique<std::atomic_int>(0));
+		this->_capacities.push_back(std::make_unique<capacity_setting>());
+		this->_borrow_levels.push_back(std::make_unique<std::atomic<uint64_t>>(0));
+	}
+
+	this->_enqueued_counts = std::make_unique<enqueue_count[]>(priority_levels * enqueue_count_shards);
+
+	// what the fixed HIGH/NORMAL/LOW tables did: HIGH workers help NORMAL, everybody else helps everybody
+	for (int i = 0; i < priority_levels; i++)
+	{
+		this->setBorrowLevels((job_priority)i, i == 0 ? this->getLevelMask((job_priority)1) : ~0ull);
+	}
+
+	this->_local_queues.store(std::make_shared<const std::vector<std::shared_ptr<work_stealing_deque>>>());
+}
+
+job_manager::~job_manager()
+{
+}
+
+void job_manager::push_job(std::shared_ptr<job> new_job)
+{
+	new_job->setJobManager(this->getPtr());
+
+	int index = this->getQueueIndex(new_job->getJobPriority());
+	int numa_node = -1;
+
+	this->recordEnqueue(new_job, index);
+	this->pushSharedJob(std::move(new_job), index, numa_node);
+
+	this->workerWakeUpNotification((job_priority)index, 1, numa_node);
+}
+
+void job_manager::push_jobs(const std::vector<std::shared_ptr<job>>& new_jobs)
+{
+	std::shared_ptr<job_manager> self = this->getPtr();
+	std::vector<int> pushed_counts(this->_priority_job_queues.size(), 0);
+	int numa_node = -1;
+
+	for (int i = 0; i < (int)new_jobs.size(); i++)
+	{
+		new_jobs[i]->setJobManager(self);
+
+		int index = this->getQueueIndex(new_jobs[i]->getJobPriority());
+
+		this->recordEnqueue(new_jobs[i], index);
+		this->pushSharedJob(new_jobs[i], index, numa_node);
+		pushed_counts[index]++;
+	}
+
+	// one wake-up pass per priority for the whole batch
+	for (int i = 0; i < (int)pushed_counts.size(); i++)
+	{
+		if (pushed_counts[i] > 0)
+		{
+			this->workerWakeUpNotification((job_priority)i, pushed_counts[i], numa_node);
+		}
+	}
+}
+
+std::shared_ptr<job> job_manager::pop_job(job_priority priority, uint64_t levels, int numa_node)
+{
+	int own_index = this->getQueueIndex(priority);
+	uint64_t candidates = this->_ready_levels.load(std::memory_order_acquire) & levels;
+
+	for (uint64_t remaining = candidates; remaining != 0; )
+	{
+		int index = nextLevel(own_index, remaining);
+		remaining &= ~(1ull << index);
+
+		std::shared_ptr<job> job = this->popLocalJob(index, numa_node);
+
+		if (job != nullptr)
+		{
+			return job;
+		}
+	}
+
+	// nothing left on this node: take the other nodes' jobs; a level found empty everywhere leaves the mask
+	for (uint64_t remaining = candidates; remaining != 0; )
+	{
+		int index = nextLevel(own_index, remaining);
+		remaining &= ~(1ull << index);
+
+		std::shared_ptr<job> job = this->popRemoteJob(index, numa_node);
+
+		if (job != nullptr)
+		{
+			return job;
+		}
+
+		this->clearLevelReady(index);
+	}
+
+	return nullptr;
+}
+
+void job_manager::pushSharedJob(std::shared_ptr<job> new_job, int index, int& numa_node)
+{
+	// a job with a deadline is ordered by it, one with a flow waits for its flow's turn,
+	// wherever they were pushed from
+	if (new_job->getDeadline() > 0)
+	{
+		numa_node = -1;
+		this->_deadline_job_queues[index]->push(std::move(new_job));
+	}
+	else if (new_job->getFlowId() != 0)
+	{
+		numa_node = -1;
+		this->_flow_job_queues[index]->push(std::move(new_job));
+	}
+	else
+	{
+		this->getPushQueue(index, numa_node)->push(std::move(new_job));
+	}
+
+	this->markLevelReady(index);
+}
+
+std::shared_ptr<job> job_manager::popDeadlineJob(int index)
+{
+	deadline_queue* queue = this->_deadline_job_queues[index].get();
+
+	while (!queue->empty())
+	{
+		std::shared_ptr<job> job = queue->pop();
+
+		if (job == nullptr)
+		{
+			return nullptr;
+		}
+
+		if (job->getDeadline() >= metricsClockNow())
+		{
+			return job;
+		}
+
+		this->_deadline_miss_counts[index]->fetch_add(1, std::memory_order_relaxed);
+
+		if (job->getDeadlinePolicy() == deadline_policy::RUN)
+		{
+			return job;
+		}
+
+		// too late to be of use: dropped like a cancelled job, and the next deadline is tried
+		this->releaseCapacity(job);
+		job->cancel();
+		this->finishJob();
+	}
+
+	return nullptr;
+}
+
+std::shared_ptr<job> job_manager::popLocalJob(int index, int numa_node)
+{
+	// promoted jobs have waited past the aging threshold already, they go first
+	if (!this->_aged_job_queues[index]->empty())
+	{
+		std::shared_ptr<job> job = this->_aged_job_queues[index]->pop();
+
+		if (job != nullptr)
+		{
+			return job;
+		}
+	}
+
+	// then the earliest deadline
+	std::shared_ptr<job> job = this->popDeadlineJob(index);
+
+	if (job != nullptr)
+	{
+		return job;
+	}
+
+	flow_queue* flows = this->_flow_job_queues[index].get();
+
+	if (flows->empty())
+	{
+		return this->popFifoJob(index, numa_node);
+	}
+
+	// flows and untagged jobs: the untagged ones get one turn per round of all active flow weights
+	bool fifo_turn = this->_flow_turns[index]->fetch_add(1, std::memory_order_relaxed) % (unsigned int)(flows->getActiveWeight() + 1) == 0;
+
+	if (fifo_turn)
+	{
+		job = this->popFifoJob(index, numa_node);
+	}
+
+	if (job == nullptr)
+	{
+		job = flows->pop();
+	}
+
+	if (job == nullptr && !fifo_turn)
+	{
+		job = this->popFifoJob(index, numa_node);
+	}
+
+	return job;
+}
+
+std::shared_ptr<job> job_manager::popFifoJob(int index, int numa_node)
+{
+	job_queue* queues[2] = { this->getNodeQueue(numa_node, index), this->_priority_job_queues[index].get() };
+
+	for (job_queue* queue : queues)
+	{
+		if (queue == nullptr || queue->empty())
+		{
+			continue;
+		}
+
+		std::shared_ptr<job> job = queue->pop();
+
+		if (job != nullptr)
+		{
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+std::shared_ptr<job> job_manager::popRemoteJob(int index, int numa_node)
+{
+	int node_count = this->getNumaNodeCount();
+
+	// nearest node number first
+	for (int offset = 1; offset <= node_count; offset++)
+	{
+		int remote_node = (numa_node + offset) % node_count;
+
+		if (remote_node == numa_node)
+		{
+			continue;
+		}
+
+		job_queue* queue = this->getNodeQueue(remote_node, index);
+
+		if (queue == nullptr || queue->empty())
+		{
+			continue;
+		}
+
+		std::shared_ptr<job> job = queue->pop();
+
+		if (job != nullptr)
+		{
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+int job_manager::nextLevel(int index, uint64_t levels)
+{
+	uint64_t own_bit = 1ull << index;
+
+	if ((levels & own_bit) != 0)
+	{
+		return index;
+	}
+
+	// bits above the own one are the less urgent levels, the lowest of them is the nearest
+	uint64_t lower_levels = levels & ~((own_bit << 1) - 1);
+
+	if (lower_levels != 0)
+	{
+		return std::countr_zero(lower_levels);
+	}
+
+	uint64_t higher_levels = levels & (own_bit - 1);
+
+	if (higher_levels != 0)
+	{
+		return std::bit_width(higher_levels) - 1;
+	}
+
+	return -1;
+}
+
+void job_manager::markLevelReady(int index)
+{
+	// release: a pop that sees the bit also sees the job behind it
+	this->_ready_levels.fetch_or(1ull << index, std::memory_order_acq_rel);
+}
+
+void job_manager::clearLevelReady(int index)
+{
+	this->_ready_levels.fetch_and(~(1ull << index), std::memory_order_acq_rel);
+
+	// a push that landed after our empty check set the bit before we cleared it, put it back
+	if (this->getLevelJobCount(index) > 0)
+	{
+		this->markLevelReady(index);
+	}
+}
+
+int job_manager::getAllJobCount()
+{
+	int count = 0;
+
+	for (int i = 0; i < (int)this->_priority_job_queues.size(); i++)
+	{
+		count += this->getLevelJobCount(i);
+	}
+
+	return count;
+}
+
+int job_manager::getJobCount(uint64_t levels)
+{
+	int total_count = 0;
+
+	levels &= this->getLevelMask((job_priority)-1);
+
+	while (levels != 0)
+	{
+		int index = std::countr_zero(levels);
+		levels &= levels - 1;
+
+		total_count += this->getLevelJobCount(index);
+	}
+
+	return total_count;
+}
+
+int job_manager::getPriorityLevels()
+{
+	return (int)this->_priority_job_queues.size();
+}
+
+uint64_t job_manager::getLevelMask(job_priority priority)
+{
+	int levels = this->getPriorityLevels();
+
+	// a priority outside the levels stands for all of them
+	if (priority < 0 || priority >= levels)
+	{
+		return levels >= 64 ? ~0ull : (1ull << levels) - 1;
+	}
+
+	return 1ull << priority;
+}
+
+void job_manager::setBorrowLevels(job_priority priority, uint64_t levels)
+{
+	int index = this->getQueueIndex(priority);
+
+	// the own level is always served first, it is not part of the borrow mask
+	this->_borrow_levels[index]->store(levels & this->getLevelMask((job_priority)-1) & ~(1ull << index));
+}
+
+uint64_t job_manager::getBorrowLevels(job_priority priority)
+{
+	return this->_borrow_levels[this->getQueueIndex(priority)]->load();
+}
+
+uint64_t job_manager::getJobMatchLevels(job_priority priority, bool reserved)
+{
+	int index = this->getQueueIndex(priority);
+
+	return reserved ? 1ull << index : (1ull << index) | this->_borrow_levels[index]->load();
+}
+
+void job_manager::setWorkerNotification(const std::function<void(job_priority, int, int)>& workerWakeUpNotification)
+{
+	this->_workerWakeUpNotification = workerWakeUpNotification;
+}
+
+int job_manager::getInFlightJobCount()
+{
+	return this->_in_flight_jobs.load();
+}
+
+void job_manager::finishJob()
+{
+	// read before the job counts out: a job pushed once the pool is idle got an epoch at least this
+	unsigned long long job_id_epoch = this->_job_id_epoch.load();
+
+	if (this->_in_flight_jobs.fetch_sub(1) != 1)
+	{
+		return;
+	}
+
+	if (this->_job_id_cancel_count.load() > 0)
+	{
+		this->pruneJobIdCancels(job_id_epoch);
+	}
+
+	if (this->_idle_waiters.load() <= 0)
+	{
+		return;
+	}
+
+	// a waiter registers before it checks the count, so either it sees zero or we see it
+	std::lock_guard<std::mutex> locker(this->_idle_mutex);
+	this->_idle_condition.notify_all();
+}
+
+bool job_manager::waitIdle(std::chrono::steady_clock::time_point deadline)
+{
+	std::unique_lock<std::mutex> locker(this->_idle_mutex);
+
+	auto idle = [this] { return this->_in_flight_jobs.load() <= 0 || this->_idle_waiters_released; };
+
+	this->_idle_waiters++;
+
+	if (deadline == std::chrono::steady_clock::time_point::max())
+	{
+		this->_idle_condition.wait(locker, idle);
+	}
+	else
+	{
+		this->_idle_condition.wait_until(locker, deadline, idle);
+	}
+
+	this->_idle_waiters--;
+
+	return this->_in_flight_jobs.load() <= 0;
+}
+
+void job_manager::releaseIdleWaiters()
+{
+	std::lock_guard<std::mutex> locker(this->_idle_mutex);
+
+	this->_idle_waiters_released = true;
+	this->_idle_condition.notify_all();
+}
+
+void job_manager::cancelJob(unsigned long long job_id)
+{
+	if (job_id == 0)
+	{
+		return;
+	}
+
+	job_id_shard& shard = this->getJobIdShard(job_id);
+	std::lock_guard<std::mutex> locker(shard.mutex);
+
+	// the epoch moves under the shard lock, so a job that sees it moved also sees the entry
+	unsigned long long epoch = ++this->_job_id_epoch;
+
+	if (shard.cancel_epochs.insert_or_assign(job_id, epoch).second)
+	{
+		this->_job_id_cancel_count.fetch_add(1);
+	}
+}
+
+bool job_manager::isJobIdCancelled(unsigned long long job_id, unsigned long long push_epoch)
+{
+	if (this->_job_id_epoch.load() <= push_epoch)
+	{
+		return false;
+	}
+
+	job_id_shard& shard = this->getJobIdShard(job_id);
+	std::lock_guard<std::mutex> locker(shard.mutex);
+
+	auto iter = shard.cancel_epochs.find(job_id);
+
+	return iter != shard.cancel_epochs.end() && push_epoch < iter->second;
+}
+
+void job_manager::pruneJobIdCancels(unsigned long long epoch)
+{
+	for (job_id_shard& shard : this->_job_id_shards)
+	{
+		std::lock_guard<std::mutex> locker(shard.mutex);
+
+		int erased = (int)std::erase_if(shard.cancel_epochs, [epoch](const auto& entry) { return entry.second <= epoch; });
+
+		this->_job_id_cancel_count.fetch_sub(erased);
+	}
+}
+
+job_manager::job_id_shard& job_manager::getJobIdShard(unsigned long long job_id)
+{
+	return this->_job_id_shards[std::hash<unsigned long long>()(job_id) % job_id_shards];
+}
+
+void job_manager::setQueueCapacity(job_priority priority, int capacity, overflow_policy policy)
+{
+	capacity_setting& setting = *this->_capacities[this->getQueueIndex(priority)];
+
+	setting.policy = (int)policy;
+	setting.capacity = std::max(capacity, 0);
+
+	// a raised or removed limit lets blocked producers through
+	std::lock_guard<std::mutex> locker(this->_capacity_mutex);
+	this->_capacity_condition.notify_all();
+}
+
+int job_manager::getQueueCapacity(job_priority priority)
+{
+	return this->_capacities[this->getQueueIndex(priority)]->capacity.load(std::memory_order_relaxed);
+}
+
+overflow_policy job_manager::getOverflowPolicy(job_priority priority)
+{
+	return (overflow_policy)this->_capacities[this->getQueueIndex(priority)]->policy.load(std::memory_order_relaxed);
+}
+
+bool job_manager::tryReserveCapacity(const std::shared_ptr<job>& new_job)
+{
+	int index = this->getQueueIndex(new_job->getJobPriority());
+	capacity_setting& setting = *this->_capacities[index];
+
+	int capacity = setting.capacity.load(std::memory_order_relaxed);
+
+	// unbounded levels do not count their jobs at all
+	if (capacity <= 0)
+	{
+		return true;
+	}
+
+	int reserved = setting.reserved.load(std::memory_order_relaxed);
+
+	do
+	{
+		if (reserved >= capacity)
+		{
+			return false;
+		}
+	} while (!setting.reserved.compare_exchange_weak(reserved, reserved + 1));
+
+	new_job->setCapacityIndex(index);
+
+	return true;
+}
+
+void job_manager::releaseCapacity(const std::shared_ptr<job>& dequeued_job)
+{
+	int index = dequeued_job->takeCapacityIndex();
+
+	if (index < 0)
+	{
+		return;
+	}
+
+	this->_capacities[index]->reserved.fetch_sub(1);
+
+	// a waiter registers before it checks the level, so either it sees the free slot or we see it
+	if (this->_capacity_waiters.load() <= 0)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> locker(this->_capacity_mutex);
+	this->_capacity_condition.notify_all();
+}
+
+bool job_manager::waitForCapacity(job_priority priority, std::chrono::steady_clock::time_point deadline)
+{
+	capacity_setting& setting = *this->_capacities[this->getQueueIndex(priority)];
+
+	std::unique_lock<std::mutex> locker(this->_capacity_mutex);
+
+	auto has_room = [this, &setting]
+	{
+		int capacity = setting.capacity.load();
+		return capacity <= 0 || setting.reserved.load() < capacity || this->_capacity_waiters_released;
+	};
+
+	this->_capacity_waiters++;
+
+	bool room = this->_capacity_condition.wait_until(locker, deadline, has_room);
+
+	this->_capacity_waiters--;
+
+	return room && !this->_capacity_waiters_released;
+}
+
+void job_manager::releaseCapacityWaiters()
+{
+	std::lock_guard<std::mutex> locker(this->_capacity_mutex);
+
+	this->_capacity_waiters_released = true;
+	this->_capacity_condition.notify_all();
+}
+
+bool job_manager::dropOldestJob(job_priority priority)
+{
+	int index = this->getQueueIndex(priority);
+	std::shared_ptr<job> oldest_job = nullptr;
+
+	// only the level's own FIFO and node queues, by enqueue order: the aged queue holds jobs of the
+	// level below, and deadline or flow jobs are served by their own order, not by age
+	for (int attempt = 0; attempt < 16 && oldest_job == nullptr; attempt++)
+	{
+		job_queue* oldest_queue = nullptr;
+		long long oldest = 0;
+
+		for (int node = -1; node < this->getNumaNodeCount(); node++)
+		{
+			job_queue* queue = node < 0 ? this->_priority_job_queues[index].get() : this->getNodeQueue(node, index);
+
+			if (queue->empty())
+			{
+				continue;
+			}
+
+			// unstamped jobs (metrics and aging off) cannot be compared, the first queue with jobs wins
+			long long queue_oldest = queue->getOldestEnqueueTime();
+
+			if (oldest_queue == nullptr || (queue_oldest > 0 && (oldest <= 0 || queue_oldest < oldest)))
+			{
+				oldest_queue = queue;
+				oldest = queue_oldest;
+			}
+		}
+
+		if (oldest_queue == nullptr)
+		{
+			return false;
+		}
+
+		// a worker may take that head first; then the next oldest is looked up again
+		oldest_job = oldest > 0 ? oldest_queue->popEnqueuedBefore(oldest) : oldest_queue->pop();
+	}
+
+	if (oldest_job == nullptr)
+	{
+		return false;
+	}
+
+	this->releaseCapacity(oldest_job);
+	oldest_job->cancel();
+	this->finishJob();
+
+	return true;
+}
+
+int job_manager::cancelQueuedJobs()
+{
+	uint64_t all_levels = this->getLevelMask((job_priority)-1);
+	int cancelled = 0;
+
+	while (true)
+	{
+		std::shared_ptr<job> left_job = this->pop_job(job_priority::HIGH_PRIORITY, all_levels);
+
+		if (left_job == nullptr)
+		{
+			break;
+		}
+
+		this->releaseCapacity(left_job);
+
+		if (left_job->cancel())
+		{
+			cancelled++;
+		}
+
+		this->finishJob();
+	}
+
+	return cancelled;
+}
+
+void job_manager::setWaitStrategy(job_priority priority, const wait_strategy& strategy)
+{
+	wait_strategy_setting& setting = *this->_wait_strategies[this->getQueueIndex(priority)];
+
+	setting.spin_count = std::max(strategy.spin_count, 0);
+	setting.yield_count = std::max(strategy.yield_count, 0);
+	setting.park = strategy.park;
+}
+
+wait_strategy job_manager::getWaitStrategy(job_priority priority)
+{
+	wait_strategy_setting& setting = *this->_wait_strategies[this->getQueueIndex(priority)];
+
+	return { setting.spin_count.load(std::memory_order_relaxed), setting.yield_count.load(std::memory_order_relaxed), setting.park.load(std::memory_order_relaxed) };
+}
+
+void job_manager::addSpinningWorker(job_priority priority)
+{
+	this->_spinning_counts[this->getQueueIndex(priority)]->fetch_add(1);
+}
+
+void job_manager::removeSpinningWorker(job_priority priority)
+{
+	this->_spinning_counts[this->getQueueIndex(priority)]->fetch_sub(1);
+}
+
+int job_manager::registerWorker(thread_worker* worker)
+{
+	std::lock_guard<std::mutex> locker(this->_idle_slot_mutex);
+
+	int slot = 0;
+
+	if (!this->_free_idle_slots.empty())
+	{
+		slot = this->_free_idle_slots.back();
+		this->_free_idle_slots.pop_back();
+	}
+	else
+	{
+		slot = this->_idle_slot_count;
+
+		int chunk = slot / idle_slots_per_chunk;
+
+		if (chunk >= max_idle_chunks)
+		{
+			throw std::length_error("too many workers for one job_manager");
+		}
+
+		if (chunk >= this->_idle_chunk_count.load(std::memory_order_relaxed))
+		{
+			auto new_chunk = std::make_unique<idle_chunk>();
+			new_chunk->idle_masks = std::make_unique<std::atomic<uint64_t>[]>(this->_priority_job_queues.size());
+
+			this->_idle_chunks[chunk] = std::move(new_chunk);
+			this->_idle_chunk_count.store(chunk + 1, std::memory_order_release);
+		}
+
+		this->_idle_slot_count++;
+	}
+
+	this->_idle_chunks[slot / idle_slots_per_chunk]->slots[slot % idle_slots_per_chunk].worker.store(worker);
+
+	return slot;
+}
+
+void job_manager::unregisterWorker(int slot)
+{
+	if (slot < 0)
+	{
+		return;
+	}
+
+	idle_chunk& chunk = *this->_idle_chunks[slot / idle_slots_per_chunk];
+	idle_slot& entry = chunk.slots[slot % idle_slots_per_chunk];
+
+	for (int i = 0; i < (int)this->_priority_job_queues.size(); i++)
+	{
+		chunk.idle_masks[i].fetch_and(~(1ull << (slot % idle_slots_per_chunk)));
+	}
+
+	// a notifier that read the worker before it was cleared is still calling it
+	entry.worker.store(nullptr);
+
+	while (entry.users.load() > 0)
+	{
+		std::this_thread::yield();
+	}
+
+	std::lock_guard<std::mutex> locker(this->_idle_slot_mutex);
+	this->_free_idle_slots.push_back(slot);
+}
+
+int job_manager::addIdleWorker(int slot, uint64_t levels)
+{
+	int idle_count = this->_idle_worker_count.fetch_add(1) + 1;
+
+	if (slot < 0)
+	{
+		return idle_count;
+	}
+
+	idle_chunk& chunk = *this->_idle_chunks[slot / idle_slots_per_chunk];
+	uint64_t bit = 1ull << (slot % idle_slots_per_chunk);
+
+	for (levels &= this->getLevelMask((job_priority)-1); levels != 0; levels &= levels - 1)
+	{
+		chunk.idle_masks[std::countr_zero(levels)].fetch_or(bit);
+	}
+
+	return idle_count;
+}
+
+void job_manager::removeIdleWorker(int slot, uint64_t levels)
 {
-	this->_workerWakeUpNotification = nullptr;
+	if (slot >= 0)
+	{
+		idle_chunk& chunk = *this->_idle_chunks[slot / idle_slots_per_chunk];
+		uint64_t bit = 1ull << (slot % idle_slots_per_chunk);
+
+		for (levels &= this->getLevelMask((job_priority)-1); levels != 0; levels &= levels - 1)
+		{
+			chunk.idle_masks[std::countr_zero(levels)].fetch_and(~bit);
+		}
+	}
+
+	this->_idle_worker_count.fetch_sub(1);
 }
 
-job_manager::~job_manager()
+int job_manager::getIdleWorkerCount()
 {
+	return this->_idle_worker_count.load();
 }
 
-void job_manager::push_job(std::shared_ptr<job> new_job)
+int job_manager::wakeIdleWorkers(job_priority priority, int job_count, int numa_node)
+{
+	int index = this->getQueueIndex(priority);
+	int chunk_count = this->_idle_chunk_count.load(std::memory_order_acquire);
+	unsigned int cursor = this->_wake_cursor.fetch_add(1, std::memory_order_relaxed);
+	int shift = (int)(cursor % idle_slots_per_chunk);
+	int woken = 0;
+
+	// for jobs in a node queue the node's own workers are tried first
+	for (int pass = numa_node >= 0 ? 0 : 1; pass < 2 && woken < job_count; pass++)
+	{
+		for (int i = 0; i < chunk_count && woken < job_count; i++)
+		{
+			idle_chunk& chunk = *this->_idle_chunks[(cursor + i) % chunk_count];
+
+			// rotated, so the bit scan starts at a different slot every time
+			uint64_t idle = std::rotr(chunk.idle_masks[index].load(), shift);
+
+			for (; idle != 0 && woken < job_count; idle &= idle - 1)
+			{
+				int slot = (std::countr_zero(idle) + shift) % idle_slots_per_chunk;
+
+				if (this->tryWakeSlot(chunk.slots[slot], pass == 0 ? numa_node : -1))
+				{
+					woken++;
+				}
+			}
+		}
+	}
+
+	return woken;
+}
+
+bool job_manager::tryWakeSlot(idle_slot& slot, int numa_node)
+{
+	slot.users.fetch_add(1);
+
+	thread_worker* worker = slot.worker.load();
+	bool woken = worker != nullptr && (numa_node < 0 || worker->getNumaNode() == numa_node) && worker->tryWakeUp();
+
+	slot.users.fetch_sub(1);
+
+	return woken;
+}
+
+void job_manager::setWorkStealing(bool enable)
+{
+	this->_work_stealing = enable;
+}
+
+bool job_manager::isWorkStealing()
+{
+	return this->_work_stealing.load(std::memory_order_relaxed);
+}
+
+int job_manager::getRegisteredWorkerCount()
+{
+	return (int)this->_local_queues.load()->size();
+}
+
+void job_manager::registerLocalQueue(std::shared_ptr<work_stealing_deque> local_queue)
+{
+	std::lock_guard<std::mutex> locker(this->_local_queue_mutex);
+
+	auto local_queues = std::make_shared<std::vector<std::shared_ptr<work_stealing_deque>>>(*this->_local_queues.load());
+
+	if (std::find(local_queues->begin(), local_queues->end(), local_queue) != local_queues->end())
+	{
+		return;
+	}
+
+	local_queues->push_back(local_queue);
+	this->_local_queues.store(std::move(local_queues));
+}
+
+void job_manager::unregisterLocalQueue(std::shared_ptr<work_stealing_deque> local_queue)
+{
+	{
+		std::lock_guard<std::mutex> locker(this->_local_queue_mutex);
+
+		auto local_queues = std::make_shared<std::vector<std::shared_ptr<work_stealing_deque>>>(*this->_local_queues.load());
+		auto iter = std::find(local_queues->begin(), local_queues->end(), local_queue);
+
+		if (iter == local_queues->end())
+		{
+			return;
+		}
+
+		local_queues->erase(iter);
+		this->_local_queues.store(std::move(local_queues));
+	}
+
+	// jobs left behind by the owner move to the shared priority queues
+	std::vector<int> moved_counts(this->_priority_job_queues.size(), 0);
+
+	while (true)
+	{
+		std::shared_ptr<job> left_job = local_queue->steal();
+
+		if (left_job == nullptr)
+		{
+			if (local_queue->empty())
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		this->_local_job_counts[local_queue->getOwnerPriority()]->fetch_sub(1);
+
+		int index = this->getQueueIndex(left_job->getJobPriority());
+		this->_priority_job_queues[index]->push(std::move(left_job));
+		this->markLevelReady(index);
+		moved_counts[index]++;
+	}
+
+	// the other workers may all be parked, nothing else would wake them for these jobs
+	for (int i = 0; i < (int)moved_counts.size(); i++)
+	{
+		if (moved_counts[i] > 0)
+		{
+			this->workerWakeUpNotification((job_priority)i, moved_counts[i]);
+		}
+	}
+}
+
+void job_manager::unregisterLocalQueues()
 {
-	std::lock_guard<std::mutex> locker(this->_job_mutex);
+	std::shared_ptr<const std::vector<std::shared_ptr<work_stealing_deque>>> local_queues = this->_local_queues.load();
+
+	for (auto& local_queue : *local_queues)
+	{
+		this->unregisterLocalQueue(local_queue);
+	}
+}
 
+void job_manager::push_local_job(work_stealing_deque* local_queue, std::shared_ptr<job> new_job)
+{
 	new_job->setJobManager(this->getPtr());
+	this->recordEnqueue(new_job, this->getQueueIndex(local_queue->getOwnerPriority()));
+
+	local_queue->push(std::move(new_job));
+	this->_local_job_counts[local_queue->getOwnerPriority()]->fetch_add(1);
+
+	this->workerWakeUpNotification(local_queue->getOwnerPriority(), 1);
+}
 
-	auto iter = this->_priority_job_list.find(new_job->getJobPriority());
+void job_manager::push_local_jobs(work_stealing_deque* local_queue, const std::vector<std::shared_ptr<job>>& new_jobs)
+{
+	std::shared_ptr<job_manager> self = this->getPtr();
 
-	if (iter == this->_priority_job_list.end())
+	for (int i = 0; i < (int)new_jobs.size(); i++)
 	{
-		this->_priority_job_list.insert({ new_job->getJobPriority(), { new_job } });
+		new_jobs[i]->setJobManager(self);
+		this->recordEnqueue(new_jobs[i], this->getQueueIndex(local_queue->getOwnerPriority()));
+
+		local_queue->push(new_jobs[i]);
 	}
-	else
+
+	this->_local_job_counts[local_queue->getOwnerPriority()]->fetch_add((int)new_jobs.size());
+
+	this->workerWakeUpNotification(local_queue->getOwnerPriority(), (int)new_jobs.size());
+}
+
+std::shared_ptr<job> job_manager::take_local_job(work_stealing_deque* local_queue)
+{
+	std::shared_ptr<job> local_job = local_queue->take();
+
+	if (local_job != nullptr)
 	{
-		iter->second.push_back(new_job);
+		this->_local_job_counts[local_queue->getOwnerPriority()]->fetch_sub(1);
 	}
 
-	this->workerWakeUpNotification();
+	return local_job;
 }
 
-std::shared_ptr<job> job_manager::pop_job(std::vector<job_priority> job_priorities)
+std::shared_ptr<job> job_manager::steal_job(work_stealing_deque* thief_queue, uint64_t levels)
 {
-	std::lock_guard<std::mutex> locker(this->_job_mutex);
+	static thread_local unsigned int random_state = (unsigned int)std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1u;
 
-	if ((int)job_priorities.size() <= 0)
+	std::shared_ptr<const std::vector<std::shared_ptr<work_stealing_deque>>> local_queues = this->_local_queues.load();
+	int queue_count = (int)local_queues->size();
+
+	if (queue_count <= 0)
 	{
 		return nullptr;
 	}
 
-	for (int i = 0; i < (int)job_priorities.size(); i++)
+	// xorshift picks a random first victim so thieves spread over the deques
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	int start = (int)(random_state % (unsigned int)queue_count);
+
+	for (int i = 0; i < queue_count; i++)
 	{
-		auto iter = this->_priority_job_list.find(job_priorities[i]);
+		work_stealing_deque* victim = (*local_queues)[(start + i) % queue_count].get();
 
-		if (iter != this->_priority_job_list.end())
+		if (victim == thief_queue || victim->empty())
 		{
-			if ((int)iter->second.size() <= 0)
-			{
-				continue;
-			}
+			continue;
+		}
 
-			std::shared_ptr<job> job = *(iter->second.begin());
-			iter->second.erase(iter->second.begin());
+		if ((levels & this->getLevelMask(victim->getOwnerPriority())) == 0)
+		{
+			continue;
+		}
 
-			return job;
+		std::shared_ptr<job> stolen_job = victim->steal();
+
+		if (stolen_job != nullptr)
+		{
+			this->_local_job_counts[victim->getOwnerPriority()]->fetch_sub(1);
+			return stolen_job;
 		}
 	}
 
 	return nullptr;
 }
 
-int job_manager::getAllJobCount()
+int job_manager::getStealableJobCount(uint64_t levels)
 {
-	std::lock_guard<std::mutex> locker(this->_job_mutex);
+	int total_count = 0;
 
-	int count = 0;
+	for (levels &= this->getLevelMask((job_priority)-1); levels != 0; levels &= levels - 1)
+	{
+		total_count += this->_local_job_counts[std::countr_zero(levels)]->load();
+	}
+
+	return total_count;
+}
+
+void job_manager::setMetricsEnabled(bool enable)
+{
+	this->_metrics_enabled = enable;
+}
+
+bool job_manager::isMetricsEnabled()
+{
+	return this->_metrics_enabled.load(std::memory_order_relaxed);
+}
 
-	for (auto iter = this->_priority_job_list.begin(); iter != this->_priority_job_list.end(); iter++)
+void job_manager::collectMetrics(pool_metrics_snapshot& snapshot)
+{
+	for (int i = 0; i < (int)this->_priority_job_queues.size(); i++)
 	{
-		count += (int)iter->second.size();
+		if (i >= (int)snapshot.priorities.size())
+		{
+			snapshot.priorities.push_back(priority_metrics_snapshot());
+		}
+
+		priority_metrics_snapshot& priority_metrics = snapshot.priorities[i];
+		priority_metrics.priority = (job_priority)i;
+		priority_metrics.enqueued = 0;
+
+		for (int shard = 0; shard < enqueue_count_shards; shard++)
+		{
+			priority_metrics.enqueued += this->_enqueued_counts[i * enqueue_count_shards + shard].count.load(std::memory_order_relaxed);
+		}
+		priority_metrics.queue_depth = this->getLevelJobCount(i) + this->_local_job_counts[i]->load(std::memory_order_relaxed);
+		priority_metrics.promoted = this->_promoted_counts[i]->load(std::memory_order_relaxed);
+		priority_metrics.deadline_missed = this->_deadline_miss_counts[i]->load(std::memory_order_relaxed);
+
+		long long oldest = this->getOldestEnqueueTime((job_priority)i);
+		priority_metrics.oldest_wait_ns = oldest > 0 ? (uint64_t)std::max(0LL, metricsClockNow() - oldest) : 0;
 	}
+}
 
-	return count;
+void job_manager::setAgingThreshold(long long threshold_ns)
+{
+	this->_aging_threshold_ns = threshold_ns > 0 ? threshold_ns : 0;
+}
+
+long long job_manager::getAgingThreshold()
+{
+	return this->_aging_threshold_ns.load(std::memory_order_relaxed);
 }
 
-int job_manager::getJobCount(std::vector<job_priority> job_priorities)
+int job_manager::promoteStarvedJobs()
 {
-	std::lock_guard<std::mutex> locker(this->_job_mutex);
+	long long threshold = this->getAgingThreshold();
 
-	if ((int)this->_priority_job_list.size() <= 0)
+	if (threshold <= 0)
 	{
 		return 0;
 	}
 
-	int total_count = 0;
+	int promoted = 0;
+
+	// an aged job moves to the aged queue of the level above, where it is served before that level's own jobs
+	for (int i = (int)this->_priority_job_queues.size() - 1; i > 0; i--)
+	{
+		job_queue* higher_queue = this->_aged_job_queues[i - 1].get();
+
+		std::vector<job_queue*> queues = { this->_priority_job_queues[i].get() };
+
+		for (int node = 0; node < this->getNumaNodeCount(); node++)
+		{
+			queues.push_back(this->getNodeQueue(node, i));
+		}
+
+		for (job_queue* queue : queues)
+		{
+			for (;;)
+			{
+				long long oldest = queue->getOldestEnqueueTime();
 
-	for (int i = 0; i < (int)job_priorities.size(); i++)
+				if (oldest <= 0 || metricsClockNow() - oldest < threshold)
+				{
+					break;
+				}
+
+				// only the aged head is taken; when a worker popped it first, a younger head stays in place
+				std::shared_ptr<job> aged_job = queue->popEnqueuedBefore(metricsClockNow() - threshold);
+
+				if (aged_job == nullptr)
+				{
+					break;
+				}
+
+				// the job keeps its priority and enqueue time, so metrics still count it at its own level
+				higher_queue->push(std::move(aged_job));
+				this->markLevelReady(i - 1);
+				this->_promoted_counts[i]->fetch_add(1, std::memory_order_relaxed);
+				this->workerWakeUpNotification((job_priority)(i - 1), 1);
+
+				promoted++;
+			}
+		}
+	}
+
+	return promoted;
+}
+
+long long job_manager::getOldestEnqueueTime(job_priority priority)
+{
+	int index = this->getQueueIndex(priority);
+
+	long long oldest = this->_aged_job_queues[index]->getOldestEnqueueTime();
+
+	for (int node = -1; node < this->getNumaNodeCount(); node++)
 	{
-		auto iter = this->_priority_job_list.find(job_priorities[i]);
+		job_queue* queue = node < 0 ? this->_priority_job_queues[index].get() : this->getNodeQueue(node, index);
+		long long queue_oldest = queue->getOldestEnqueueTime();
 
-		if (iter != this->_priority_job_list.end())
+		if (queue_oldest > 0 && (oldest <= 0 || queue_oldest < oldest))
 		{
-			total_count += (int)iter->second.size();
+			oldest = queue_oldest;
 		}
 	}
 
-	return total_count;
+	return oldest;
 }
 
-void job_manager::setWorkerNotification(const std::function<void(void)>& workerWakeUpNotification)
+void job_manager::setEnqueueTimeRequired(bool required)
 {
-	this->_workerWakeUpNotification = workerWakeUpNotification;
+	this->_enqueue_time_required = required;
+}
+
+void job_manager::recordEnqueue(const std::shared_ptr<job>& new_job, int index)
+{
+	// every push passes here, so this is where a job starts to count as in flight
+	this->_in_flight_jobs.fetch_add(1);
+
+	new_job->markQueued();
+
+	if (new_job->getJobId() != 0)
+	{
+		new_job->setJobIdEpoch(this->_job_id_epoch.load());
+	}
+
+	if (job_tracer::isEnabled())
+	{
+		job_tracer::record(trace_event_type::ENQUEUE, new_job->getTraceId(), new_job->getJobPriority());
+	}
+
+	bool metrics_enabled = this->isMetricsEnabled();
+
+	// the starvation watchdog and the autoscaler need the timestamps even when metrics are off
+	if (!metrics_enabled && this->getAgingThreshold() <= 0 && !this->_enqueue_time_required.load(std::memory_order_relaxed))
+	{
+		new_job->setEnqueueTime(0);
+		return;
+	}
+
+	new_job->setEnqueueTime(metricsClockNow());
+
+	if (metrics_enabled)
+	{
+		// producer threads take the shards in turn as they first push
+		static std::atomic_int next_shard { 0 };
+		thread_local int shard = next_shard.fetch_add(1, std::memory_order_relaxed) % enqueue_count_shards;
+
+		this->_enqueued_counts[index * enqueue_count_shards + shard].count.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void job_manager::setNumaNodes(int node_count)
+{
+	std::lock_guard<std::mutex> locker(this->_numa_mutex);
+
+	node_count = std::min(node_count, max_numa_nodes);
+
+	if (this->_numa_node_count.load() > 0 || node_count <= 1)
+	{
+		return;
+	}
+
+	for (int i = 0; i < node_count * (int)this->_priority_job_queues.size(); i++)
+	{
+		this->_node_job_queues.push_back(std::make_unique<job_queue>());
+	}
+
+	this->_numa_node_count.store(node_count, std::memory_order_release);
+}
+
+int job_manager::getNumaNodeCount()
+{
+	return this->_numa_node_count.load(std::memory_order_acquire);
 }
 
-void job_manager::workerWakeUpNotification()
+void job_manager::setNumaRouting(bool enable)
 {
+	this->_numa_routing = enable;
+}
+
+bool job_manager::isNumaRouting()
+{
+	return this->_numa_routing.load(std::memory_order_relaxed);
+}
+
+void job_manager::addNodeWorker(int numa_node)
+{
+	if (numa_node >= 0 && numa_node < max_numa_nodes)
+	{
+		this->_node_worker_counts[numa_node].fetch_add(1);
+	}
+}
+
+void job_manager::removeNodeWorker(int numa_node)
+{
+	if (numa_node >= 0 && numa_node < max_numa_nodes)
+	{
+		this->_node_worker_counts[numa_node].fetch_sub(1);
+	}
+}
+
+job_queue* job_manager::getPushQueue(int index, int& numa_node)
+{
+	numa_node = -1;
+
+	if (!this->isNumaRouting() || this->getNumaNodeCount() <= 0)
+	{
+		return this->_priority_job_queues[index].get();
+	}
+
+	// a worker knows its node, any other thread asks which CPU it is on
+	thread_worker* worker = thread_worker::current();
+	int node = worker != nullptr && worker->getNumaNode() >= 0 ? worker->getNumaNode() : cpu_topology::system().getCurrentNode();
+
+	job_queue* queue = this->getNodeQueue(node, index);
+
+	if (queue == nullptr || this->_node_worker_counts[node].load(std::memory_order_relaxed) <= 0)
+	{
+		return this->_priority_job_queues[index].get();
+	}
+
+	numa_node = node;
+
+	return queue;
+}
+
+job_queue* job_manager::getNodeQueue(int numa_node, int index)
+{
+	if (numa_node < 0 || numa_node >= this->getNumaNodeCount())
+	{
+		return nullptr;
+	}
+
+	return this->_node_job_queues[numa_node * this->_priority_job_queues.size() + index].get();
+}
+
+int job_manager::getNodeJobCount(int index)
+{
+	int count = 0;
+
+	for (int node = 0; node < this->getNumaNodeCount(); node++)
+	{
+		count += this->getNodeQueue(node, index)->size();
+	}
+
+	return count;
+}
+
+int job_manager::getLevelJobCount(int index)
+{
+	return this->_priority_job_queues[index]->size() + this->_aged_job_queues[index]->size() + this->_deadline_job_queues[index]->size()
+		+ this->_flow_job_queues[index]->size() + this->getNodeJobCount(index);
+}
+
+void job_manager::workerWakeUpNotification(job_priority priority, int job_count, int numa_node)
+{
+	// a busy pool has no parked worker to wake
+	if (this->_idle_worker_count.load() <= 0)
+	{
+		return;
+	}
+
+	// enough spinning workers to take every job queued for the level (not just the pushed ones, or a
+	// burst pushed while one worker spins would run on that worker alone); one that stops spinning
+	// checks the queues before it parks
+	int index = this->getQueueIndex(priority);
+	int spinning = this->_spinning_counts[index]->load();
+
+	if (spinning > 0 && spinning >= std::max(job_count, this->getLevelJobCount(index)))
+	{
+		return;
+	}
+
 	if (this->_workerWakeUpNotification != nullptr)
 	{
-		this->_workerWakeUpNotification();
+		this->_workerWakeUpNotification(priority, job_count, numa_node);
+		return;
+	}
+
+	this->wakeIdleWorkers(priority, job_count, numa_node);
+}
+
+int job_manager::getQueueIndex(job_priority priority)
+{
+	int index = (int)priority;
+
+	// unknown priorities are treated as NORMAL_PRIORITY (the only level of a one-level manager)
+	if (index < 0 || index >= (int)this->_priority_job_queues.size())
+	{
+		index = std::min<int>(job_priority::NORMAL_PRIORITY, (int)this->_priority_job_queues.size() - 1);
 	}
+
+	return index;
 }
 
 std::shared_ptr<job_manager> job_manager::getPtr()
 {
 	return this->shared_from_this();
-}
\ No newline at end of file
+}
@@ -1,17 +1,73 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
-#include <vector>
 #include <mutex>
-#include <map>
+#include <unordered_map>
+#include <vector>
 #include <functional>
 
+#include "deadline_queue.h"
+#include "flow_queue.h"
 #include "job.h"
+#include "job_queue.h"
+#include "pool_metrics.h"
+#include "work_stealing_deque.h"
+
+class thread_worker;
+
+// How an idle worker waits for the next job: spin with a CPU pause, then yield the thread, then park
+// on its condition variable. A spinning worker picks up a new job within a few hundred nanoseconds
+// and pushes skip the wake-up while it spins, at the cost of burning its core while there is no work.
+struct wait_strategy
+{
+	int spin_count = 0;
+	int yield_count = 0;
+
+	// false: never park, keep spinning and yielding until a job or a stop arrives
+	bool park = true;
+
+	// park right away (the default)
+	static wait_strategy parking()
+	{
+		return {};
+	}
+
+	static wait_strategy spinThenPark(int spin_count, int yield_count = 0)
+	{
+		return { spin_count, yield_count, true };
+	}
+
+	// latency-critical workers: occupy a core for good
+	static wait_strategy busySpin(int spin_count = 256, int yield_count = 0)
+	{
+		return { spin_count, yield_count, false };
+	}
+};
+
+// what a push into a full bounded priority level does, see job_manager::setQueueCapacity()
+enum class overflow_policy : int
+{
+	// wait for a free slot (a pool worker runs queued jobs meanwhile)
+	BLOCK,
+
+	// cancel the new job right away
+	REJECT,
+
+	// cancel the oldest queued job of the level to make room
+	DROP_OLDEST,
+
+	// run the new job on the pushing thread instead of queueing it
+	CALLER_RUNS,
+};
 
 class job_manager : public std::enable_shared_from_this<job_manager>
 {
 public:
-	job_manager();
+	// priority_levels queues, job_priority(0) .. job_priority(priority_levels - 1), clamped to 1..max_priority_levels
+	explicit job_manager(int priority_levels = 3);
 	virtual ~job_manager();
 
 public:
@@ -19,19 +75,315 @@ public:
 
 public:
 	void push_job(std::shared_ptr<job> new_job);
-	std::shared_ptr<job> pop_job(std::vector<job_priority> job_priorities);
+	void push_jobs(const std::vector<std::shared_ptr<job>>& new_jobs);
+	// take a job of the levels in the mask: the worker's own level first, then the less urgent levels
+	// nearest first, then the more urgent ones nearest first. A worker on a NUMA node takes its own
+	// node's jobs first and other nodes' only when it has none (-1: no node).
+	std::shared_ptr<job> pop_job(job_priority priority, uint64_t levels, int numa_node = -1);
 
 	int getAllJobCount();
-	int getJobCount(std::vector<job_priority> job_priorities);
-	void setWorkerNotification(const std::function<void(void)>& workerWakeUpNotification);
+	int getJobCount(uint64_t levels);
+
+	// level masks: bit i stands for job_priority(i)
+	int getPriorityLevels();
+	uint64_t getLevelMask(job_priority priority);
+
+	// levels the workers of a level take jobs from once their own level is empty. By default the
+	// most urgent level borrows from the next one only and every other level from all levels.
+	void setBorrowLevels(job_priority priority, uint64_t levels);
+	uint64_t getBorrowLevels(job_priority priority);
+
+	// levels a worker of the priority runs; reserved workers only run their own level
+	uint64_t getJobMatchLevels(job_priority priority, bool reserved);
+
+	// called with (priority, job count, NUMA node the jobs went to or -1)
+	void setWorkerNotification(const std::function<void(job_priority, int, int)>& workerWakeUpNotification);
+
+	// queued plus running jobs: a job counts from its push until the worker returns from work()
+	int getInFlightJobCount();
+	void finishJob();
+
+	// block until no job is queued or running; false when the deadline passed or the waiters were released first
+	bool waitIdle(std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
+	// make every waitIdle() return, for a pool that stops with jobs left
+	void releaseIdleWaiters();
+
+	// pop and cancel every job left in the shared queues, for a pool whose workers are gone;
+	// returns the number cancelled
+	int cancelQueuedJobs();
+
+	// cancel every queued job pushed with this id (not 0) before the call. Nothing is indexed per job:
+	// the call records a cancel epoch for the id, and a job is dropped when it is dequeued if its id
+	// was cancelled after its push (see job::tryStart()), so its future fails at that point.
+	void cancelJob(unsigned long long job_id);
+
+	// whether a job with this id pushed at `push_epoch` was cancelled since; lock-free unless some
+	// id was cancelled after the push
+	bool isJobIdCancelled(unsigned long long job_id, unsigned long long push_epoch);
+
+	// bounded queues: at most `capacity` jobs of a priority level wait in its queues (0: unbounded,
+	// the default). A job holds its slot from tryReserveCapacity() until a worker dequeues it.
+	void setQueueCapacity(job_priority priority, int capacity, overflow_policy policy);
+	int getQueueCapacity(job_priority priority);
+	overflow_policy getOverflowPolicy(job_priority priority);
+
+	bool tryReserveCapacity(const std::shared_ptr<job>& new_job);
+	void releaseCapacity(const std::shared_ptr<job>& dequeued_job);
+
+	// block until the job's level has a free slot; false on timeout or after releaseCapacityWaiters()
+	bool waitForCapacity(job_priority priority, std::chrono::steady_clock::time_point deadline);
+	void releaseCapacityWaiters();
+
+	// take the oldest job of a level's FIFO and NUMA node queues and cancel it, false when they are
+	// empty (jobs promoted into the level, deadline and flow jobs are never dropped)
+	bool dropOldestJob(job_priority priority);
+
+	// wait strategy of the workers of one priority
+	void setWaitStrategy(job_priority priority, const wait_strategy& strategy);
+	wait_strategy getWaitStrategy(job_priority priority);
+
+	// workers spinning for jobs, counted for their own priority only: a spinner takes its own level
+	// first, so one spinner counted on every level it borrows would stand in for several parked workers
+	void addSpinningWorker(job_priority priority);
+	void removeSpinningWorker(job_priority priority);
+
+	// idle-worker registry: a worker takes a slot when it joins the manager, and while it is parked
+	// its slot's bit is set in the idle mask of every level it runs. A push claims parked workers
+	// from its level's mask, so it neither locks nor scans the other workers.
+	int registerWorker(thread_worker* worker);
+	void unregisterWorker(int slot);
+
+	// returns the number of parked workers including this one
+	int addIdleWorker(int slot, uint64_t levels);
+	void removeIdleWorker(int slot, uint64_t levels);
+	int getIdleWorkerCount();
+
+	// claim and wake up to job_count parked workers of the priority with thread_worker::tryWakeUp(),
+	// those of numa_node first; returns the number woken
+	int wakeIdleWorkers(job_priority priority, int job_count, int numa_node = -1);
+
+public:
+	// work-stealing mode: workers own a local deque that other workers may steal from
+	void setWorkStealing(bool enable);
+	bool isWorkStealing();
+
+	int getRegisteredWorkerCount();
+	void registerLocalQueue(std::shared_ptr<work_stealing_deque> local_queue);
+	void unregisterLocalQueue(std::shared_ptr<work_stealing_deque> local_queue);
+
+	// unregister every local deque, moving the jobs left in them to the shared queues; used by
+	// stopPool() once the workers are joined, so cancelQueuedJobs() also finds those jobs
+	void unregisterLocalQueues();
+
+	void push_local_job(work_stealing_deque* local_queue, std::shared_ptr<job> new_job);
+	void push_local_jobs(work_stealing_deque* local_queue, const std::vector<std::shared_ptr<job>>& new_jobs);
+	std::shared_ptr<job> take_local_job(work_stealing_deque* local_queue);
+	std::shared_ptr<job> steal_job(work_stealing_deque* thief_queue, uint64_t levels);
+
+	int getStealableJobCount(uint64_t levels);
+
+public:
+	// enqueue counters and push timestamps used by thread_pool::snapshot()
+	void setMetricsEnabled(bool enable);
+	bool isMetricsEnabled();
+	void collectMetrics(pool_metrics_snapshot& snapshot);
+
+public:
+	// jobs waiting longer than the threshold in a shared queue are promoted to the next higher priority
+	void setAgingThreshold(long long threshold_ns);
+	long long getAgingThreshold();
+
+	// promote the aged head jobs of every queue below the highest, returns the number moved
+	int promoteStarvedJobs();
+
+	// enqueue time of the oldest job waiting in a priority's shared queues, 0 when none
+	long long getOldestEnqueueTime(job_priority priority);
+
+	// stamp enqueue times even with metrics and aging off (needed by wait-time based autoscaling)
+	void setEnqueueTimeRequired(bool required);
+
+public:
+	// NUMA mode: jobs pushed from a node that has workers go to that node's queues. The node
+	// queues are created on the first call and kept; turning the mode off only stops routing.
+	void setNumaNodes(int node_count);
+	int getNumaNodeCount();
+	void setNumaRouting(bool enable);
+	bool isNumaRouting();
+
+	// workers announce their node so pushes never land on a node nobody serves
+	void addNodeWorker(int numa_node);
+	void removeNodeWorker(int numa_node);
+
+	static constexpr int max_numa_nodes = 64;
+	static constexpr int max_priority_levels = 64;
+	static constexpr int job_id_shards = 16;
+	static constexpr int enqueue_count_shards = 16;
+	static constexpr int idle_slots_per_chunk = 64;
+	static constexpr int max_idle_chunks = 256;
 
 private:
-	void workerWakeUpNotification();
+	void recordEnqueue(const std::shared_ptr<job>& new_job, int index);
+
+	struct job_id_shard;
+	job_id_shard& getJobIdShard(unsigned long long job_id);
+	void pruneJobIdCancels(unsigned long long epoch);
+	void workerWakeUpNotification(job_priority priority, int job_count, int numa_node = -1);
+
+	// wake the slot's worker if it is parked (and on numa_node, when that is not -1)
+	struct idle_slot;
+	bool tryWakeSlot(idle_slot& slot, int numa_node);
+	int getQueueIndex(job_priority priority);
+
+	// shared queue a push from the calling thread goes to, and its node (-1 for the global queue)
+	job_queue* getPushQueue(int index, int& numa_node);
+	job_queue* getNodeQueue(int numa_node, int index);
+
+	// jobs waiting in the node queues of one priority level
+	int getNodeJobCount(int index);
+	int getLevelJobCount(int index);
+
+	// ready mask upkeep: set after a push into a level's shared queues, cleared when a pop finds them empty
+	void markLevelReady(int index);
+	void clearLevelReady(int index);
+
+	// next level of the mask in pop_job() order for a worker of level `index`, -1 when the mask is empty
+	static int nextLevel(int index, uint64_t levels);
+	std::shared_ptr<job> popLocalJob(int index, int numa_node);
+	std::shared_ptr<job> popRemoteJob(int index, int numa_node);
+
+	// into the level's deadline queue or the shared queue a push from the calling thread goes to
+	void pushSharedJob(std::shared_ptr<job> new_job, int index, int& numa_node);
+
+	// earliest deadline of the level; missed ones are counted and dropped when their policy says so
+	std::shared_ptr<job> popDeadlineJob(int index);
+
+	// the level's FIFO jobs, from the node queue first
+	std::shared_ptr<job> popFifoJob(int index, int numa_node);
 
 private:
-	std::mutex _job_mutex;
-	std::map<job_priority, std::vector<std::shared_ptr<job>>> _priority_job_list;
+	// one lock-free queue per job_priority, indexed by the priority value
+	std::vector<std::unique_ptr<job_queue>> _priority_job_queues;
 
-	std::function<void(void)> _workerWakeUpNotification;
-};
+	// jobs promoted into a level by the starvation watchdog, served before that level's own queue
+	std::vector<std::unique_ptr<job_queue>> _aged_job_queues;
+
+	// jobs with a deadline, earliest first; served after the aged queue and before the FIFO queues
+	std::vector<std::unique_ptr<deadline_queue>> _deadline_job_queues;
+	std::vector<std::unique_ptr<std::atomic<uint64_t>>> _deadline_miss_counts;
+
+	// jobs with a flow id, round robin across flows; the level's untagged FIFO jobs take turns
+	// with them as one more flow of weight 1, counted by the turn counter
+	std::vector<std::unique_ptr<flow_queue>> _flow_job_queues;
+	std::vector<std::unique_ptr<std::atomic<unsigned int>>> _flow_turns;
+
+	// levels whose shared queues (global, aged and node queues) may hold jobs, so a pop finds the
+	// next level to serve with a bit scan however many levels there are
+	std::atomic<uint64_t> _ready_levels;
+	std::vector<std::unique_ptr<std::atomic<uint64_t>>> _borrow_levels;
+
+	// per NUMA node, [node * priority levels + index]; filled once before _numa_node_count is published
+	std::vector<std::unique_ptr<job_queue>> _node_job_queues;
+	std::mutex _numa_mutex;
+	std::atomic_int _numa_node_count;
+	std::atomic_bool _numa_routing;
+	std::atomic_int _node_worker_counts[max_numa_nodes];
 
+	std::function<void(job_priority, int, int)> _workerWakeUpNotification;
+
+	std::atomic_int _idle_worker_count;
+
+	struct idle_slot
+	{
+		std::atomic<thread_worker*> worker { nullptr };
+
+		// notifiers using the worker right now; a leaving worker waits for them to finish
+		std::atomic_int users { 0 };
+	};
+
+	// 64 worker slots, and per level the mask of those slots whose worker is parked
+	struct idle_chunk
+	{
+		idle_slot slots[idle_slots_per_chunk];
+		std::unique_ptr<std::atomic<uint64_t>[]> idle_masks;
+	};
+
+	// chunks are only added, each before _idle_chunk_count is raised past it, so a notifier reads
+	// them without a lock; slots are handed out and taken back under _idle_slot_mutex
+	std::unique_ptr<idle_chunk> _idle_chunks[max_idle_chunks];
+	std::atomic_int _idle_chunk_count;
+	std::mutex _idle_slot_mutex;
+	int _idle_slot_count;
+	std::vector<int> _free_idle_slots;
+
+	// rotates the first slot a notifier tries, so wake-ups spread over the parked workers
+	std::atomic<unsigned int> _wake_cursor;
+
+	struct wait_strategy_setting
+	{
+		std::atomic_int spin_count { 0 };
+		std::atomic_int yield_count { 0 };
+		std::atomic_bool park { true };
+	};
+
+	std::vector<std::unique_ptr<wait_strategy_setting>> _wait_strategies;
+
+	struct capacity_setting
+	{
+		std::atomic_int capacity { 0 };
+		std::atomic_int policy { (int)overflow_policy::BLOCK };
+		std::atomic_int reserved { 0 };
+	};
+
+	// producers blocked on a full level only cost a dequeue the mutex while they wait
+	std::vector<std::unique_ptr<capacity_setting>> _capacities;
+	std::atomic_int _capacity_waiters;
+	std::mutex _capacity_mutex;
+	std::condition_variable _capacity_condition;
+	bool _capacity_waiters_released;
+	std::vector<std::unique_ptr<std::atomic_int>> _spinning_counts;
+
+	// cancelJob(): the epoch of the last cancel of each id, an entry per cancelled id. The entries
+	// are dropped when the pool goes idle, as no job pushed afterwards can be older than them.
+	struct job_id_shard
+	{
+		std::mutex mutex;
+		std::unordered_map<unsigned long long, unsigned long long> cancel_epochs;
+	};
+
+	job_id_shard _job_id_shards[job_id_shards];
+	std::atomic<unsigned long long> _job_id_epoch;
+	std::atomic_int _job_id_cancel_count;
+
+	// finishing the last job only takes the mutex when somebody waits in waitIdle()
+	std::atomic_int _in_flight_jobs;
+	std::atomic_int _idle_waiters;
+	std::mutex _idle_mutex;
+	std::condition_variable _idle_condition;
+	bool _idle_waiters_released;
+
+	std::atomic_bool _metrics_enabled;
+
+	// pushes per level, split into cache-line shards picked per producer thread so producers do not
+	// contend on one counter; collectMetrics() sums the shards. Entry level * shards + shard.
+	struct alignas(64) enqueue_count
+	{
+		std::atomic<uint64_t> count { 0 };
+	};
+
+	std::unique_ptr<enqueue_count[]> _enqueued_counts;
+	std::vector<std::unique_ptr<std::atomic<uint64_t>>> _promoted_counts;
+
+	// 0 when aging is off
+	std::atomic<long long> _aging_threshold_ns;
+	std::atomic_bool _enqueue_time_required;
+
+	std::atomic_bool _work_stealing;
+
+	// registered local deques, replaced copy-on-write so thieves can scan them without a lock
+	std::mutex _local_queue_mutex;
+	std::atomic<std::shared_ptr<const std::vector<std::shared_ptr<work_stealing_deque>>>> _local_queues;
+
+	// number of jobs sitting in local deques, per owner priority
+	std::vector<std::unique_ptr<std::atomic_int>> _local_job_counts;
+};
@@ -0,0 +1,237 @@
+#include "job_queue.h"
+
+#include <climits>
+
+job_queue::job_queue(size_t ring_capacity)
+	: _enqueue_pos(0), _dequeue_pos(0), _count(0), _overflow_count(0)
+{
+	// ring capacity must be a power of two so positions can be masked instead of divided
+	size_t capacity = 2;
+	while (capacity < ring_capacity)
+	{
+		capacity <<= 1;
+	}
+
+	this->_ring = std::make_unique<slot[]>(capacity);
+	this->_ring_mask = capacity - 1;
+
+	for (size_t i = 0; i < capacity; i++)
+	{
+		this->_ring[i].sequence.store(i, std::memory_order_relaxed);
+		this->_ring[i].enqueue_time.store(0, std::memory_order_relaxed);
+	}
+}
+
+job_queue::~job_queue()
+{
+}
+
+void job_queue::push(std::shared_ptr<job> new_job)
+{
+	this->_count.fetch_add(1, std::memory_order_seq_cst);
+
+	// once jobs have spilled, keep appending behind them so FIFO order is preserved
+	if (this->_overflow_count.load(std::memory_order_acquire) <= 0 && this->tryPushRing(new_job))
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> locker(this->_overflow_mutex);
+
+	this->_overflow.push_back(std::move(new_job));
+	this->_overflow_count.fetch_add(1, std::memory_order_release);
+}
+
+std::shared_ptr<job> job_queue::pop()
+{
+	std::shared_ptr<job> out_job = nullptr;
+
+	if (this->tryPopRing(out_job))
+	{
+		this->_count.fetch_sub(1, std::memory_order_relaxed);
+		return out_job;
+	}
+
+	return this->popOverflow(LLONG_MAX);
+}
+
+std::shared_ptr<job> job_queue::popEnqueuedBefore(long long cutoff)
+{
+	size_t pos = this->_dequeue_pos.load(std::memory_order_relaxed);
+
+	for (;;)
+	{
+		slot* cur_slot = &this->_ring[pos & this->_ring_mask];
+		size_t sequence = cur_slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+		if (diff == 0)
+		{
+			// the slot cannot be refilled before it is popped, so a successful CAS takes the job checked here
+			if (cur_slot->enqueue_time.load(std::memory_order_relaxed) > cutoff)
+			{
+				return nullptr;
+			}
+
+			if (this->_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				std::shared_ptr<job> out_job = std::move(cur_slot->item);
+				cur_slot->sequence.store(pos + this->_ring_mask + 1, std::memory_order_release);
+				this->_count.fetch_sub(1, std::memory_order_relaxed);
+
+				return out_job;
+			}
+		}
+		else if (diff < 0)
+		{
+			// ring is empty
+			break;
+		}
+		else
+		{
+			pos = this->_dequeue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	return this->popOverflow(cutoff);
+}
+
+std::shared_ptr<job> job_queue::popOverflow(long long cutoff)
+{
+	if (this->_overflow_count.load(std::memory_order_acquire) <= 0)
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> locker(this->_overflow_mutex);
+
+	if (this->_overflow.empty() || this->_overflow.front()->getEnqueueTime() > cutoff)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<job> out_job = std::move(this->_overflow.front());
+	this->_overflow.pop_front();
+
+	// refill the ring from the overflow list so following pops take the lock-free path again
+	int moved = 1;
+	while (!this->_overflow.empty() && this->tryPushRing(this->_overflow.front()))
+	{
+		this->_overflow.pop_front();
+		moved++;
+	}
+
+	this->_overflow_count.fetch_sub(moved, std::memory_order_release);
+	this->_count.fetch_sub(1, std::memory_order_relaxed);
+
+	return out_job;
+}
+
+int job_queue::size()
+{
+	int count = this->_count.load(std::memory_order_seq_cst);
+
+	return count > 0 ? count : 0;
+}
+
+bool job_queue::empty()
+{
+	return this->size() <= 0;
+}
+
+size_t job_queue::getRingCapacity()
+{
+	return this->_ring_mask + 1;
+}
+
+long long job_queue::getOldestEnqueueTime()
+{
+	size_t pos = this->_dequeue_pos.load(std::memory_order_acquire);
+	slot& head_slot = this->_ring[pos & this->_ring_mask];
+
+	// jobs spill only behind a full ring, so a filled head slot is the oldest job
+	if (head_slot.sequence.load(std::memory_order_acquire) == pos + 1)
+	{
+		return head_slot.enqueue_time.load(std::memory_order_relaxed);
+	}
+
+	if (this->_overflow_count.load(std::memory_order_acquire) <= 0)
+	{
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> locker(this->_overflow_mutex);
+
+	return this->_overflow.empty() ? 0 : this->_overflow.front()->getEnqueueTime();
+}
+
+bool job_queue::tryPushRing(std::shared_ptr<job>& new_job)
+{
+	size_t pos = this->_enqueue_pos.load(std::memory_order_relaxed);
+	slot* cur_slot = nullptr;
+
+	for (;;)
+	{
+		cur_slot = &this->_ring[pos & this->_ring_mask];
+		size_t sequence = cur_slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+		if (diff == 0)
+		{
+			if (this->_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			// ring is full
+			return false;
+		}
+		else
+		{
+			pos = this->_enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	cur_slot->enqueue_time.store(new_job->getEnqueueTime(), std::memory_order_relaxed);
+	cur_slot->item = std::move(new_job);
+	cur_slot->sequence.store(pos + 1, std::memory_order_release);
+
+	return true;
+}
+
+bool job_queue::tryPopRing(std::shared_ptr<job>& out_job)
+{
+	size_t pos = this->_dequeue_pos.load(std::memory_order_relaxed);
+	slot* cur_slot = nullptr;
+
+	for (;;)
+	{
+		cur_slot = &this->_ring[pos & this->_ring_mask];
+		size_t sequence = cur_slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+		if (diff == 0)
+		{
+			if (this->_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			// ring is empty
+			return false;
+		}
+		else
+		{
+			pos = this->_dequeue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	out_job = std::move(cur_slot->item);
+	cur_slot->sequence.store(pos + this->_ring_mask + 1, std::memory_order_release);
+
+	return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "job.h"
+
+// Multi-producer / multi-consumer FIFO of jobs.
+// The fast path is a bounded lock-free ring (sequence-numbered slots), so push and pop are O(1)
+// and never take a lock. When the ring is full, jobs spill into an overflow list so the queue
+// stays unbounded; consumers move spilled jobs back into the ring as it drains.
+class job_queue
+{
+public:
+	job_queue(size_t ring_capacity = 4096);
+	~job_queue();
+
+	job_queue(const job_queue&) = delete;
+	job_queue& operator=(const job_queue&) = delete;
+
+public:
+	void push(std::shared_ptr<job> new_job);
+	std::shared_ptr<job> pop();
+
+	// pop the head only if it was enqueued at or before `cutoff` (job::getEnqueueTime), else leave the
+	// queue as it is; nullptr then. The age check and the pop are one step, so a concurrent pop never
+	// makes it take a younger job instead.
+	std::shared_ptr<job> popEnqueuedBefore(long long cutoff);
+
+	int size();
+	bool empty();
+	size_t getRingCapacity();
+
+	// enqueue time (job::getEnqueueTime) of the job at the head, 0 when empty or not stamped.
+	// The head may be popped concurrently, so this is a hint for the starvation watchdog.
+	long long getOldestEnqueueTime();
+
+private:
+	bool tryPushRing(std::shared_ptr<job>& new_job);
+	bool tryPopRing(std::shared_ptr<job>& out_job);
+	std::shared_ptr<job> popOverflow(long long cutoff);
+
+private:
+	struct slot
+	{
+		std::atomic<size_t> sequence;
+		std::atomic<long long> enqueue_time;
+		std::shared_ptr<job> item;
+	};
+
+	std::unique_ptr<slot[]> _ring;
+	size_t _ring_mask;
+
+	alignas(64) std::atomic<size_t> _enqueue_pos;
+	alignas(64) std::atomic<size_t> _dequeue_pos;
+	alignas(64) std::atomic_int _count;
+
+	std::atomic_int _overflow_count;
+	std::mutex _overflow_mutex;
+	std::deque<std::shared_ptr<job>> _overflow;
+};
@@ -0,0 +1,351 @@
+#include "job_tracer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "pool_metrics.h"
+
+namespace
+{
+	// fields are relaxed atomics so the dump can read a ring while its thread keeps writing
+	struct trace_slot
+	{
+		std::atomic<long long> timestamp { 0 };
+		std::atomic<unsigned long long> trace_id { 0 };
+		std::atomic<uint32_t> kind { 0 };
+	};
+
+	struct trace_ring
+	{
+		int thread_id = 0;
+		std::string thread_name;
+
+		// allocated by the owner on its first event, published by the head store
+		std::unique_ptr<trace_slot[]> slots;
+
+		// number of events ever written, only the owner thread stores it
+		std::atomic<size_t> head { 0 };
+
+		// the owner thread is gone, nothing writes to the ring any more; guarded by the state mutex
+		bool exited = false;
+	};
+
+	struct trace_event
+	{
+		long long timestamp;
+		unsigned long long trace_id;
+		trace_event_type type;
+		job_priority priority;
+	};
+
+	struct tracer_state
+	{
+		std::mutex mutex;
+		std::vector<std::shared_ptr<trace_ring>> rings;
+		int next_thread_id = 1;
+		std::atomic<long long> since { 0 };
+	};
+
+	// never destroyed: worker threads may still record during static destruction
+	tracer_state& tracerState()
+	{
+		static tracer_state* state = new tracer_state();
+		return *state;
+	}
+
+	// an exited thread's ring stays registered until a dump wrote it out; an empty one goes at once,
+	// and beyond max_exited_rings the oldest exited rings are dropped undumped
+	void retireRing(const std::shared_ptr<trace_ring>& ring)
+	{
+		tracer_state& state = tracerState();
+
+		std::lock_guard<std::mutex> locker(state.mutex);
+
+		ring->exited = true;
+
+		if (ring->head.load(std::memory_order_relaxed) == 0)
+		{
+			std::erase(state.rings, ring);
+			return;
+		}
+
+		size_t exited_count = std::count_if(state.rings.begin(), state.rings.end(), [](const std::shared_ptr<trace_ring>& registered) { return registered->exited; });
+
+		for (auto iter = state.rings.begin(); iter != state.rings.end() && exited_count > job_tracer::max_exited_rings; )
+		{
+			if ((*iter)->exited)
+			{
+				iter = state.rings.erase(iter);
+				exited_count--;
+			}
+			else
+			{
+				++iter;
+			}
+		}
+	}
+
+	struct ring_owner
+	{
+		std::shared_ptr<trace_ring> ring;
+
+		~ring_owner()
+		{
+			retireRing(this->ring);
+		}
+	};
+
+	trace_ring& localRing()
+	{
+		thread_local ring_owner owner { []
+		{
+			auto new_ring = std::make_shared<trace_ring>();
+			tracer_state& state = tracerState();
+
+			std::lock_guard<std::mutex> locker(state.mutex);
+
+			new_ring->thread_id = state.next_thread_id++;
+			new_ring->thread_name = "thread " + std::to_string(new_ring->thread_id);
+			state.rings.push_back(new_ring);
+
+			return new_ring;
+		}() };
+
+		return *owner.ring;
+	}
+
+	// copy the events of a ring that are still intact after the copy
+	void readRing(trace_ring& ring, long long since, std::vector<trace_event>& events)
+	{
+		const size_t capacity = job_tracer::events_per_thread;
+
+		size_t head = ring.head.load(std::memory_order_acquire);
+
+		if (head == 0)
+		{
+			return;
+		}
+
+		size_t first = head > capacity ? head - capacity : 0;
+
+		std::vector<trace_event> copied;
+		copied.reserve(head - first);
+
+		for (size_t i = first; i < head; i++)
+		{
+			trace_slot& slot = ring.slots[i % capacity];
+			uint32_t kind = slot.kind.load(std::memory_order_relaxed);
+
+			copied.push_back({ slot.timestamp.load(std::memory_order_relaxed), slot.trace_id.load(std::memory_order_relaxed),
+				(trace_event_type)(kind & 0xff), (job_priority)(kind >> 8) });
+		}
+
+		// slots the owner overwrote while we were copying are dropped, and so is the slot of index
+		// head_after, which it may be writing before publishing head_after + 1
+		size_t head_after = ring.head.load(std::memory_order_acquire);
+		size_t valid_from = head_after >= capacity ? head_after - capacity + 1 : 0;
+
+		for (size_t i = std::max(first, valid_from); i < head; i++)
+		{
+			if (copied[i - first].timestamp >= since)
+			{
+				events.push_back(copied[i - first]);
+			}
+		}
+	}
+
+	std::string priorityName(job_priority priority)
+	{
+		switch (priority)
+		{
+			case job_priority::HIGH_PRIORITY:
+				return "HIGH";
+			case job_priority::NORMAL_PRIORITY:
+				return "NORMAL";
+			case job_priority::LOW_PRIORITY:
+				return "LOW";
+			default:
+				// the unnamed levels of a pool with more than three
+				return "LEVEL " + std::to_string((int)priority);
+		}
+	}
+
+	std::string escapeJson(const std::string& text)
+	{
+		std::string escaped;
+
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+			}
+
+			escaped += c;
+		}
+
+		return escaped;
+	}
+
+	void writeEvent(std::ostream& output, const trace_event& event, int thread_id, bool& first)
+	{
+		const char* name = "job";
+		const char* phase = "i";
+
+		switch (event.type)
+		{
+			case trace_event_type::ENQUEUE:
+				name = "enqueue";
+				break;
+			case trace_event_type::JOB_BEGIN:
+				phase = "B";
+				break;
+			case trace_event_type::JOB_END:
+				phase = "E";
+				break;
+			case trace_event_type::NOTIFY:
+				name = "notify";
+				break;
+			case trace_event_type::PARK:
+				name = "idle";
+				phase = "B";
+				break;
+			case trace_event_type::WAKEUP:
+				name = "idle";
+				phase = "E";
+				break;
+		}
+
+		output << (first ? "" : ",\n") << "{\"name\":\"" << name << "\",\"cat\":\"thread_pool\",\"ph\":\"" << phase << "\"";
+		output << ",\"ts\":" << (event.timestamp / 1000) << "." << (event.timestamp % 1000 / 100) << (event.timestamp % 100 / 10) << (event.timestamp % 10);
+		output << ",\"pid\":1,\"tid\":" << thread_id;
+
+		if (phase[0] == 'i')
+		{
+			output << ",\"s\":\"t\"";
+		}
+
+		if (event.type != trace_event_type::PARK && event.type != trace_event_type::WAKEUP)
+		{
+			output << ",\"args\":{\"job\":" << event.trace_id << ",\"priority\":\"" << priorityName(event.priority) << "\"}";
+		}
+
+		output << "}";
+		first = false;
+	}
+}
+
+void job_tracer::enable()
+{
+	tracerState().since = metricsClockNow();
+	_enabled = true;
+}
+
+void job_tracer::disable()
+{
+	_enabled = false;
+}
+
+void job_tracer::record(trace_event_type type, unsigned long long trace_id, job_priority priority)
+{
+	trace_ring& ring = localRing();
+
+	if (ring.slots == nullptr)
+	{
+		ring.slots.reset(new trace_slot[events_per_thread]);
+	}
+
+	size_t head = ring.head.load(std::memory_order_relaxed);
+	trace_slot& slot = ring.slots[head % events_per_thread];
+
+	slot.timestamp.store(metricsClockNow(), std::memory_order_relaxed);
+	slot.trace_id.store(trace_id, std::memory_order_relaxed);
+	slot.kind.store((uint32_t)type | ((uint32_t)priority << 8), std::memory_order_relaxed);
+
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+void job_tracer::setThreadName(const std::string& name)
+{
+	trace_ring& ring = localRing();
+
+	std::lock_guard<std::mutex> locker(tracerState().mutex);
+	ring.thread_name = name;
+}
+
+void job_tracer::writeChromeTrace(std::ostream& output)
+{
+	tracer_state& state = tracerState();
+	long long since = state.since.load();
+
+	std::vector<std::shared_ptr<trace_ring>> rings;
+	std::vector<std::string> names;
+	std::vector<std::shared_ptr<trace_ring>> exited_rings;
+
+	{
+		std::lock_guard<std::mutex> locker(state.mutex);
+
+		rings = state.rings;
+
+		for (auto& ring : rings)
+		{
+			names.push_back(ring->thread_name);
+
+			if (ring->exited)
+			{
+				exited_rings.push_back(ring);
+			}
+		}
+	}
+
+	output << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+	bool first = true;
+
+	for (size_t i = 0; i < rings.size(); i++)
+	{
+		std::vector<trace_event> events;
+		readRing(*rings[i], since, events);
+
+		if (events.empty())
+		{
+			continue;
+		}
+
+		output << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << rings[i]->thread_id
+			<< ",\"args\":{\"name\":\"" << escapeJson(names[i]) << "\"}}";
+		first = false;
+
+		for (const trace_event& event : events)
+		{
+			writeEvent(output, event, rings[i]->thread_id, first);
+		}
+	}
+
+	output << "\n]}\n";
+
+	// rings of exited threads are complete once written out
+	std::lock_guard<std::mutex> locker(state.mutex);
+
+	for (const std::shared_ptr<trace_ring>& exited_ring : exited_rings)
+	{
+		std::erase(state.rings, exited_ring);
+	}
+}
+
+bool job_tracer::writeChromeTrace(const std::string& path)
+{
+	std::ofstream file(path);
+
+	if (!file)
+	{
+		return false;
+	}
+
+	writeChromeTrace(file);
+
+	return (bool)file;
+}
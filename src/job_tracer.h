@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "job.h"
+
+// Timeline tracing of job execution, exported as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// Every thread that records an event gets its own fixed-size ring buffer written without locks;
+// when a ring is full the oldest events are overwritten. The ring of an exited thread is freed by
+// the next dump, or earlier when too many exited threads (retired workers, producers) pile up.
+// Tracing is process-wide like job_allocator: jobs and producers are not tied to one pool. While
+// disabled every hook costs one relaxed load and a predictable branch.
+enum class trace_event_type : uint8_t
+{
+	ENQUEUE,		// job pushed into a queue (on the producer thread)
+	JOB_BEGIN,		// job::work() started
+	JOB_END,		// job::work() returned
+	NOTIFY,			// a parked worker was claimed for a wake-up (on the notifier thread)
+	PARK,			// worker went to sleep
+	WAKEUP			// worker woke up
+};
+
+class job_tracer
+{
+public:
+	// start recording; events recorded before the last enable() are left out of the dump
+	static void enable();
+	static void disable();
+
+	static bool isEnabled()
+	{
+		return _enabled.load(std::memory_order_relaxed);
+	}
+
+	// trace_id is job::getTraceId() for job events, 0 for the others
+	static void record(trace_event_type type, unsigned long long trace_id, job_priority priority);
+
+	// name shown for the calling thread's track
+	static void setThreadName(const std::string& name);
+
+	// write every recorded event as one Chrome trace JSON document
+	static void writeChromeTrace(std::ostream& output);
+	static bool writeChromeTrace(const std::string& path);
+
+	// events each thread keeps before overwriting the oldest
+	static constexpr size_t events_per_thread = 1 << 16;
+
+	// rings of exited threads kept for the next dump; a dump frees the ones it wrote out
+	static constexpr size_t max_exited_rings = 16;
+
+private:
+	inline static std::atomic_bool _enabled { false };
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Data-parallel loops on top of thread_pool.
+// The range is handed out in chunks claimed from a shared counter. Chunks shrink as the range
+// drains (guided self-scheduling: remaining / (2 * participants), never below the grain), so big
+// ranges pay few claims and the tail still balances across workers. The calling thread works on
+// chunks too, and only blocks for chunks other workers are still running.
+
+template <std::integral Index>
+class parallel_range_state
+{
+public:
+	parallel_range_state(Index first, Index last, Index grain, int participants)
+		: _next(first), _last(last), _grain(grain), _participants(participants), _done(0), _failed(false)
+	{
+		this->_total = (size_t)(last - first);
+	}
+
+	// claim the next chunk, returns false once the range is exhausted
+	bool claim(Index& chunk_first, Index& chunk_last)
+	{
+		Index current = this->_next.load(std::memory_order_relaxed);
+
+		do
+		{
+			if (current >= this->_last)
+			{
+				return false;
+			}
+
+			Index size = std::max<Index>(this->_grain, (Index)((this->_last - current) / (2 * this->_participants)));
+			chunk_first = current;
+			chunk_last = (this->_last - current) > size ? (Index)(current + size) : this->_last;
+		} while (!this->_next.compare_exchange_weak(current, chunk_last, std::memory_order_relaxed));
+
+		return true;
+	}
+
+	void complete(Index chunk_first, Index chunk_last)
+	{
+		size_t done = this->_done.fetch_add((size_t)(chunk_last - chunk_first), std::memory_order_acq_rel) + (size_t)(chunk_last - chunk_first);
+
+		if (done >= this->_total)
+		{
+			this->_done.notify_all();
+		}
+	}
+
+	void fail(std::exception_ptr error)
+	{
+		std::lock_guard<std::mutex> locker(this->_error_mutex);
+
+		if (this->_error == nullptr)
+		{
+			this->_error = error;
+		}
+
+		this->_failed = true;
+	}
+
+	bool failed()
+	{
+		return this->_failed.load(std::memory_order_relaxed);
+	}
+
+	// block until every claimed chunk has completed, then rethrow the first failure
+	void wait()
+	{
+		size_t done = this->_done.load(std::memory_order_acquire);
+
+		while (done < this->_total)
+		{
+			this->_done.wait(done, std::memory_order_acquire);
+			done = this->_done.load(std::memory_order_acquire);
+		}
+
+		if (this->_error != nullptr)
+		{
+			std::rethrow_exception(this->_error);
+		}
+	}
+
+private:
+	std::atomic<Index> _next;
+	Index _last;
+	Index _grain;
+	int _participants;
+
+	size_t _total;
+	std::atomic<size_t> _done;
+
+	std::mutex _error_mutex;
+	std::exception_ptr _error;
+	std::atomic_bool _failed;
+};
+
+namespace parallel_detail
+{
+	template <std::integral Index>
+	Index chooseGrain(Index first, Index last, Index grain, int participants)
+	{
+		if (grain > 0)
+		{
+			return grain;
+		}
+
+		// aim for about 32 chunks per participant at the start of the range
+		Index automatic = (Index)((last - first) / (participants * 32));
+
+		return automatic > 0 ? automatic : 1;
+	}
+
+	// run chunks on the calling thread and on up to `helpers` pool workers
+	template <std::integral Index, typename RunChunk>
+	void runChunks(const std::shared_ptr<thread_pool>& pool, Index first, Index last, Index grain, job_priority priority, RunChunk& run_chunk)
+	{
+		int helpers = pool->getWorkerNumbers();
+		int participants = helpers + 1;
+
+		grain = chooseGrain(first, last, grain, participants);
+
+		// no more helpers than there are chunks beyond the caller's first one
+		Index chunks = (Index)((last - first + grain - 1) / grain);
+		helpers = (int)std::min<Index>((Index)helpers, chunks - 1);
+
+		auto state = std::make_shared<parallel_range_state<Index>>(first, last, grain, participants);
+
+		auto work_loop = [state, &run_chunk]()
+		{
+			Index chunk_first;
+			Index chunk_last;
+
+			while (state->claim(chunk_first, chunk_last))
+			{
+				if (!state->failed())
+				{
+					try
+					{
+						run_chunk(chunk_first, chunk_last);
+					}
+					catch (...)
+					{
+						state->fail(std::current_exception());
+					}
+				}
+
+				state->complete(chunk_first, chunk_last);
+			}
+		};
+
+		// helpers that start after the range is exhausted return without touching run_chunk
+		std::vector<std::shared_ptr<job>> helper_jobs;
+
+		for (int i = 0; i < helpers; i++)
+		{
+			helper_jobs.push_back(thread_pool::make_job(priority, work_loop));
+		}
+
+		pool->addJobs(helper_jobs);
+
+		work_loop();
+		state->wait();
+	}
+}
+
+template <std::integral Index, typename F>
+void parallel_for(const std::shared_ptr<thread_pool>& pool, Index first, Index last, F&& func, Index grain = 0,
+	job_priority priority = job_priority::NORMAL_PRIORITY)
+{
+	if (first >= last)
+	{
+		return;
+	}
+
+	auto run_chunk = [&func](Index chunk_first, Index chunk_last)
+	{
+		for (Index i = chunk_first; i < chunk_last; i++)
+		{
+			func(i);
+		}
+	};
+
+	parallel_detail::runChunks(pool, first, last, grain, priority, run_chunk);
+}
+
+// reduce(reduce(...), ...) over map(i) for every i in [first, last), combined in index order,
+// so reduce only has to be associative
+template <std::integral Index, typename T, typename Map, typename Reduce>
+T parallel_reduce(const std::shared_ptr<thread_pool>& pool, Index first, Index last, T init, Map&& map, Reduce&& reduce,
+	Index grain = 0, job_priority priority = job_priority::NORMAL_PRIORITY)
+{
+	if (first >= last)
+	{
+		return init;
+	}
+
+	std::mutex partial_mutex;
+	std::vector<std::pair<Index, T>> partials;
+
+	auto run_chunk = [&](Index chunk_first, Index chunk_last)
+	{
+		T partial = map(chunk_first);
+
+		for (Index i = chunk_first + 1; i < chunk_last; i++)
+		{
+			partial = reduce(std::move(partial), map(i));
+		}
+
+		std::lock_guard<std::mutex> locker(partial_mutex);
+		partials.emplace_back(chunk_first, std::move(partial));
+	};
+
+	parallel_detail::runChunks(pool, first, last, grain, priority, run_chunk);
+
+	std::sort(partials.begin(), partials.end(), [](const auto& left, const auto& right) { return left.first < right.first; });
+
+	T result = std::move(init);
+
+	for (auto& partial : partials)
+	{
+		result = reduce(std::move(result), std::move(partial.second));
+	}
+
+	return result;
+}
@@ -0,0 +1,91 @@
+#include "pool_metrics.h"
+
+#include <algorithm>
+#include <bit>
+
+double histogram_snapshot::meanNs() const
+{
+	return this->count > 0 ? (double)this->sum_ns / (double)this->count : 0.0;
+}
+
+uint64_t histogram_snapshot::percentileNs(double fraction) const
+{
+	if (this->count == 0)
+	{
+		return 0;
+	}
+
+	uint64_t target = (uint64_t)(fraction * (double)this->count);
+	uint64_t seen = 0;
+
+	for (int i = 0; i < bucket_count; i++)
+	{
+		seen += this->buckets[i];
+
+		if (seen > target)
+		{
+			uint64_t upper = i == 0 ? 0 : ((uint64_t)1 << i) - 1;
+			return std::min(upper, this->max_ns);
+		}
+	}
+
+	return this->max_ns;
+}
+
+void histogram_snapshot::merge(const histogram_snapshot& other)
+{
+	this->count += other.count;
+	this->sum_ns += other.sum_ns;
+	this->max_ns = std::max(this->max_ns, other.max_ns);
+
+	for (int i = 0; i < bucket_count; i++)
+	{
+		this->buckets[i] += other.buckets[i];
+	}
+}
+
+latency_histogram::latency_histogram()
+	: _count(0), _sum_ns(0), _max_ns(0)
+{
+	for (int i = 0; i < histogram_snapshot::bucket_count; i++)
+	{
+		this->_buckets[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void latency_histogram::record(long long nanoseconds)
+{
+	uint64_t value = nanoseconds > 0 ? (uint64_t)nanoseconds : 0;
+	int bucket = std::min((int)std::bit_width(value), histogram_snapshot::bucket_count - 1);
+
+	increment(this->_buckets[bucket], 1);
+	increment(this->_count, 1);
+	increment(this->_sum_ns, value);
+
+	if (value > this->_max_ns.load(std::memory_order_relaxed))
+	{
+		this->_max_ns.store(value, std::memory_order_relaxed);
+	}
+}
+
+void latency_histogram::mergeInto(histogram_snapshot& snapshot) const
+{
+	histogram_snapshot local;
+
+	local.count = this->_count.load(std::memory_order_relaxed);
+	local.sum_ns = this->_sum_ns.load(std::memory_order_relaxed);
+	local.max_ns = this->_max_ns.load(std::memory_order_relaxed);
+
+	for (int i = 0; i < histogram_snapshot::bucket_count; i++)
+	{
+		local.buckets[i] = this->_buckets[i].load(std::memory_order_relaxed);
+	}
+
+	snapshot.merge(local);
+}
+
+void latency_histogram::increment(std::atomic<uint64_t>& counter, uint64_t value)
+{
+	// single writer: a relaxed load/store pair is enough and avoids a locked instruction
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "job.h"
+
+// Runtime metrics of a thread_pool.
+// Counters live next to the code that updates them (job_manager for enqueues, each thread_worker
+// for the jobs it runs) and are updated with relaxed atomics; thread_pool::snapshot() merges them
+// into the plain structs below without stopping the pool.
+
+inline long long metricsClockNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct histogram_snapshot
+{
+	// bucket i counts samples in [2^(i-1), 2^i) nanoseconds, bucket 0 counts zero
+	static constexpr int bucket_count = 48;
+
+	uint64_t count = 0;
+	uint64_t sum_ns = 0;
+	uint64_t max_ns = 0;
+	std::array<uint64_t, bucket_count> buckets {};
+
+	double meanNs() const;
+
+	// upper bound of the bucket holding the given fraction of samples (0.5 = p50, 0.99 = p99)
+	uint64_t percentileNs(double fraction) const;
+
+	void merge(const histogram_snapshot& other);
+};
+
+// log2-bucketed histogram of nanosecond durations written by a single thread
+class latency_histogram
+{
+public:
+	latency_histogram();
+
+	void record(long long nanoseconds);
+	void mergeInto(histogram_snapshot& snapshot) const;
+
+private:
+	static void increment(std::atomic<uint64_t>& counter, uint64_t value);
+
+private:
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum_ns;
+	std::atomic<uint64_t> _max_ns;
+	std::atomic<uint64_t> _buckets[histogram_snapshot::bucket_count];
+};
+
+struct priority_metrics_snapshot
+{
+	job_priority priority = job_priority::NORMAL_PRIORITY;
+
+	uint64_t enqueued = 0;
+	uint64_t executed = 0;
+	int queue_depth = 0;
+
+	// jobs of this level moved up by the starvation watchdog, and the age of the oldest queued job
+	uint64_t promoted = 0;
+	uint64_t oldest_wait_ns = 0;
+
+	// jobs with a deadline dequeued after it, whether their policy ran or dropped them
+	uint64_t deadline_missed = 0;
+
+	// time from push to start, and time spent in work()
+	histogram_snapshot wait_time;
+	histogram_snapshot run_time;
+};
+
+struct worker_metrics_snapshot
+{
+	job_priority priority = job_priority::NORMAL_PRIORITY;
+
+	uint64_t jobs_executed = 0;
+	uint64_t busy_ns = 0;
+	uint64_t idle_ns = 0;
+
+	// busy / (busy + idle)
+	double utilisation = 0.0;
+};
+
+struct pool_metrics_snapshot
+{
+	std::vector<priority_metrics_snapshot> priorities;
+	std::vector<worker_metrics_snapshot> workers;
+};
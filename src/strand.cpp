@@ -0,0 +1,220 @@
+#include "strand.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+
+#include "thread_pool.h"
+
+namespace
+{
+	// jobs a drain job runs before it hands the worker back to the pool's other jobs
+	constexpr int drain_batch_size = 32;
+}
+
+struct strand::strand_state
+{
+	std::shared_ptr<thread_pool> pool;
+	job_priority priority;
+
+	std::mutex mutex;
+	std::deque<std::shared_ptr<job>> jobs;
+
+	// a drain job is queued or running; only it takes jobs off the queue
+	bool scheduled = false;
+
+	static thread_local strand_state* running_state;
+
+	// run up to one batch, true when jobs are left for the next drain job
+	bool drain()
+	{
+		strand_state* outer_state = running_state;
+		running_state = this;
+
+		for (int i = 0; i < drain_batch_size; i++)
+		{
+			std::shared_ptr<job> next_job;
+
+			{
+				std::lock_guard<std::mutex> locker(this->mutex);
+
+				if (this->jobs.empty())
+				{
+					this->scheduled = false;
+					running_state = outer_state;
+					return false;
+				}
+
+				next_job = std::move(this->jobs.front());
+				this->jobs.pop_front();
+			}
+
+			// a job cancelled while queued is skipped
+			if (next_job->tryStart())
+			{
+				next_job->work();
+				next_job->finishRun();
+			}
+		}
+
+		running_state = outer_state;
+
+		std::lock_guard<std::mutex> locker(this->mutex);
+
+		this->scheduled = !this->jobs.empty();
+
+		return this->scheduled;
+	}
+
+	void cancelQueued()
+	{
+		std::deque<std::shared_ptr<job>> cancelled_jobs;
+
+		{
+			std::lock_guard<std::mutex> locker(this->mutex);
+
+			cancelled_jobs.swap(this->jobs);
+			this->scheduled = false;
+		}
+
+		for (auto& cancelled_job : cancelled_jobs)
+		{
+			cancelled_job->cancel();
+		}
+	}
+};
+
+thread_local strand::strand_state* strand::strand_state::running_state = nullptr;
+
+// runs one batch of the strand and queues its successor while jobs are left
+class strand::drain_job : public job
+{
+public:
+	drain_job(job_priority job_priority, std::shared_ptr<strand_state> state)
+		: job(job_priority, nullptr), _state(std::move(state))
+	{
+	}
+
+	void work() override
+	{
+		// while the level is full the successor is refused, and this drain job runs the next batch
+		// itself: queued through the overflow policy, CALLER_RUNS would nest it on this stack
+		while (this->_state->drain())
+		{
+			if (strand::scheduleSuccessor(this->_state))
+			{
+				return;
+			}
+		}
+	}
+
+protected:
+	void onCancelled() override
+	{
+		this->_state->cancelQueued();
+	}
+
+private:
+	std::shared_ptr<strand_state> _state;
+};
+
+strand::strand(std::shared_ptr<thread_pool> pool, job_priority priority)
+	: _priority(priority), _state(std::make_shared<strand_state>())
+{
+	this->_state->pool = std::move(pool);
+	this->_state->priority = priority;
+}
+
+strand::~strand()
+{
+}
+
+job_handle strand::post(job_function work_function)
+{
+	return this->post(thread_pool::make_job(this->_priority, std::move(work_function)));
+}
+
+job_handle strand::post(std::shared_ptr<job> new_job)
+{
+	job_handle handle(new_job);
+	bool first = false;
+
+	{
+		std::lock_guard<std::mutex> locker(this->_state->mutex);
+
+		this->_state->jobs.push_back(std::move(new_job));
+
+		first = !this->_state->scheduled;
+		this->_state->scheduled = true;
+	}
+
+	// the queue was idle: nothing runs it until a drain job is queued
+	if (first)
+	{
+		schedule(this->_state);
+	}
+
+	return handle;
+}
+
+bool strand::runningInThisThread()
+{
+	return strand_state::running_state == this->_state.get();
+}
+
+int strand::getQueuedCount()
+{
+	std::lock_guard<std::mutex> locker(this->_state->mutex);
+
+	return (int)this->_state->jobs.size();
+}
+
+void strand::schedule(const std::shared_ptr<strand_state>& state)
+{
+	std::shared_ptr<job> next_drain = thread_pool::make_job<drain_job>(state->priority, state);
+
+	// a stopped pool cancels it, and the strand's jobs with it, instead of leaving them queued
+	state->pool->addJob(std::move(next_drain));
+}
+
+bool strand::scheduleSuccessor(const std::shared_ptr<strand_state>& state)
+{
+	std::shared_ptr<job> next_drain = thread_pool::make_job<drain_job>(state->priority, state);
+
+	if (state->pool->tryAddJob(std::move(next_drain)))
+	{
+		return true;
+	}
+
+	// a stopped pool cancels the strand's jobs, as it would have cancelled the successor
+	if (state->pool->isTerminated())
+	{
+		state->cancelQueued();
+		return true;
+	}
+
+	return false;
+}
+
+keyed_strand::keyed_strand(std::shared_ptr<thread_pool> pool, int strand_count, job_priority priority)
+{
+	strand_count = std::max(strand_count, 1);
+
+	for (int i = 0; i < strand_count; i++)
+	{
+		this->_strands.push_back(std::make_unique<strand>(pool, priority));
+	}
+}
+
+int keyed_strand::getStrandCount()
+{
+	return (int)this->_strands.size();
+}
+
+size_t keyed_strand::getStrandIndex(uint64_t hash)
+{
+	// Fibonacci hashing: the high bits of the product depend on every bit of the key
+	hash *= 0x9e3779b97f4a7c15ull;
+
+	return (size_t)((hash >> 32) % this->_strands.size());
+}
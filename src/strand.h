@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "job.h"
+#include "job_allocator.h"
+#include "task_job.h"
+
+class thread_pool;
+
+// Serial executor on a thread_pool: jobs posted to one strand run one at a time, in post order, on
+// whichever worker is free, while different strands run in parallel. Per-entity ordering (a session,
+// an account) then needs no lock inside work(), and no worker ever blocks on another one.
+//
+//	strand session(pool);
+//	session.post([&] { apply(first_update); });
+//	session.post([&] { apply(second_update); });		// runs after the first, maybe on another worker
+//	auto total = session.submit([&] { return balance(); });
+//
+// An idle strand holds no thread: the first post schedules one drain job on the pool, which runs the
+// queued jobs (a batch at a time, so other work is not shut out) and ends when the queue is empty.
+// When the strand's level is full, the drain job goes on with the next batch instead of queuing a
+// successor.
+// Jobs run at the strand's priority whatever their own. A job cancelled while queued is skipped; when
+// the drain job is cancelled (e.g. by the pool's overflow policy or a stopped pool) every job queued in
+// the strand is cancelled with it.
+class strand
+{
+private:
+	struct strand_state;
+	class drain_job;
+
+public:
+	explicit strand(std::shared_ptr<thread_pool> pool, job_priority priority = job_priority::NORMAL_PRIORITY);
+
+	// queued jobs still run after the strand object is gone
+	~strand();
+
+	strand(const strand&) = delete;
+	strand& operator=(const strand&) = delete;
+
+public:
+	job_handle post(job_function work_function);
+	job_handle post(std::shared_ptr<job> new_job);
+
+	template <typename F, typename... Args>
+	auto submit(F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		using return_type = std::invoke_result_t<F, Args...>;
+
+		auto call = [func = std::forward<F>(func), args_tuple = std::make_tuple(std::forward<Args>(args)...)]() mutable -> return_type
+			{
+				return std::apply(std::move(func), std::move(args_tuple));
+			};
+
+		auto task = std::allocate_shared<task_job<return_type, decltype(call)>>(pool_allocator<task_job<return_type, decltype(call)>>(),
+			this->_priority, std::move(call));
+		auto future = task->getFuture();
+
+		this->post(std::move(task));
+
+		return future;
+	}
+
+	// true on the thread that is running one of this strand's jobs right now
+	bool runningInThisThread();
+
+	// jobs posted and not started yet
+	int getQueuedCount();
+
+private:
+	// push a drain job for the queued jobs onto the pool
+	static void schedule(const std::shared_ptr<strand_state>& state);
+
+	// queue the next drain job without blocking or running it inline; false when the level is full
+	static bool scheduleSuccessor(const std::shared_ptr<strand_state>& state);
+
+private:
+	job_priority _priority;
+	std::shared_ptr<strand_state> _state;
+};
+
+// A fixed set of strands indexed by a hash of a key, for per-key ordering without one strand per key:
+// jobs of one key always land on the same strand and so run in order, and keys that share a strand
+// are serialized with each other as well. More strands means fewer unrelated keys sharing one.
+//
+//	keyed_strand accounts(pool, 256);
+//	accounts.post(account_id, [=] { debit(account_id, amount); });
+class keyed_strand
+{
+public:
+	explicit keyed_strand(std::shared_ptr<thread_pool> pool, int strand_count = 64, job_priority priority = job_priority::NORMAL_PRIORITY);
+
+	keyed_strand(const keyed_strand&) = delete;
+	keyed_strand& operator=(const keyed_strand&) = delete;
+
+public:
+	template <typename Key, typename Hash = std::hash<Key>>
+	strand& get(const Key& key)
+	{
+		return *this->_strands[this->getStrandIndex((uint64_t)Hash{}(key))];
+	}
+
+	template <typename Key>
+	job_handle post(const Key& key, job_function work_function)
+	{
+		return this->get(key).post(std::move(work_function));
+	}
+
+	template <typename Key, typename F, typename... Args>
+	auto submit(const Key& key, F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		return this->get(key).submit(std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	int getStrandCount();
+
+private:
+	// std::hash of an integer is the integer itself on common standard libraries, so mix the bits first
+	size_t getStrandIndex(uint64_t hash);
+
+private:
+	std::vector<std::unique_ptr<strand>> _strands;
+};
@@ -0,0 +1,466 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "job_allocator.h"
+
+// Lazy coroutine task for code running on a thread_pool.
+// A task<T> does not start until it is awaited (or passed to sync_wait). Awaiting it starts it on the
+// awaiting thread by symmetric transfer, and when it finishes it transfers straight back to the
+// awaiting coroutine on whatever worker it finished on, so a chain of tasks costs no queue
+// round-trips. To move onto the pool (or to another priority) a coroutine awaits
+// thread_pool::schedule():
+//
+//	task<int> handle(std::shared_ptr<thread_pool> pool, request req)
+//	{
+//		co_await pool->schedule(job_priority::HIGH_PRIORITY);
+//		int rows = co_await query(pool, req);
+//		co_return rows;
+//	}
+//
+//	int rows = sync_wait(handle(pool, req));		// block until done
+//	std::future<int> rows = start_task(handle(pool, req));	// or run it detached
+//
+// Coroutine frames come from job_allocator slabs. T must be void or a movable value type.
+template <typename T>
+class task;
+
+namespace task_detail
+{
+	struct final_awaiter
+	{
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise().getContinuation();
+
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept
+		{
+		}
+	};
+
+	class promise_base
+	{
+	public:
+		static void* operator new(size_t size)
+		{
+			return job_allocator::allocate(size);
+		}
+
+		static void operator delete(void* memory, size_t size) noexcept
+		{
+			job_allocator::deallocate(memory, size);
+		}
+
+		std::suspend_always initial_suspend() const noexcept
+		{
+			return {};
+		}
+
+		final_awaiter final_suspend() const noexcept
+		{
+			return {};
+		}
+
+		void unhandled_exception() noexcept
+		{
+			this->_error = std::current_exception();
+		}
+
+		void setContinuation(std::coroutine_handle<> continuation) noexcept
+		{
+			this->_continuation = continuation;
+		}
+
+		std::coroutine_handle<> getContinuation() const noexcept
+		{
+			return this->_continuation;
+		}
+
+	protected:
+		void rethrowIfFailed()
+		{
+			if (this->_error != nullptr)
+			{
+				std::rethrow_exception(this->_error);
+			}
+		}
+
+	private:
+		std::coroutine_handle<> _continuation;
+		std::exception_ptr _error;
+	};
+
+	template <typename T>
+	class task_promise : public promise_base
+	{
+	public:
+		task<T> get_return_object() noexcept;
+
+		template <typename U>
+			requires std::is_convertible_v<U&&, T>
+		void return_value(U&& value)
+		{
+			this->_value.emplace(std::forward<U>(value));
+		}
+
+		T takeResult()
+		{
+			this->rethrowIfFailed();
+			return std::move(*this->_value);
+		}
+
+	private:
+		std::optional<T> _value;
+	};
+
+	template <>
+	class task_promise<void> : public promise_base
+	{
+	public:
+		task<void> get_return_object() noexcept;
+
+		void return_void() noexcept
+		{
+		}
+
+		void takeResult()
+		{
+			this->rethrowIfFailed();
+		}
+	};
+}
+
+template <typename T = void>
+class task
+{
+public:
+	using promise_type = task_detail::task_promise<T>;
+
+public:
+	task() noexcept
+		: _handle(nullptr)
+	{
+	}
+
+	explicit task(std::coroutine_handle<promise_type> handle) noexcept
+		: _handle(handle)
+	{
+	}
+
+	task(task&& other) noexcept
+		: _handle(std::exchange(other._handle, nullptr))
+	{
+	}
+
+	task& operator=(task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			this->destroy();
+			this->_handle = std::exchange(other._handle, nullptr);
+		}
+
+		return *this;
+	}
+
+	task(const task&) = delete;
+	task& operator=(const task&) = delete;
+
+	~task()
+	{
+		this->destroy();
+	}
+
+	bool isDone() const noexcept
+	{
+		return !this->_handle || this->_handle.done();
+	}
+
+	auto operator co_await() && noexcept
+	{
+		return awaiter { this->_handle };
+	}
+
+	auto operator co_await() & noexcept
+	{
+		return awaiter { this->_handle };
+	}
+
+private:
+	struct awaiter
+	{
+		std::coroutine_handle<promise_type> handle;
+
+		bool await_ready() const noexcept
+		{
+			return !this->handle || this->handle.done();
+		}
+
+		// start the task on this thread and come back here when it finishes
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			this->handle.promise().setContinuation(awaiting);
+			return this->handle;
+		}
+
+		T await_resume()
+		{
+			return this->handle.promise().takeResult();
+		}
+	};
+
+	void destroy() noexcept
+	{
+		if (this->_handle)
+		{
+			this->_handle.destroy();
+			this->_handle = nullptr;
+		}
+	}
+
+private:
+	std::coroutine_handle<promise_type> _handle;
+};
+
+template <typename T>
+task<T> task_detail::task_promise<T>::get_return_object() noexcept
+{
+	return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_detail::task_promise<void>::get_return_object() noexcept
+{
+	return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+namespace task_detail
+{
+	// signalled under the mutex, so the waiter cannot return while the notifier still touches it
+	struct sync_wait_state
+	{
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool done = false;
+	};
+
+	class sync_wait_task
+	{
+	public:
+		struct promise_type
+		{
+			sync_wait_state* state = nullptr;
+
+			sync_wait_task get_return_object() noexcept
+			{
+				return sync_wait_task(std::coroutine_handle<promise_type>::from_promise(*this));
+			}
+
+			std::suspend_always initial_suspend() const noexcept
+			{
+				return {};
+			}
+
+			auto final_suspend() const noexcept
+			{
+				struct notify_awaiter
+				{
+					bool await_ready() const noexcept
+					{
+						return false;
+					}
+
+					void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept
+					{
+						sync_wait_state* state = handle.promise().state;
+
+						std::lock_guard<std::mutex> locker(state->mutex);
+						state->done = true;
+						state->condition.notify_all();
+					}
+
+					void await_resume() const noexcept
+					{
+					}
+				};
+
+				return notify_awaiter {};
+			}
+
+			void return_void() noexcept
+			{
+			}
+
+			void unhandled_exception() noexcept
+			{
+				std::terminate();
+			}
+		};
+
+		explicit sync_wait_task(std::coroutine_handle<promise_type> handle) noexcept
+			: _handle(handle)
+		{
+		}
+
+		sync_wait_task(sync_wait_task&& other) noexcept
+			: _handle(std::exchange(other._handle, nullptr))
+		{
+		}
+
+		~sync_wait_task()
+		{
+			if (this->_handle)
+			{
+				this->_handle.destroy();
+			}
+		}
+
+		void run(sync_wait_state& state)
+		{
+			this->_handle.promise().state = &state;
+			this->_handle.resume();
+
+			std::unique_lock<std::mutex> locker(state.mutex);
+			state.condition.wait(locker, [&state] { return state.done; });
+		}
+
+	private:
+		std::coroutine_handle<promise_type> _handle;
+	};
+
+	template <typename T>
+	sync_wait_task makeSyncWaitTask(task<T>& awaited, std::optional<T>& result, std::exception_ptr& error)
+	{
+		try
+		{
+			result.emplace(co_await awaited);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+	}
+
+	// coroutine that starts eagerly and frees its own frame when it finishes
+	struct detached_task
+	{
+		struct promise_type
+		{
+			detached_task get_return_object() const noexcept
+			{
+				return {};
+			}
+
+			std::suspend_never initial_suspend() const noexcept
+			{
+				return {};
+			}
+
+			std::suspend_never final_suspend() const noexcept
+			{
+				return {};
+			}
+
+			void return_void() noexcept
+			{
+			}
+
+			void unhandled_exception() noexcept
+			{
+				std::terminate();
+			}
+		};
+	};
+
+	template <typename T>
+	detached_task runIntoPromise(task<T> awaited, std::promise<T> promise)
+	{
+		try
+		{
+			if constexpr (std::is_void_v<T>)
+			{
+				co_await awaited;
+				promise.set_value();
+			}
+			else
+			{
+				promise.set_value(co_await awaited);
+			}
+		}
+		catch (...)
+		{
+			promise.set_exception(std::current_exception());
+		}
+	}
+
+	inline sync_wait_task makeSyncWaitTask(task<void>& awaited, std::exception_ptr& error)
+	{
+		try
+		{
+			co_await awaited;
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+	}
+}
+
+// block the calling thread until the task has finished and return its result (or rethrow).
+// Do not call it from a pool worker: that worker would be parked until the task is done.
+template <typename T>
+T sync_wait(task<T> awaited)
+{
+	task_detail::sync_wait_state state;
+	std::exception_ptr error;
+
+	if constexpr (std::is_void_v<T>)
+	{
+		task_detail::makeSyncWaitTask(awaited, error).run(state);
+
+		if (error != nullptr)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+	else
+	{
+		std::optional<T> result;
+		task_detail::makeSyncWaitTask(awaited, result, error).run(state);
+
+		if (error != nullptr)
+		{
+			std::rethrow_exception(error);
+		}
+
+		return std::move(*result);
+	}
+}
+
+// start the task on the calling thread (up to its first schedule()) and return a future of its result,
+// so many tasks can be in flight without a thread waiting on each
+template <typename T>
+std::future<T> start_task(task<T> started)
+{
+	std::promise<T> promise;
+	std::future<T> future = promise.get_future();
+
+	task_detail::runIntoPromise(std::move(started), std::move(promise));
+
+	return future;
+}
@@ -0,0 +1,202 @@
+#include "task_group.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+#include "thread_pool.h"
+
+struct task_group::group_state
+{
+	std::atomic_int pending { 0 };
+
+	cancellation_token token;
+
+	// jobs of the group in run() order; entries that started elsewhere are trimmed as it grows
+	std::mutex mutex;
+	std::vector<std::shared_ptr<job>> queued;
+	size_t trim_size = 64;
+
+	std::exception_ptr error;
+
+	void finish()
+	{
+		// the last job wakes a waiter blocked in wait(); the state outlives it through the jobs
+		if (this->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			this->pending.notify_all();
+		}
+	}
+
+	void fail(std::exception_ptr job_error)
+	{
+		std::lock_guard<std::mutex> locker(this->mutex);
+
+		if (this->error == nullptr)
+		{
+			this->error = job_error;
+		}
+	}
+};
+
+// counts itself out of its group exactly once, whether it runs or is cancelled
+class task_group::group_job : public job
+{
+public:
+	group_job(job_priority job_priority, job_function work_func, std::shared_ptr<group_state> state)
+		: job(job_priority, std::move(work_func)), _state(std::move(state))
+	{
+	}
+
+	void work() override
+	{
+		try
+		{
+			job::work();
+		}
+		catch (...)
+		{
+			this->_state->fail(std::current_exception());
+		}
+
+		this->_state->finish();
+	}
+
+protected:
+	void onCancelled() override
+	{
+		this->_state->finish();
+	}
+
+private:
+	std::shared_ptr<group_state> _state;
+};
+
+task_group::task_group(std::shared_ptr<thread_pool> pool, job_priority priority)
+	: _pool(std::move(pool)), _priority(priority), _state(std::make_shared<group_state>())
+{
+}
+
+task_group::~task_group()
+{
+	try
+	{
+		this->wait();
+	}
+	catch (...)
+	{
+	}
+}
+
+void task_group::run(job_function work_function)
+{
+	this->run(this->_priority, std::move(work_function));
+}
+
+void task_group::run(job_priority priority, job_function work_function)
+{
+	std::shared_ptr<job> new_job = thread_pool::make_job<group_job>(priority, std::move(work_function), this->_state);
+	new_job->setCancellationToken(this->_state->token);
+
+	this->_state->pending.fetch_add(1, std::memory_order_relaxed);
+
+	// queue it first: pushing marks the job pending again, which must not revive a job that a
+	// waiter already took from `queued` and started
+	this->_pool->addJob(new_job);
+
+	{
+		std::lock_guard<std::mutex> locker(this->_state->mutex);
+
+		// drop jobs a worker already took, so a long-lived group does not hold every finished job
+		if (this->_state->queued.size() >= this->_state->trim_size)
+		{
+			std::erase_if(this->_state->queued, [](const std::shared_ptr<job>& queued_job) { return !queued_job->isPending(); });
+			this->_state->trim_size = std::max<size_t>(64, this->_state->queued.size() * 2);
+		}
+
+		// a job that started elsewhere is skipped by whoever dequeues its second copy
+		this->_state->queued.push_back(std::move(new_job));
+	}
+}
+
+void task_group::wait()
+{
+	while (true)
+	{
+		int pending = this->_state->pending.load(std::memory_order_acquire);
+
+		if (pending <= 0)
+		{
+			break;
+		}
+
+		// the group's own jobs first, then anything else a worker of this pool could run
+		if (this->runQueuedJob() || this->_pool->runPendingJob())
+		{
+			continue;
+		}
+
+		// every remaining job is running on another thread
+		this->_state->pending.wait(pending, std::memory_order_acquire);
+	}
+
+	std::exception_ptr error;
+
+	{
+		std::lock_guard<std::mutex> locker(this->_state->mutex);
+		std::swap(error, this->_state->error);
+
+		// the jobs hold the state, drop the entries of those that ran elsewhere to break the cycle
+		std::erase_if(this->_state->queued, [](const std::shared_ptr<job>& queued_job) { return !queued_job->isPending(); });
+	}
+
+	if (error != nullptr)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+void task_group::cancel()
+{
+	this->_state->token.cancel();
+}
+
+bool task_group::isCancelled()
+{
+	return this->_state->token.isCancelled();
+}
+
+bool task_group::runQueuedJob()
+{
+	while (true)
+	{
+		std::shared_ptr<job> queued_job;
+
+		{
+			std::lock_guard<std::mutex> locker(this->_state->mutex);
+
+			if (this->_state->queued.empty())
+			{
+				return false;
+			}
+
+			queued_job = std::move(this->_state->queued.back());
+			this->_state->queued.pop_back();
+		}
+
+		if (queued_job->tryStart())
+		{
+			queued_job->work();
+			queued_job->finishRun();
+			return true;
+		}
+
+		// cancelled: tryStart() already counted it out of the group
+		if (queued_job->isCancelled())
+		{
+			return true;
+		}
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+
+#include "job.h"
+
+class thread_pool;
+
+// Structured fork/join on a thread_pool: run() jobs into the group, then wait() until all of them
+// have finished. wait() does not just block. The waiting thread runs the group's queued jobs itself
+// (newest first), and a pool worker waiting inside a job also runs other queued jobs of the pool, so
+// recursive divide-and-conquer on a fixed-size pool neither deadlocks nor parks its workers.
+//
+//	long long fib(const std::shared_ptr<thread_pool>& pool, int n)
+//	{
+//		if (n < 20) return serial_fib(n);
+//		long long a, b;
+//		task_group group(pool);
+//		group.run([&] { a = fib(pool, n - 1); });
+//		group.run([&] { b = fib(pool, n - 2); });
+//		group.wait();
+//		return a + b;
+//	}
+//
+// Jobs run on a stopped pool, or still queued when it stops, are cancelled; wait() then returns.
+class task_group
+{
+private:
+	struct group_state;
+	class group_job;
+
+public:
+	explicit task_group(std::shared_ptr<thread_pool> pool, job_priority priority = job_priority::NORMAL_PRIORITY);
+
+	// waits for the jobs still pending; their exceptions are dropped
+	~task_group();
+
+	task_group(const task_group&) = delete;
+	task_group& operator=(const task_group&) = delete;
+
+public:
+	void run(job_function work_function);
+	void run(job_priority priority, job_function work_function);
+
+	// block until every job run so far has finished or been cancelled, helping meanwhile;
+	// rethrows the first exception a job threw since the last wait()
+	void wait();
+
+	// jobs of the group that have not started are skipped; the group stays cancelled
+	void cancel();
+	bool isCancelled();
+
+private:
+	// run the newest queued job of the group on the calling thread, false when none is left
+	bool runQueuedJob();
+
+private:
+	std::shared_ptr<thread_pool> _pool;
+	job_priority _priority;
+	std::shared_ptr<group_state> _state;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <exception>
+#include <future>
+#include <type_traits>
+#include <utility>
+
+#include "job.h"
+#include "job_allocator.h"
+
+// Job fused with the promise of its result.
+// The callable is stored in the job object itself, and the job and the shared state of the
+// returned std::future are both allocated from job_allocator slabs.
+template <typename R, typename F>
+class task_job : public job
+{
+public:
+	task_job(job_priority job_priority, F&& func)
+		: job(job_priority, nullptr), _func(std::move(func)), _promise(std::allocator_arg, pool_allocator<char>())
+	{
+	}
+
+	std::future<R> getFuture()
+	{
+		return this->_promise.get_future();
+	}
+
+	void work() override
+	{
+		try
+		{
+			if constexpr (std::is_void_v<R>)
+			{
+				this->_func();
+				this->_promise.set_value();
+			}
+			else
+			{
+				this->_promise.set_value(this->_func());
+			}
+		}
+		catch (...)
+		{
+			this->_promise.set_exception(std::current_exception());
+		}
+	}
+
+protected:
+	void onCancelled() override
+	{
+		this->_promise.set_exception(std::make_exception_ptr(job_cancelled_error()));
+	}
+
+private:
+	F _func;
+	std::promise<R> _promise;
+};
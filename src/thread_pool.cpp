@@ -1,14 +1,99 @@
 #include "thread_pool.h"
 
-thread_pool::thread_pool()
+namespace
+{
+	// resumes a coroutine suspended in schedule_awaitable; a cancelled one resumes right away and
+	// its co_await throws, so the coroutine is never lost
+	class resume_job : public job
+	{
+	public:
+		resume_job(job_priority job_priority, std::coroutine_handle<> handle, bool* cancelled)
+			: job(job_priority, nullptr), _handle(handle), _cancelled(cancelled)
+		{
+		}
+
+		void work() override
+		{
+			this->_handle.resume();
+		}
+
+	protected:
+		void onCancelled() override
+		{
+			*this->_cancelled = true;
+			this->_handle.resume();
+		}
+
+	private:
+		std::coroutine_handle<> _handle;
+		bool* _cancelled;
+	};
+
+	// periodic timer shared by its fire callback and the jobs it pushes
+	struct periodic_timer_state
+	{
+		job_function work;
+		std::atomic_bool queued { false };
+	};
+
+	// one run of a periodic timer; the next run may be queued once this one ran or was cancelled
+	// (rejected or dropped by the overflow policy, cancelled by a stopped pool)
+	class periodic_job : public job
+	{
+	public:
+		periodic_job(job_priority job_priority, std::shared_ptr<periodic_timer_state> state)
+			: job(job_priority, nullptr), _state(std::move(state))
+		{
+		}
+
+		void work() override
+		{
+			struct queued_reset
+			{
+				periodic_timer_state* state;
+				~queued_reset() { this->state->queued = false; }
+			} reset { this->_state.get() };
+
+			this->_state->work();
+		}
+
+	protected:
+		void onCancelled() override
+		{
+			this->_state->queued = false;
+		}
+
+	private:
+		std::shared_ptr<periodic_timer_state> _state;
+	};
+}
+
+thread_pool::thread_pool(int priority_levels)
 	: _terminated(false)
 {
-	this->_job_manager = std::make_shared<job_manager>();
-	this->_job_manager->setWorkerNotification(std::bind(&thread_pool::notifyWakeUpWorkers, this));
+	if (priority_levels < 1 || priority_levels > job_manager::max_priority_levels)
+	{
+		throw std::invalid_argument("thread_pool needs 1 to 64 priority levels");
+	}
+
+	// every priority has an entry up front, so routing reads never race with an insert
+	for (int i = 0; i < priority_levels; i++)
+	{
+		this->_priority_worker_numbers[(job_priority)i] = 0;
+		this->_shared_worker_numbers[(job_priority)i] = 0;
+		this->_autoscale_max_workers[(job_priority)i] = 0;
+	}
+
+	this->_timer_wheel = std::make_shared<timer_wheel>();
+
+	this->_job_manager = std::make_shared<job_manager>(priority_levels);
+	this->_job_manager->setWorkerNotification(std::bind(&thread_pool::notifyWakeUpWorkers, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
 }
 
 thread_pool::~thread_pool()
 {
+	this->stopTimers();
+	this->stopWatchdog();
 }
 
 std::shared_ptr<thread_pool> thread_pool::getPtr(void)
@@ -23,6 +108,11 @@ void thread_pool::addWorker(std::shared_ptr<thread_worker> new_worker)
 		return;
 	}
 
+	if (this->_priority_worker_numbers.find(new_worker->getPriority()) == this->_priority_worker_numbers.end())
+	{
+		throw std::invalid_argument("worker priority is not a level of this pool");
+	}
+
 	std::lock_guard<std::mutex> locker(this->_woker_mutex);
 
 	std::vector<std::shared_ptr<thread_worker>>::iterator it = std::find(this->_workers.begin(), this->_workers.end(), new_worker);
@@ -36,6 +126,8 @@ void thread_pool::addWorker(std::shared_ptr<thread_worker> new_worker)
 
 	new_worker->setJobManager(this->_job_manager);
 	new_worker->startWorker();
+
+	this->updateWorkersPriorityNumbers();
 }
 
 void thread_pool::removeWorker(std::shared_ptr<thread_worker> worker)
@@ -50,6 +142,15 @@ void thread_pool::removeWorker(std::shared_ptr<thread_worker> worker)
 	}
 
 	this->_workers.erase(it);
+
+	auto scaled = std::find(this->_scaled_workers.begin(), this->_scaled_workers.end(), worker.get());
+
+	if (scaled != this->_scaled_workers.end())
+	{
+		this->_scaled_workers.erase(scaled);
+	}
+
+	this->updateWorkersPriorityNumbers();
 }
 
 void thread_pool::removeWorkers()
@@ -62,23 +163,37 @@ void thread_pool::removeWorkers()
 	}
 
 	this->_workers.clear();
+	this->_scaled_workers.clear();
+
+	this->updateWorkersPriorityNumbers();
 }
 
 void thread_pool::setWorkersPriorityNumbers()
 {
 	std::lock_guard<std::mutex> locker(this->_woker_mutex);
 
+	this->updateWorkersPriorityNumbers();
+}
+
+void thread_pool::updateWorkersPriorityNumbers()
+{
+	std::map<job_priority, int> counts;
+	std::map<job_priority, int> shared_counts;
+
 	for (int i = 0; i < (int)this->_workers.size(); i++)
 	{
-		auto iter = this->_priority_worker_numbers.find(this->_workers[i]->getPriority());
+		counts[this->_workers[i]->getPriority()]++;
+		shared_counts[this->_workers[i]->getPriority()] += this->_workers[i]->isReserved() ? 0 : 1;
+	}
 
-		if (iter == this->_priority_worker_numbers.end())
-		{
-			this->_priority_worker_numbers.insert({ this->_workers[i]->getPriority() , 0 });
-			iter = this->_priority_worker_numbers.find(this->_workers[i]->getPriority());
-		}
+	for (auto& [priority, number] : this->_priority_worker_numbers)
+	{
+		number = counts[priority];
+	}
 
-		iter->second++;
+	for (auto& [priority, number] : this->_shared_worker_numbers)
+	{
+		number = shared_counts[priority];
 	}
 }
 
@@ -89,83 +204,996 @@ int thread_pool::getWorkerNumbers()
 	return (int)this->_workers.size();
 }
 
-void thread_pool::addJob(std::shared_ptr<job> new_job)
+int thread_pool::getWorkerNumbers(job_priority priority)
+{
+	auto iter = this->_priority_worker_numbers.find(priority);
+
+	return iter == this->_priority_worker_numbers.end() ? 0 : iter->second.load();
+}
+
+int thread_pool::addWorkersPerPhysicalCore(job_priority priority)
 {
 	if (this->_terminated)
 	{
-		return;
+		return 0;
 	}
 
-	// if there is no worker can do new_job's priority(HIGH or LOW), change to NORMAL_PRIORITY
-	job_priority new_job_priority = new_job->getJobPriority();
+	int added = 0;
 
-	if (new_job_priority == job_priority::HIGH_PRIORITY || new_job_priority == job_priority::LOW_PRIORITY)
+	for (const std::vector<int>& core_cpus : cpu_topology::system().getPhysicalCores())
 	{
-		auto iter = this->_priority_worker_numbers.find(new_job_priority);
+		auto worker = std::make_shared<thread_worker>(priority);
+		worker->setCpuAffinity(core_cpus);
 
-		if (iter == this->_priority_worker_numbers.end())
-		{
-			new_job->setJobPriority(job_priority::NORMAL_PRIORITY);
-		}
-		else
+		this->addWorker(worker);
+		added++;
+	}
+
+	return added;
+}
+
+void thread_pool::setNumaAware(bool enable)
+{
+	if (enable)
+	{
+		this->_job_manager->setNumaNodes(cpu_topology::system().getNodeCount());
+	}
+
+	this->_job_manager->setNumaRouting(enable);
+}
+
+bool thread_pool::isNumaAware()
+{
+	return this->_job_manager->isNumaRouting();
+}
+
+void thread_pool::trimJobMemory()
+{
+	job_allocator::flushThreadCache();
+	job_allocator::trim();
+}
+
+job_handle thread_pool::addJob(std::shared_ptr<job> new_job)
+{
+	// a rejected job is cancelled, so its future, coroutine or group hears about it
+	if (this->_terminated)
+	{
+		new_job->cancel();
+		return job_handle();
+	}
+
+	this->resolveJobPriority(new_job);
+
+	job_handle handle(new_job);
+
+	if (this->admitJob(new_job))
+	{
+		this->enqueueJob(std::move(new_job));
+	}
+
+	return handle;
+}
+
+bool thread_pool::tryAddJob(std::shared_ptr<job> new_job)
+{
+	if (this->_terminated)
+	{
+		return false;
+	}
+
+	this->resolveJobPriority(new_job);
+
+	if (!this->_job_manager->tryReserveCapacity(new_job))
+	{
+		return false;
+	}
+
+	this->enqueueJob(std::move(new_job));
+
+	return true;
+}
+
+void thread_pool::enqueueJob(std::shared_ptr<job> new_job)
+{
+	if (this->_job_manager->isWorkStealing())
+	{
+		thread_worker* worker = thread_worker::current();
+
+		if (worker != nullptr && worker->pushLocalJob(new_job, this->_job_manager))
 		{
-			if (iter->second <= 0)
-			{
-				new_job->setJobPriority(job_priority::NORMAL_PRIORITY);
-			}
+			return;
 		}
 	}
 
-	this->_job_manager->push_job(new_job);
+	this->_job_manager->push_job(std::move(new_job));
 }
 
-void thread_pool::stopPool(bool wait_for_finish_jobs, std::chrono::seconds max_wait_time)
+bool thread_pool::admitJob(const std::shared_ptr<job>& new_job, bool may_block)
 {
-	// Set terminated flag first to prevent new jobs/workers being added
-	this->_terminated = true;
+	job_priority priority = new_job->getJobPriority();
 
-	if (wait_for_finish_jobs)
+	while (!this->_job_manager->tryReserveCapacity(new_job))
 	{
-		auto start_time = std::chrono::steady_clock::now();
-		while (this->_job_manager->getAllJobCount() > 0)
+		overflow_policy policy = this->_job_manager->getOverflowPolicy(priority);
+
+		if (!may_block && (policy == overflow_policy::BLOCK || policy == overflow_policy::CALLER_RUNS))
 		{
-			if (max_wait_time != std::chrono::seconds(0) && std::chrono::steady_clock::now() - start_time >= max_wait_time)
+			policy = overflow_policy::REJECT;
+		}
+
+		switch (policy)
+		{
+		case overflow_policy::REJECT:
+			new_job->cancel();
+			return false;
+
+		case overflow_policy::CALLER_RUNS:
+			if (new_job->tryStart())
+			{
+				new_job->work();
+				new_job->finishRun();
+			}
+			return false;
+
+		case overflow_policy::DROP_OLDEST:
+			// the level's queued jobs may all sit in worker deques, out of reach
+			if (!this->_job_manager->dropOldestJob(priority))
+			{
+				new_job->cancel();
+				return false;
+			}
+			break;
+
+		case overflow_policy::BLOCK:
+			if (this->_terminated)
+			{
+				new_job->cancel();
+				return false;
+			}
+
+			// a worker of this pool runs queued jobs instead, or a pool whose jobs push could block on itself
+			if (this->runPendingJob())
 			{
 				break;
 			}
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			this->_job_manager->waitForCapacity(priority, thread_worker::current() != nullptr
+				? std::chrono::steady_clock::now() + std::chrono::milliseconds(1)
+				: std::chrono::steady_clock::time_point::max());
+			break;
 		}
 	}
 
-	std::lock_guard<std::mutex> locker(this->_woker_mutex);
+	return true;
+}
 
-	// Stop all workers (request_stop + notify + join)
-	for (int i = 0; i < (int)this->_workers.size(); i++)
+void thread_pool::addJobs(const std::vector<std::shared_ptr<job>>& new_jobs)
+{
+	if (this->_terminated)
 	{
-		if (this->_workers[i] != nullptr)
+		for (const std::shared_ptr<job>& new_job : new_jobs)
 		{
-			this->_workers[i]->stopWorker();
+			new_job->cancel();
 		}
+
+		return;
 	}
 
-	this->_workers.clear();
+	if (new_jobs.empty())
+	{
+		return;
+	}
+
+	std::vector<std::shared_ptr<job>> shared_jobs;
+	std::vector<std::shared_ptr<job>> local_jobs;
+
+	thread_worker* worker = this->_job_manager->isWorkStealing() ? thread_worker::current() : nullptr;
+
+	for (int i = 0; i < (int)new_jobs.size(); i++)
+	{
+		this->resolveJobPriority(new_jobs[i]);
+
+		if (!this->admitJob(new_jobs[i]))
+		{
+			continue;
+		}
+
+		if (worker != nullptr && worker->canPushLocalJob(new_jobs[i], this->_job_manager))
+		{
+			local_jobs.push_back(new_jobs[i]);
+		}
+		else
+		{
+			shared_jobs.push_back(new_jobs[i]);
+		}
+	}
+
+	if (!local_jobs.empty())
+	{
+		worker->pushLocalJobs(local_jobs, this->_job_manager);
+	}
+
+	if (!shared_jobs.empty())
+	{
+		this->_job_manager->push_jobs(shared_jobs);
+	}
 }
 
-std::weak_ptr<job_manager> thread_pool::getJobManager()
+void thread_pool::cancelJob(unsigned long long job_id)
 {
-	return this->_job_manager;
+	this->_job_manager->cancelJob(job_id);
 }
 
-void thread_pool::notifyWakeUpWorkers()
+bool thread_pool::runPendingJob()
 {
-	std::lock_guard<std::mutex> locker(this->_woker_mutex);
+	thread_worker* worker = thread_worker::current();
 
-	for (int i = 0; i < (int)this->_workers.size(); i++)
+	return worker != nullptr && worker->runPendingJob(this->_job_manager);
+}
+
+void thread_pool::resolveJobPriority(const std::shared_ptr<job>& new_job)
+{
+	int levels = (int)this->_priority_worker_numbers.size();
+	int level = new_job->getJobPriority();
+
+	// unknown priorities are NORMAL_PRIORITY jobs
+	if (level < 0 || level >= levels)
+	{
+		level = std::min<int>(job_priority::NORMAL_PRIORITY, levels - 1);
+		new_job->setJobPriority((job_priority)level);
+	}
+
+	// a level with workers of its own, or one the autoscaler may spawn workers for, keeps its jobs.
+	// Every producer runs this at once, so the maps are only read through at(), never operator[]
+	if (this->_priority_worker_numbers.at((job_priority)level) > 0 || this->_autoscale_max_workers.at((job_priority)level) > 0)
 	{
-		if (this->_workers[i] != nullptr)
+		return;
+	}
+
+	// otherwise the job moves to the nearest level with workers that are not reserved for it, the
+	// more urgent one on a tie; with none at all it stays where it is until a worker is added
+	auto served = [this](int index)
+	{
+		return this->_shared_worker_numbers.at((job_priority)index) > 0 || this->_autoscale_max_workers.at((job_priority)index) > 0;
+	};
+
+	for (int distance = 1; distance < levels; distance++)
+	{
+		if (level - distance >= 0 && served(level - distance))
+		{
+			new_job->setJobPriority((job_priority)(level - distance));
+			return;
+		}
+
+		if (level + distance < levels && served(level + distance))
 		{
-			this->_workers[i]->notifyWakeUp();
+			new_job->setJobPriority((job_priority)(level + distance));
+			return;
 		}
 	}
 }
+
+void thread_pool::setWorkStealing(bool enable)
+{
+	this->_job_manager->setWorkStealing(enable);
+}
+
+bool thread_pool::isWorkStealing()
+{
+	return this->_job_manager->isWorkStealing();
+}
+
+pool_metrics_snapshot thread_pool::snapshot()
+{
+	pool_metrics_snapshot snapshot;
+
+	this->_job_manager->collectMetrics(snapshot);
+
+	std::lock_guard<std::mutex> locker(this->_woker_mutex);
+
+	for (auto& worker : this->_workers)
+	{
+		worker->collectMetrics(snapshot);
+	}
+
+	return snapshot;
+}
+
+void thread_pool::setMetricsEnabled(bool enable)
+{
+	this->_job_manager->setMetricsEnabled(enable);
+}
+
+bool thread_pool::isMetricsEnabled()
+{
+	return this->_job_manager->isMetricsEnabled();
+}
+
+schedule_awaitable thread_pool::schedule(job_priority priority)
+{
+	return schedule_awaitable(this, priority);
+}
+
+schedule_awaitable::schedule_awaitable(thread_pool* pool, job_priority priority)
+	: _pool(pool), _priority(priority), _rejected(false), _cancelled(false)
+{
+}
+
+bool schedule_awaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	if (this->_pool->isTerminated())
+	{
+		this->_rejected = true;
+		return false;
+	}
+
+	this->_pool->addJob(thread_pool::make_job<resume_job>(this->_priority, handle, &this->_cancelled));
+
+	// the coroutine may already be running on a worker here, *this must not be touched any more
+	return true;
+}
+
+void schedule_awaitable::await_resume() const
+{
+	if (this->_rejected)
+	{
+		throw std::runtime_error("thread_pool is terminated");
+	}
+
+	if (this->_cancelled)
+	{
+		throw job_cancelled_error();
+	}
+}
+
+std::future<void> thread_pool::submitGraph(job_graph& graph)
+{
+	if (this->_terminated)
+	{
+		std::promise<void> promise;
+		promise.set_exception(std::make_exception_ptr(std::runtime_error("thread_pool is terminated")));
+		return promise.get_future();
+	}
+
+	return graph.launch(this->getPtr());
+}
+
+void thread_pool::setStarvationThreshold(std::chrono::milliseconds threshold)
+{
+	std::lock_guard<std::mutex> locker(this->_watchdog_mutex);
+
+	long long threshold_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(threshold).count();
+	this->_job_manager->setAgingThreshold(threshold_ns);
+
+	this->startWatchdog();
+}
+
+std::chrono::milliseconds thread_pool::getStarvationThreshold()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds(this->_job_manager->getAgingThreshold()));
+}
+
+void thread_pool::setAutoscalePolicy(job_priority priority, const autoscale_policy& policy)
+{
+	if (this->_autoscale_max_workers.find(priority) == this->_autoscale_max_workers.end())
+	{
+		throw std::invalid_argument("unknown job_priority");
+	}
+
+	if (policy.min_workers < 0 || policy.max_workers < 0 || (policy.max_workers > 0 && policy.min_workers > policy.max_workers))
+	{
+		throw std::invalid_argument("autoscale_policy needs 0 <= min_workers <= max_workers");
+	}
+
+	std::lock_guard<std::mutex> locker(this->_watchdog_mutex);
+
+	if (policy.max_workers > 0)
+	{
+		this->_autoscale_policies[priority] = policy;
+	}
+	else
+	{
+		this->_autoscale_policies.erase(priority);
+	}
+
+	this->_autoscale_max_workers.at(priority) = policy.max_workers;
+
+	bool wait_time_needed = false;
+
+	for (auto& [scaled_priority, scaled_policy] : this->_autoscale_policies)
+	{
+		wait_time_needed = wait_time_needed || scaled_policy.wait_time_threshold.count() > 0;
+	}
+
+	this->_job_manager->setEnqueueTimeRequired(wait_time_needed);
+
+	this->startWatchdog();
+}
+
+autoscale_policy thread_pool::getAutoscalePolicy(job_priority priority)
+{
+	std::lock_guard<std::mutex> locker(this->_watchdog_mutex);
+
+	auto iter = this->_autoscale_policies.find(priority);
+
+	return iter != this->_autoscale_policies.end() ? iter->second : autoscale_policy();
+}
+
+void thread_pool::setQueueCapacity(job_priority priority, int capacity, overflow_policy policy)
+{
+	this->_job_manager->setQueueCapacity(priority, capacity, policy);
+}
+
+int thread_pool::getQueueCapacity(job_priority priority)
+{
+	return this->_job_manager->getQueueCapacity(priority);
+}
+
+overflow_policy thread_pool::getOverflowPolicy(job_priority priority)
+{
+	return this->_job_manager->getOverflowPolicy(priority);
+}
+
+void thread_pool::setWaitStrategy(const wait_strategy& strategy)
+{
+	for (int i = 0; i < this->getPriorityLevels(); i++)
+	{
+		this->_job_manager->setWaitStrategy((job_priority)i, strategy);
+	}
+}
+
+void thread_pool::setWaitStrategy(job_priority priority, const wait_strategy& strategy)
+{
+	this->_job_manager->setWaitStrategy(priority, strategy);
+}
+
+wait_strategy thread_pool::getWaitStrategy(job_priority priority)
+{
+	return this->_job_manager->getWaitStrategy(priority);
+}
+
+int thread_pool::getPriorityLevels()
+{
+	return this->_job_manager->getPriorityLevels();
+}
+
+void thread_pool::setReservedWorkers(job_priority priority, int count)
+{
+	if (this->_priority_worker_numbers.find(priority) == this->_priority_worker_numbers.end())
+	{
+		throw std::invalid_argument("unknown job_priority");
+	}
+
+	if (count < 0)
+	{
+		throw std::invalid_argument("reserved worker count must not be negative");
+	}
+
+	std::vector<std::shared_ptr<thread_worker>> retired;
+
+	{
+		std::lock_guard<std::mutex> locker(this->_woker_mutex);
+
+		if (this->_terminated)
+		{
+			return;
+		}
+
+		int reserved_count = 0;
+
+		for (auto it = this->_workers.begin(); it != this->_workers.end(); )
+		{
+			if (!(*it)->isReserved() || (*it)->getPriority() != priority)
+			{
+				++it;
+				continue;
+			}
+
+			if (reserved_count < count)
+			{
+				reserved_count++;
+				++it;
+				continue;
+			}
+
+			retired.push_back(*it);
+			it = this->_workers.erase(it);
+		}
+
+		for (; reserved_count < count; reserved_count++)
+		{
+			auto worker = std::make_shared<thread_worker>(priority);
+			worker->setReserved(true);
+
+			this->_workers.push_back(worker);
+
+			worker->setJobManager(this->_job_manager);
+			worker->startWorker();
+		}
+
+		this->updateWorkersPriorityNumbers();
+	}
+
+	if (retired.empty())
+	{
+		return;
+	}
+
+	// joined outside the lock, like the workers the autoscaler retires
+	for (auto& worker : retired)
+	{
+		worker->stopWorker();
+		worker->setJobManager(nullptr);
+	}
+
+	this->wakeWorkersForQueuedJobs();
+}
+
+int thread_pool::getReservedWorkers(job_priority priority)
+{
+	std::lock_guard<std::mutex> locker(this->_woker_mutex);
+
+	return (int)std::count_if(this->_workers.begin(), this->_workers.end(),
+		[priority](const std::shared_ptr<thread_worker>& worker) { return worker->isReserved() && worker->getPriority() == priority; });
+}
+
+void thread_pool::setBorrowLevels(job_priority priority, const std::vector<job_priority>& levels)
+{
+	if (this->_priority_worker_numbers.find(priority) == this->_priority_worker_numbers.end())
+	{
+		throw std::invalid_argument("unknown job_priority");
+	}
+
+	uint64_t mask = 0;
+
+	for (job_priority level : levels)
+	{
+		if (this->_priority_worker_numbers.find(level) == this->_priority_worker_numbers.end())
+		{
+			throw std::invalid_argument("unknown job_priority");
+		}
+
+		mask |= this->_job_manager->getLevelMask(level);
+	}
+
+	this->_job_manager->setBorrowLevels(priority, mask);
+
+	{
+		std::lock_guard<std::mutex> locker(this->_woker_mutex);
+
+		// parked workers are in the idle masks of their old levels: woken, they park again with the new ones
+		for (auto& worker : this->_workers)
+		{
+			worker->setJobMatchPriorities();
+			worker->tryWakeUp();
+		}
+	}
+
+	// workers that may take the borrowed levels' jobs now could be parked with those jobs queued
+	this->wakeWorkersForQueuedJobs();
+}
+
+std::vector<job_priority> thread_pool::getBorrowLevels(job_priority priority)
+{
+	std::vector<job_priority> levels;
+	uint64_t mask = this->_job_manager->getBorrowLevels(priority);
+
+	for (int i = 0; i < this->getPriorityLevels(); i++)
+	{
+		if ((mask & (1ull << i)) != 0)
+		{
+			levels.push_back((job_priority)i);
+		}
+	}
+
+	return levels;
+}
+
+bool thread_pool::hasWatchdogWork()
+{
+	return this->_job_manager->getAgingThreshold() > 0 || !this->_autoscale_policies.empty();
+}
+
+void thread_pool::startWatchdog()
+{
+	if (this->hasWatchdogWork() && !this->_watchdog_thread.joinable() && !this->_terminated)
+	{
+		this->_watchdog_thread = std::jthread([this](std::stop_token st) {
+			this->watchdog_function(st);
+		});
+	}
+
+	// wakes a watchdog parked while it had nothing to do; a running one picks up the change next round
+	this->_watchdog_condition.notify_all();
+}
+
+void thread_pool::stopWatchdog()
+{
+	std::jthread watchdog;
+
+	{
+		std::lock_guard<std::mutex> locker(this->_watchdog_mutex);
+		watchdog.swap(this->_watchdog_thread);
+	}
+
+	if (watchdog.joinable())
+	{
+		watchdog.request_stop();
+		this->_watchdog_condition.notify_all();
+		watchdog.join();
+	}
+}
+
+void thread_pool::watchdog_function(std::stop_token stop_token)
+{
+	// how often the autoscaler looks at the queues
+	constexpr std::chrono::nanoseconds autoscale_interval = std::chrono::milliseconds(10);
+
+	std::unique_lock<std::mutex> locker(this->_watchdog_mutex);
+
+	while (!stop_token.stop_requested())
+	{
+		if (!this->hasWatchdogWork())
+		{
+			// aging and autoscaling turned off: park until one is turned on again or the pool stops
+			this->_watchdog_condition.wait(locker, stop_token, [this] { return this->hasWatchdogWork(); });
+			continue;
+		}
+
+		long long threshold_ns = this->_job_manager->getAgingThreshold();
+		auto interval = std::chrono::nanoseconds::max();
+
+		if (threshold_ns > 0)
+		{
+			// check four times per threshold, so a job waits at most about 1.25x the threshold per level
+			interval = std::max(std::chrono::nanoseconds(threshold_ns / 4), std::chrono::nanoseconds(std::chrono::milliseconds(1)));
+		}
+
+		if (!this->_autoscale_policies.empty())
+		{
+			interval = std::min(interval, autoscale_interval);
+		}
+
+		this->_watchdog_condition.wait_for(locker, stop_token, interval, [] { return false; });
+
+		if (stop_token.stop_requested())
+		{
+			break;
+		}
+
+		std::map<job_priority, autoscale_policy> policies = this->_autoscale_policies;
+
+		locker.unlock();
+
+		if (threshold_ns > 0)
+		{
+			this->_job_manager->promoteStarvedJobs();
+		}
+
+		if (!policies.empty())
+		{
+			this->autoscaleWorkers(policies);
+		}
+
+		locker.lock();
+	}
+}
+
+bool thread_pool::isOverloaded(job_priority priority, const autoscale_policy& policy)
+{
+	int depth = this->_job_manager->getJobCount(this->_job_manager->getLevelMask(priority));
+
+	if (depth <= 0)
+	{
+		return false;
+	}
+
+	if (policy.queue_depth_threshold > 0 && depth >= policy.queue_depth_threshold)
+	{
+		return true;
+	}
+
+	long long wait_threshold_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(policy.wait_time_threshold).count();
+
+	if (wait_threshold_ns > 0)
+	{
+		long long oldest = this->_job_manager->getOldestEnqueueTime(priority);
+
+		if (oldest > 0 && metricsClockNow() - oldest >= wait_threshold_ns)
+		{
+			return true;
+		}
+	}
+
+	// without thresholds any backlog counts
+	return policy.queue_depth_threshold <= 0 && wait_threshold_ns <= 0;
+}
+
+void thread_pool::autoscaleWorkers(const std::map<job_priority, autoscale_policy>& policies)
+{
+	long long now = metricsClockNow();
+
+	std::vector<std::shared_ptr<thread_worker>> retired;
+	std::vector<job_priority> spawned;
+
+	{
+		std::lock_guard<std::mutex> locker(this->_woker_mutex);
+
+		if (this->_terminated)
+		{
+			return;
+		}
+
+		for (auto& [priority, policy] : policies)
+		{
+			long long idle_timeout_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(policy.idle_timeout).count();
+
+			int worker_count = 0;
+			int capable_count = 0;
+			int idle_capable_count = 0;
+
+			std::vector<std::shared_ptr<thread_worker>> expired;
+
+			for (auto& worker : this->_workers)
+			{
+				if (worker->canRunPriority(priority))
+				{
+					capable_count++;
+					idle_capable_count += worker->isIdle() ? 1 : 0;
+				}
+
+				if (worker->getPriority() != priority)
+				{
+					continue;
+				}
+
+				worker_count++;
+
+				long long idle_since = worker->getIdleSince();
+				bool scaled = std::find(this->_scaled_workers.begin(), this->_scaled_workers.end(), worker.get()) != this->_scaled_workers.end();
+
+				if (scaled && idle_since > 0 && now - idle_since >= idle_timeout_ns)
+				{
+					expired.push_back(worker);
+				}
+			}
+
+			// scale down: parked too long, keep min_workers; a worker that was just woken for a job is kept
+			for (size_t i = 0; i < expired.size() && worker_count > policy.min_workers; i++)
+			{
+				if (!expired[i]->tryRetire())
+				{
+					continue;
+				}
+
+				this->_workers.erase(std::find(this->_workers.begin(), this->_workers.end(), expired[i]));
+				this->_scaled_workers.erase(std::find(this->_scaled_workers.begin(), this->_scaled_workers.end(), expired[i].get()));
+
+				retired.push_back(expired[i]);
+				worker_count--;
+				capable_count--;
+			}
+
+			// scale up: fill min_workers at once, above it one worker per check while the backlog lasts
+			int wanted = std::max(policy.min_workers - worker_count, 0);
+
+			if (wanted == 0 && idle_capable_count == 0 && (capable_count == 0 ? this->_job_manager->getJobCount(this->_job_manager->getLevelMask(priority)) > 0 : this->isOverloaded(priority, policy)))
+			{
+				wanted = 1;
+			}
+
+			wanted = std::min(wanted, policy.max_workers - worker_count);
+
+			for (int i = 0; i < wanted; i++)
+			{
+				spawned.push_back(priority);
+			}
+		}
+
+		for (job_priority priority : spawned)
+		{
+			auto worker = std::make_shared<thread_worker>(priority);
+
+			this->_workers.push_back(worker);
+			this->_scaled_workers.push_back(worker.get());
+
+			worker->setJobManager(this->_job_manager);
+			worker->startWorker();
+		}
+
+		this->updateWorkersPriorityNumbers();
+	}
+
+	if (retired.empty())
+	{
+		return;
+	}
+
+	// joined outside the lock; a retired worker leaves park() without taking a job, so this is quick
+	for (auto& worker : retired)
+	{
+		worker->stopWorker();
+		worker->setJobManager(nullptr);
+	}
+
+	this->wakeWorkersForQueuedJobs();
+}
+
+void thread_pool::wakeWorkersForQueuedJobs()
+{
+	for (int i = 0; i < this->getPriorityLevels(); i++)
+	{
+		int job_count = this->_job_manager->getJobCount(this->_job_manager->getLevelMask((job_priority)i));
+
+		if (job_count > 0)
+		{
+			this->notifyWakeUpWorkers((job_priority)i, job_count);
+		}
+	}
+}
+
+timer_handle thread_pool::addTimer(job_priority priority, std::chrono::steady_clock::time_point deadline, std::chrono::milliseconds period, job_function work)
+{
+	std::lock_guard<std::mutex> locker(this->_timer_mutex);
+
+	if (this->_terminated)
+	{
+		return timer_handle();
+	}
+
+	if (!this->_timer_thread.joinable())
+	{
+		this->_timer_thread = std::jthread([wheel = this->_timer_wheel](std::stop_token st) {
+			while (wheel->runDue(st))
+			{
+			}
+		});
+	}
+
+	// fire callbacks run on the timer thread, which is joined before the pool goes away
+	if (period.count() <= 0)
+	{
+		std::shared_ptr<job> due_job = make_job(priority, std::move(work));
+
+		return this->_timer_wheel->add(deadline, period, [this, due_job]() { this->addTimerJob(due_job); });
+	}
+
+	auto state = std::make_shared<periodic_timer_state>();
+	state->work = std::move(work);
+
+	return this->_timer_wheel->add(deadline, period, [this, priority, state]()
+		{
+			if (state->queued.exchange(true))
+			{
+				return;
+			}
+
+			this->addTimerJob(make_job<periodic_job>(priority, state));
+		});
+}
+
+void thread_pool::addTimerJob(std::shared_ptr<job> due_job)
+{
+	if (this->_terminated)
+	{
+		due_job->cancel();
+		return;
+	}
+
+	this->resolveJobPriority(due_job);
+
+	// the timer thread serves every timer, so it never waits for capacity or runs the job itself
+	if (this->admitJob(due_job, false))
+	{
+		this->enqueueJob(std::move(due_job));
+	}
+}
+
+size_t thread_pool::getTimerCount()
+{
+	return this->_timer_wheel->size();
+}
+
+void thread_pool::stopTimers()
+{
+	std::jthread timer_thread;
+
+	{
+		std::lock_guard<std::mutex> locker(this->_timer_mutex);
+		timer_thread.swap(this->_timer_thread);
+	}
+
+	if (timer_thread.joinable())
+	{
+		timer_thread.request_stop();
+		timer_thread.join();
+	}
+
+	this->_timer_wheel->clear();
+}
+
+void thread_pool::stopPool(bool wait_for_finish_jobs, std::chrono::seconds max_wait_time)
+{
+	// Set terminated flag first to prevent new jobs/workers being added
+	{
+		std::lock_guard<std::mutex> locker(this->_timer_mutex);
+		this->_terminated = true;
+	}
+
+	// producers blocked on a full queue give up, their jobs are cancelled
+	this->_job_manager->releaseCapacityWaiters();
+
+	// pending timers are dropped, their jobs were never queued
+	this->stopTimers();
+
+	if (wait_for_finish_jobs)
+	{
+		auto deadline = std::chrono::steady_clock::time_point::max();
+
+		if (max_wait_time != std::chrono::seconds(0))
+		{
+			deadline = std::chrono::steady_clock::now() + max_wait_time;
+		}
+
+		// queued and running jobs; returns as soon as the last one finishes
+		this->_job_manager->waitIdle(deadline);
+	}
+
+	this->stopWatchdog();
+
+	// take the workers out under the lock but join them outside it, so a job that is still
+	// running and adds another job cannot deadlock on the worker mutex
+	std::vector<std::shared_ptr<thread_worker>> workers;
+
+	{
+		std::lock_guard<std::mutex> locker(this->_woker_mutex);
+		workers.swap(this->_workers);
+		this->_scaled_workers.clear();
+		this->updateWorkersPriorityNumbers();
+	}
+
+	// Stop all workers (request_stop + notify + join)
+	for (int i = 0; i < (int)workers.size(); i++)
+	{
+		if (workers[i] != nullptr)
+		{
+			workers[i]->stopWorker();
+		}
+	}
+
+	// nobody is left to run what is still queued, in the shared queues or in the workers' deques:
+	// cancel it, which fails its futures and resumes its coroutines with job_cancelled_error
+	this->_job_manager->unregisterLocalQueues();
+	this->_job_manager->cancelQueuedJobs();
+	this->_job_manager->releaseIdleWaiters();
+}
+
+void thread_pool::wait_idle()
+{
+	this->_job_manager->waitIdle();
+}
+
+bool thread_pool::drain(std::chrono::steady_clock::time_point deadline)
+{
+	return this->_job_manager->waitIdle(deadline);
+}
+
+int thread_pool::getInFlightJobCount()
+{
+	return this->_job_manager->getInFlightJobCount();
+}
+
+bool thread_pool::isTerminated()
+{
+	return this->_terminated;
+}
+
+std::weak_ptr<job_manager> thread_pool::getJobManager()
+{
+	return this->_job_manager;
+}
+
+void thread_pool::notifyWakeUpWorkers(job_priority priority, int job_count, int numa_node)
+{
+	this->_job_manager->wakeIdleWorkers(priority, job_count, numa_node);
+}
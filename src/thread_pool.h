@@ -2,24 +2,83 @@
 
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <coroutine>
 #include <future>
+#include <map>
 #include <mutex>
 #include <memory>
+#include <optional>
 #include <stdexcept>
+#include <thread>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
 #include <functional>
+#include <iterator>
 
+#include "cpu_topology.h"
+#include "job_allocator.h"
+#include "job_graph.h"
 #include "job_manager.h"
+#include "job_tracer.h"
+#include "pool_metrics.h"
+#include "task_job.h"
 #include "thread_worker.h"
+#include "timer_wheel.h"
 
 class job_manager;
+class thread_pool;
+
+// elastic worker count for one priority, see thread_pool::setAutoscalePolicy()
+struct autoscale_policy
+{
+	// workers of the priority kept alive however idle they are
+	int min_workers = 0;
+
+	// upper bound for the priority's worker count, 0 turns autoscaling off for it
+	int max_workers = 0;
+
+	// add a worker while the priority's queue holds at least this many jobs (0: not checked)
+	int queue_depth_threshold = 0;
+
+	// add a worker while the oldest queued job has waited at least this long (0: not checked)
+	std::chrono::milliseconds wait_time_threshold { 0 };
+
+	// retire a worker above min_workers that has been parked this long
+	std::chrono::milliseconds idle_timeout { 5000 };
+};
+
+// awaitable returned by thread_pool::schedule(): suspends the coroutine and resumes it on a pool worker
+class schedule_awaitable
+{
+public:
+	schedule_awaitable(thread_pool* pool, job_priority priority);
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	// returns false (resume right here) when the pool is terminated; await_resume then throws
+	bool await_suspend(std::coroutine_handle<> handle);
+	void await_resume() const;
+
+private:
+	thread_pool* _pool;
+	job_priority _priority;
+	bool _rejected;
+
+	// the resume job was cancelled (full bounded queue); await_resume then throws job_cancelled_error
+	bool _cancelled;
+};
+
 class thread_pool: public std::enable_shared_from_this<thread_pool>
 {
 public:
-	thread_pool();
+	// priority_levels levels, job_priority(0) (HIGH_PRIORITY) the most urgent; 1..64, 3 by default
+	explicit thread_pool(int priority_levels = 3);
 	virtual ~thread_pool();
 
 public:
@@ -31,12 +90,55 @@ public:
 	void removeWorkers();
 
 public:
-	std::map<job_priority, int> _priority_worker_numbers;
+	// recount the workers per priority that route jobs of levels without workers; add/removeWorker
+	// and the autoscaler keep the counts up to date already
 	void setWorkersPriorityNumbers();
 	int getWorkerNumbers();
 
+	// workers of the priority, reserved ones included
+	int getWorkerNumbers(job_priority priority);
+
+public:
+	// one worker per physical core, pinned to that core's hardware threads; returns the number added
+	int addWorkersPerPhysicalCore(job_priority priority = job_priority::NORMAL_PRIORITY);
+
+	// NUMA mode: a job goes to the queue of the node it was submitted from (when that node has
+	// workers), and workers take jobs of another node only when their own node has none. Only
+	// useful with pinned workers on a machine with more than one node; a no-op on one node.
+	void setNumaAware(bool enable);
+	bool isNumaAware();
+
+public:
+	// create a job (or a job subclass) in job_allocator slab memory instead of the global heap
+	template <typename T = job, typename... Args>
+	static std::shared_ptr<T> make_job(Args&&... args)
+	{
+		return std::allocate_shared<T>(pool_allocator<T>(), std::forward<Args>(args)...);
+	}
+
+	// release slab memory that is no longer used by any job
+	void trimJobMemory();
+
+public:
+	// the handle cancels the job while it is still queued; an empty handle when the pool is terminated.
+	// A job of a full bounded priority is handled by its overflow_policy, see setQueueCapacity().
+	job_handle addJob(std::shared_ptr<job> new_job);
+	void addJobs(const std::vector<std::shared_ptr<job>>& new_jobs);
+
+	// queue the job only if its priority has room; false (job untouched) when full or terminated
+	bool tryAddJob(std::shared_ptr<job> new_job);
+
+	// cancel the queued jobs added with this id (not 0), see job_manager::cancelJob()
+	void cancelJob(unsigned long long job_id);
+
+	// called from inside a job of this pool: run one queued job on the calling worker instead of
+	// blocking it (see task_group); false on other threads or when nothing is queued
+	bool runPendingJob();
+
 public:
-	void addJob(std::shared_ptr<job> new_job);
+	// jobs added from inside a running job go to that worker's local deque, idle workers steal them
+	void setWorkStealing(bool enable);
+	bool isWorkStealing();
 
 public:
 	template <typename F, typename... Args>
@@ -50,30 +152,260 @@ public:
 	auto submit(job_priority priority, F&& func, Args&&... args)
 		-> std::future<std::invoke_result_t<F, Args...>>
 	{
-		using return_type = std::invoke_result_t<F, Args...>;
+		return submitTask({}, priority, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	// as submit(), scheduled earliest deadline first within the priority level (see job::setDeadline()),
+	// e.g. submit(job_deadline::after(5ms, deadline_policy::DROP), handle_request, request)
+	template <typename F, typename... Args>
+	auto submit(const job_deadline& deadline, F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		return submitTask({ .deadline = &deadline }, job_priority::NORMAL_PRIORITY, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	template <typename F, typename... Args>
+	auto submit(const job_deadline& deadline, job_priority priority, F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		return submitTask({ .deadline = &deadline }, priority, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	// as submit(), queued fairly among the other flows of the priority level (see job::setFlow()),
+	// e.g. submit(job_flow{ tenant_id }, handle_request, request)
+	template <typename F, typename... Args>
+	auto submit(const job_flow& flow, F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		return submitTask({ .flow = &flow }, job_priority::NORMAL_PRIORITY, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	template <typename F, typename... Args>
+	auto submit(const job_flow& flow, job_priority priority, F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		return submitTask({ .flow = &flow }, priority, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	// as submit(), in a cancellation group: after token.cancel() the job is skipped if it has not
+	// started, and the future throws job_cancelled_error
+	template <typename F, typename... Args>
+	auto submit(const cancellation_token& token, F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		return submitTask({ .token = &token }, job_priority::NORMAL_PRIORITY, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	template <typename F, typename... Args>
+	auto submit(const cancellation_token& token, job_priority priority, F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		return submitTask({ .token = &token }, priority, std::forward<F>(func), std::forward<Args>(args)...);
+	}
 
+	// as submit(), but never blocks, drops another job or runs it on this thread: nullopt when the
+	// priority's bounded queue is full or the pool is terminated
+	template <typename F, typename... Args>
+	auto try_submit(F&& func, Args&&... args)
+		-> std::optional<std::future<std::invoke_result_t<F, Args...>>>
+	{
+		return try_submit(job_priority::NORMAL_PRIORITY, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	template <typename F, typename... Args>
+	auto try_submit(job_priority priority, F&& func, Args&&... args)
+		-> std::optional<std::future<std::invoke_result_t<F, Args...>>>
+	{
 		if (this->_terminated)
 		{
-			std::promise<return_type> promise;
-			promise.set_exception(std::make_exception_ptr(std::runtime_error("thread_pool is terminated")));
-			return promise.get_future();
+			return std::nullopt;
 		}
 
-		auto task = std::make_shared<std::packaged_task<return_type()>>(
-			[func = std::forward<F>(func), args_tuple = std::make_tuple(std::forward<Args>(args)...)]() mutable -> return_type
-			{
-				return std::apply(std::move(func), std::move(args_tuple));
-			});
+		auto task = this->makeCallTask(priority, std::forward<F>(func), std::forward<Args>(args)...);
+		auto future = task->getFuture();
 
-		auto future = task->get_future();
-		auto task_job = std::make_shared<job>(priority, [task]() mutable { (*task)(); });
-		addJob(task_job);
+		if (!this->tryAddJob(std::move(task)))
+		{
+			return std::nullopt;
+		}
 
 		return future;
 	}
 
+	// submit func(element) for every element of [begin, end) as one batch
+	template <typename Iterator, typename F>
+	auto submit_bulk(job_priority priority, Iterator begin, Iterator end, F&& func)
+		-> std::vector<std::future<std::invoke_result_t<std::decay_t<F>&, typename std::iterator_traits<Iterator>::value_type&>>>
+	{
+		using value_type = typename std::iterator_traits<Iterator>::value_type;
+		using return_type = std::invoke_result_t<std::decay_t<F>&, value_type&>;
+
+		std::vector<std::future<return_type>> futures;
+
+		if (this->_terminated)
+		{
+			for (Iterator iter = begin; iter != end; ++iter)
+			{
+				std::promise<return_type> promise;
+				promise.set_exception(std::make_exception_ptr(std::runtime_error("thread_pool is terminated")));
+				futures.push_back(promise.get_future());
+			}
+
+			return futures;
+		}
+
+		// every job of the batch shares one copy of func
+		auto shared_func = std::make_shared<std::decay_t<F>>(std::forward<F>(func));
+		std::vector<std::shared_ptr<job>> batch_jobs;
+
+		for (Iterator iter = begin; iter != end; ++iter)
+		{
+			auto task = this->makeTaskJob<return_type>(priority,
+				[shared_func, value = value_type(*iter)]() mutable -> return_type
+				{
+					return (*shared_func)(value);
+				});
+
+			futures.push_back(task->getFuture());
+			batch_jobs.push_back(std::move(task));
+		}
+
+		addJobs(batch_jobs);
+
+		return futures;
+	}
+
+public:
+	// delayed and periodic jobs: a timer wheel owned by the pool pushes the job into its priority
+	// queue when it is due, so no worker sleeps through the delay. Resolution is 1ms, a timer never
+	// fires early. The returned handle cancels the timer in O(1); timers of a stopped pool are dropped.
+	template <typename Rep, typename Period, typename F, typename... Args>
+	timer_handle submit_after(std::chrono::duration<Rep, Period> delay, F&& func, Args&&... args)
+	{
+		return submit_after(job_priority::NORMAL_PRIORITY, delay, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	template <typename Rep, typename Period, typename F, typename... Args>
+	timer_handle submit_after(job_priority priority, std::chrono::duration<Rep, Period> delay, F&& func, Args&&... args)
+	{
+		return this->addTimer(priority, std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay),
+			std::chrono::milliseconds(0), this->bindTimerJob(std::forward<F>(func), std::forward<Args>(args)...));
+	}
+
+	// time points of any clock (system_clock too) are converted to a steady_clock deadline once, here
+	template <typename Clock, typename Duration, typename F, typename... Args>
+	timer_handle submit_at(std::chrono::time_point<Clock, Duration> time, F&& func, Args&&... args)
+	{
+		return submit_at(job_priority::NORMAL_PRIORITY, time, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	template <typename Clock, typename Duration, typename F, typename... Args>
+	timer_handle submit_at(job_priority priority, std::chrono::time_point<Clock, Duration> time, F&& func, Args&&... args)
+	{
+		return submit_after(priority, time - Clock::now(), std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	// first run one period from now, then every period (at least 1ms); a run is skipped while the
+	// previous one is still queued or running, so runs of one timer never overlap
+	template <typename Rep, typename Period, typename F, typename... Args>
+	timer_handle submit_every(std::chrono::duration<Rep, Period> period, F&& func, Args&&... args)
+	{
+		return submit_every(job_priority::NORMAL_PRIORITY, period, std::forward<F>(func), std::forward<Args>(args)...);
+	}
+
+	template <typename Rep, typename Period, typename F, typename... Args>
+	timer_handle submit_every(job_priority priority, std::chrono::duration<Rep, Period> period, F&& func, Args&&... args)
+	{
+		auto period_ms = std::chrono::duration_cast<std::chrono::milliseconds>(period);
+
+		if (period_ms.count() <= 0)
+		{
+			throw std::invalid_argument("submit_every needs a period of at least 1ms");
+		}
+
+		return this->addTimer(priority, std::chrono::steady_clock::now() + period_ms, period_ms,
+			this->bindTimerJob(std::forward<F>(func), std::forward<Args>(args)...));
+	}
+
+	// timers waiting to fire
+	size_t getTimerCount();
+
+public:
+	// queue depth, wait/run time histograms per priority and utilisation per worker, read while the pool runs
+	pool_metrics_snapshot snapshot();
+
+	// enabled by default; disabling skips the clock reads on push and around every job
+	void setMetricsEnabled(bool enable);
+	bool isMetricsEnabled();
+
+public:
+	// starvation watchdog: a job waiting longer than the threshold in a shared queue is moved to the
+	// next higher priority queue (LOW -> NORMAL -> HIGH), so background work gets bounded latency
+	// under a sustained flood of higher priority jobs. Zero (the default) turns the watchdog off.
+	void setStarvationThreshold(std::chrono::milliseconds threshold);
+	std::chrono::milliseconds getStarvationThreshold();
+
+public:
+	// autoscaling: the watchdog thread spawns a worker of the priority (one per check, every 10ms)
+	// while its queue depth or oldest wait crosses the policy thresholds and no idle worker can take
+	// the jobs, and retires workers parked longer than idle_timeout down to min_workers.
+	// A policy with max_workers 0 (the default) turns autoscaling off for the priority; workers
+	// added by hand are counted but never retired.
+	void setAutoscalePolicy(job_priority priority, const autoscale_policy& policy);
+	autoscale_policy getAutoscalePolicy(job_priority priority);
+
+public:
+	int getPriorityLevels();
+
+	// reserved capacity: the pool keeps `count` workers of the level that only ever run the level's
+	// own jobs, so its jobs find a worker however busy the other levels keep the rest of the pool
+	void setReservedWorkers(job_priority priority, int count);
+	int getReservedWorkers(job_priority priority);
+
+	// levels the (not reserved) workers of a level take jobs from once their own level is empty: the
+	// less urgent ones nearest first, then the more urgent ones nearest first. By default HIGH workers
+	// borrow from NORMAL only and every other level from all levels.
+	void setBorrowLevels(job_priority priority, const std::vector<job_priority>& levels);
+	std::vector<job_priority> getBorrowLevels(job_priority priority);
+
+public:
+	// backpressure: at most `capacity` jobs of the priority wait in its queues (0, the default, is
+	// unbounded). A push into a full level blocks (a pool worker runs queued jobs meanwhile), is
+	// cancelled, cancels the oldest queued job, or runs on the pushing thread, as the policy says.
+	void setQueueCapacity(job_priority priority, int capacity, overflow_policy policy = overflow_policy::BLOCK);
+	int getQueueCapacity(job_priority priority);
+	overflow_policy getOverflowPolicy(job_priority priority);
+
+public:
+	// how idle workers of a priority wait for jobs before they park (see wait_strategy), e.g. busy-spinning
+	// HIGH workers for low latency while NORMAL and LOW workers park. The first overload sets every priority.
+	void setWaitStrategy(const wait_strategy& strategy);
+	void setWaitStrategy(job_priority priority, const wait_strategy& strategy);
+	wait_strategy getWaitStrategy(job_priority priority);
+
+public:
+	// co_await pool->schedule(priority) continues the coroutine on a worker of this pool
+	schedule_awaitable schedule(job_priority priority = job_priority::NORMAL_PRIORITY);
+
+public:
+	// run a dependency graph; the future completes when every node has run or been skipped,
+	// with the first exception thrown by a node
+	std::future<void> submitGraph(job_graph& graph);
+
+public:
+	// block until no job is queued or running; woken by the worker that finishes the last job.
+	// Timers that are not due yet do not count. Never call it from inside a job of this pool.
+	void wait_idle();
+
+	// wait_idle() with a deadline: true when the pool went idle, false on timeout or when the pool stopped
+	bool drain(std::chrono::steady_clock::time_point deadline);
+
+	// jobs queued or running
+	int getInFlightJobCount();
+
 public:
 	void stopPool(bool wait_for_finish_jobs = false, std::chrono::seconds max_wait_time = std::chrono::seconds(0));
+	bool isTerminated();
 
 public:
 	std::weak_ptr<job_manager> getJobManager();
@@ -86,7 +418,136 @@ private:
 	std::shared_ptr<job_manager> _job_manager;
 	std::vector<std::shared_ptr<thread_worker>> _workers;
 
+	// workers the autoscaler spawned, the only ones it retires again
+	std::vector<thread_worker*> _scaled_workers;
+
+	// worker count per priority, used to route jobs of levels without workers; read by every producer
+	// without _woker_mutex, so an entry exists for every level from the start
+	std::map<job_priority, std::atomic_int> _priority_worker_numbers;
+
+	// the same without reserved workers: the levels a job may be moved to
+	std::map<job_priority, std::atomic_int> _shared_worker_numbers;
+
 public:
-	void notifyWakeUpWorkers();
+	// wakes parked workers through the job manager's idle registry, those of numa_node first when it is given
+	void notifyWakeUpWorkers(job_priority priority, int job_count = 1, int numa_node = -1);
+
+private:
+	void resolveJobPriority(const std::shared_ptr<job>& new_job);
+
+	// apply the overflow policy of the job's priority; false when the job must not be queued
+	// because it was cancelled or already ran on the calling thread. Without may_block, BLOCK and
+	// CALLER_RUNS reject the job instead.
+	bool admitJob(const std::shared_ptr<job>& new_job, bool may_block = true);
+	void enqueueJob(std::shared_ptr<job> new_job);
+
+	// recount _priority_worker_numbers, _woker_mutex must be held
+	void updateWorkersPriorityNumbers();
+
+	// a wake-up may have claimed a worker that was stopped since, hand the queued jobs to others
+	void wakeWorkersForQueuedJobs();
+
+	// start the watchdog thread if aging or autoscaling needs it, _watchdog_mutex must be held
+	void startWatchdog();
+	bool hasWatchdogWork();
+	void stopWatchdog();
+	void watchdog_function(std::stop_token stop_token);
+
+	void autoscaleWorkers(const std::map<job_priority, autoscale_policy>& policies);
+	bool isOverloaded(job_priority priority, const autoscale_policy& policy);
+
+	timer_handle addTimer(job_priority priority, std::chrono::steady_clock::time_point deadline, std::chrono::milliseconds period, job_function work);
+
+	// push a due timer job from the timer thread without blocking it; a job that does not fit is cancelled
+	void addTimerJob(std::shared_ptr<job> due_job);
+	void stopTimers();
+
+	// periodic timers call the same function every time, so arguments are passed as lvalues
+	template <typename F, typename... Args>
+	static job_function bindTimerJob(F&& func, Args&&... args)
+	{
+		return [func = std::forward<F>(func), args_tuple = std::make_tuple(std::forward<Args>(args)...)]() mutable
+		{
+			std::apply(func, args_tuple);
+		};
+	}
+
+	// what a submit() overload attaches to its job, nullptr for none
+	struct submit_options
+	{
+		const cancellation_token* token = nullptr;
+		const job_deadline* deadline = nullptr;
+		const job_flow* flow = nullptr;
+	};
+
+	template <typename F, typename... Args>
+	auto submitTask(const submit_options& options, job_priority priority, F&& func, Args&&... args)
+		-> std::future<std::invoke_result_t<F, Args...>>
+	{
+		using return_type = std::invoke_result_t<F, Args...>;
+
+		if (this->_terminated)
+		{
+			std::promise<return_type> promise;
+			promise.set_exception(std::make_exception_ptr(std::runtime_error("thread_pool is terminated")));
+			return promise.get_future();
+		}
+
+		auto task = this->makeCallTask(priority, std::forward<F>(func), std::forward<Args>(args)...);
+
+		if (options.token != nullptr)
+		{
+			task->setCancellationToken(*options.token);
+		}
+
+		if (options.deadline != nullptr)
+		{
+			task->setDeadline(*options.deadline);
+		}
+
+		if (options.flow != nullptr)
+		{
+			task->setFlow(*options.flow);
+		}
+
+		auto future = task->getFuture();
+		addJob(std::move(task));
+
+		return future;
+	}
+
+	template <typename F, typename... Args>
+	auto makeCallTask(job_priority priority, F&& func, Args&&... args)
+	{
+		using return_type = std::invoke_result_t<F, Args...>;
+
+		return this->makeTaskJob<return_type>(priority,
+			[func = std::forward<F>(func), args_tuple = std::make_tuple(std::forward<Args>(args)...)]() mutable -> return_type
+			{
+				return std::apply(std::move(func), std::move(args_tuple));
+			});
+	}
+
+	template <typename R, typename F>
+	std::shared_ptr<task_job<R, F>> makeTaskJob(job_priority priority, F&& func)
+	{
+		return std::allocate_shared<task_job<R, F>>(pool_allocator<task_job<R, F>>(), priority, std::move(func));
+	}
+
+private:
+	std::mutex _watchdog_mutex;
+	std::condition_variable_any _watchdog_condition;
+
+	// guarded by _watchdog_mutex; only priorities with max_workers > 0 are stored
+	std::map<job_priority, autoscale_policy> _autoscale_policies;
+
+	// max_workers per priority, read without a lock when jobs are routed
+	std::map<job_priority, std::atomic_int> _autoscale_max_workers;
+
+	std::mutex _timer_mutex;
+	std::shared_ptr<timer_wheel> _timer_wheel;
 
+	// declared last so they are joined before the members they use are destroyed
+	std::jthread _timer_thread;
+	std::jthread _watchdog_thread;
 };
@@ -1,9 +1,54 @@
 #include "thread_worker.h"
 
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "cpu_topology.h"
+#include "job_allocator.h"
+#include "job_tracer.h"
+
+thread_local thread_worker* thread_worker::_current_worker = nullptr;
+
+namespace
+{
+	// tell the core we are in a spin loop: saves power and frees the pipeline for a hyperthread sibling
+	inline void cpuRelax()
+	{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+		_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+
+	// trim() walks every global free list; a pool that goes idle many times a second only needs
+	// one walk per interval, done by whichever last-parking worker gets here first
+	constexpr long long idle_trim_interval_ns = 100'000'000;
+	std::atomic<long long> last_idle_trim { 0 };
+
+	void trimIdleMemory()
+	{
+		long long now = metricsClockNow();
+		long long last = last_idle_trim.load(std::memory_order_relaxed);
+
+		if (now - last < idle_trim_interval_ns || !last_idle_trim.compare_exchange_strong(last, now, std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		job_allocator::trim();
+	}
+}
+
 thread_worker::thread_worker(job_priority job_priority)
+	: _reserved(false), _job_match_levels(0), _idle(false), _wake_pending(false), _idle_slot(-1), _idle_levels(0), _jobs_executed(0), _busy_ns(0), _start_time(0), _idle_since(0), _numa_node(-1)
 {
 	this->_terminated = false;
 	this->_job_priority = job_priority;
+	this->_local_jobs = std::make_shared<work_stealing_deque>(job_priority);
 
 	this->setJobMatchPriorities();
 }
@@ -12,11 +57,58 @@ thread_worker::~thread_worker()
 {
 	this->stopWorker();
 
+	std::shared_ptr<job_manager> manager = this->_job_manager.lock();
+
+	if (manager != nullptr)
+	{
+		manager->unregisterWorker(this->_idle_slot);
+		manager->unregisterLocalQueue(this->_local_jobs);
+		manager->removeNodeWorker(this->_numa_node);
+	}
 }
 
 void thread_worker::setJobManager(std::shared_ptr<job_manager> job_manager)
 {
+	std::shared_ptr<class job_manager> old_manager = this->_job_manager.lock();
+
+	if (old_manager == job_manager)
+	{
+		return;
+	}
+
+	if (old_manager != nullptr)
+	{
+		// a thread parked in the old manager would keep its slot in that manager's idle masks
+		this->stopWorker();
+
+		old_manager->unregisterWorker(this->_idle_slot);
+		old_manager->unregisterLocalQueue(this->_local_jobs);
+		old_manager->removeNodeWorker(this->_numa_node);
+	}
+
 	this->_job_manager = job_manager;
+	this->_idle_slot = -1;
+
+	if (job_manager != nullptr)
+	{
+		this->_idle_slot = job_manager->registerWorker(this);
+		job_manager->registerLocalQueue(this->_local_jobs);
+		job_manager->addNodeWorker(this->_numa_node);
+
+		// the worker is not running yet, nobody reads the histograms while they are replaced
+		while ((int)this->_wait_times.size() < job_manager->getPriorityLevels())
+		{
+			this->_wait_times.push_back(std::make_unique<latency_histogram>());
+			this->_run_times.push_back(std::make_unique<latency_histogram>());
+		}
+	}
+
+	this->setJobMatchPriorities();
+}
+
+thread_worker* thread_worker::current()
+{
+	return _current_worker;
 }
 
 void thread_worker::startWorker()
@@ -24,6 +116,7 @@ void thread_worker::startWorker()
 	this->stopWorker();
 
 	this->_terminated = false;
+	this->_start_time = metricsClockNow();
 
 	// Use lambda to properly capture this and pass stop_token
 	this->_worker_thread = std::jthread([this](std::stop_token st) {
@@ -56,37 +149,174 @@ job_priority thread_worker::getPriority()
 
 void thread_worker::setJobMatchPriorities()
 {
-	switch (this->_job_priority)
+	std::shared_ptr<job_manager> manager = this->_job_manager.lock();
+
+	// without a manager there is nothing to borrow from
+	if (manager == nullptr)
 	{
-		case job_priority::HIGH_PRIORITY:
-		{
-			this->_job_match_priorities = { job_priority::HIGH_PRIORITY, job_priority::NORMAL_PRIORITY };
-			break;
-		}
+		this->_job_match_levels = this->_job_priority >= 0 && this->_job_priority < 64 ? 1ull << this->_job_priority : 0;
+		return;
+	}
 
-		case job_priority::NORMAL_PRIORITY:
-		{
-			this->_job_match_priorities = { job_priority::NORMAL_PRIORITY, job_priority::LOW_PRIORITY, job_priority::HIGH_PRIORITY };
-			break;
-		}
+	this->_job_match_levels = manager->getJobMatchLevels(this->_job_priority, this->_reserved);
+}
 
-		case job_priority::LOW_PRIORITY:
-		{
-			this->_job_match_priorities = { job_priority::LOW_PRIORITY, job_priority::NORMAL_PRIORITY, job_priority::HIGH_PRIORITY };
-			break;
-		}
+void thread_worker::setReserved(bool reserved)
+{
+	this->_reserved = reserved;
 
-		default:
-			this->_job_match_priorities = { job_priority::HIGH_PRIORITY, job_priority::NORMAL_PRIORITY, job_priority::LOW_PRIORITY };
-			break;
+	this->setJobMatchPriorities();
+}
+
+bool thread_worker::isReserved()
+{
+	return this->_reserved;
+}
+
+void thread_worker::setCpuAffinity(const std::vector<int>& cpus)
+{
+	this->_cpu_affinity = cpus;
+
+	if (!cpus.empty())
+	{
+		this->_numa_node = cpu_topology::system().getNodeOfCpu(cpus.front());
 	}
 }
 
+const std::vector<int>& thread_worker::getCpuAffinity()
+{
+	return this->_cpu_affinity;
+}
+
+void thread_worker::setNumaNode(int numa_node)
+{
+	this->_numa_node = numa_node;
+}
+
+int thread_worker::getNumaNode()
+{
+	return this->_numa_node;
+}
+
+bool thread_worker::canPushLocalJob(const std::shared_ptr<job>& new_job, const std::shared_ptr<job_manager>& manager)
+{
+	// only the owning thread may push, and only jobs this worker would pick first itself;
+	// jobs with a deadline or a flow have to wait in their level's queues to be ordered
+	if (_current_worker != this || new_job->getJobPriority() != this->_job_priority || new_job->getDeadline() > 0 || new_job->getFlowId() != 0)
+	{
+		return false;
+	}
+
+	return manager != nullptr && manager == this->_job_manager.lock();
+}
+
+bool thread_worker::pushLocalJob(std::shared_ptr<job> new_job, std::shared_ptr<job_manager> manager)
+{
+	if (!this->canPushLocalJob(new_job, manager))
+	{
+		return false;
+	}
+
+	manager->push_local_job(this->_local_jobs.get(), std::move(new_job));
+
+	return true;
+}
+
+void thread_worker::pushLocalJobs(const std::vector<std::shared_ptr<job>>& new_jobs, std::shared_ptr<job_manager> manager)
+{
+	manager->push_local_jobs(this->_local_jobs.get(), new_jobs);
+}
+
 void thread_worker::notifyWakeUp()
 {
 	this->_worker_condition.notify_one();
 }
 
+bool thread_worker::tryWakeUp()
+{
+	// a worker that was claimed already is skipped without its lock
+	if (!this->_idle.load())
+	{
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(this->_worker_mutex);
+
+		// claim the idle worker, only one notifier may win it
+		if (!this->claimIdle())
+		{
+			return false;
+		}
+
+		this->_wake_pending = true;
+	}
+
+	if (job_tracer::isEnabled())
+	{
+		job_tracer::record(trace_event_type::NOTIFY, 0, this->_job_priority);
+	}
+
+	this->_worker_condition.notify_one();
+
+	return true;
+}
+
+bool thread_worker::tryRetire()
+{
+	// park() leaves its wait and clears _idle under this mutex, so a worker claimed here still sees the
+	// stop request before it looks for a job
+	std::lock_guard<std::mutex> locker(this->_worker_mutex);
+
+	if (!this->claimIdle())
+	{
+		return false;
+	}
+
+	this->_worker_thread.request_stop();
+
+	return true;
+}
+
+bool thread_worker::claimIdle()
+{
+	bool expected = true;
+
+	if (!this->_idle.compare_exchange_strong(expected, false))
+	{
+		return false;
+	}
+
+	std::shared_ptr<job_manager> manager = this->_job_manager.lock();
+
+	if (manager != nullptr)
+	{
+		manager->removeIdleWorker(this->_idle_slot, this->_idle_levels);
+	}
+
+	return true;
+}
+
+bool thread_worker::isIdle()
+{
+	return this->_idle.load();
+}
+
+long long thread_worker::getIdleSince()
+{
+	return this->_idle_since.load(std::memory_order_relaxed);
+}
+
+bool thread_worker::canRunPriority(job_priority priority)
+{
+	if (priority < 0 || priority >= 64)
+	{
+		return false;
+	}
+
+	return (this->_job_match_levels.load(std::memory_order_relaxed) & (1ull << priority)) != 0;
+}
+
 void thread_worker::jobCountChanged()
 {
 	this->_worker_condition.notify_all();
@@ -106,47 +336,313 @@ bool thread_worker::checkwakeUpCondition()
 		return false;
 	}
 
-	return manager->getJobCount(this->_job_match_priorities) > 0;
+	return this->hasPendingJob(manager);
 }
 
-void thread_worker::worker_function(std::stop_token stop_token)
+bool thread_worker::hasPendingJob(const std::shared_ptr<job_manager>& manager)
 {
-	while (!stop_token.stop_requested())
+	uint64_t levels = this->_job_match_levels.load(std::memory_order_relaxed);
+
+	if (manager->getJobCount(levels) > 0)
 	{
-		std::shared_ptr<job> cur_job = nullptr;
+		return true;
+	}
+
+	return manager->isWorkStealing() && manager->getStealableJobCount(levels) > 0;
+}
+
+std::shared_ptr<job> thread_worker::spinForJob(std::stop_token& stop_token)
+{
+	std::shared_ptr<job_manager> manager = this->_job_manager.lock();
+
+	if (manager == nullptr)
+	{
+		return nullptr;
+	}
+
+	wait_strategy strategy = manager->getWaitStrategy(this->_job_priority);
+
+	if (strategy.park && strategy.spin_count <= 0 && strategy.yield_count <= 0)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<job> found = nullptr;
 
-		std::unique_lock<std::mutex> locker(this->_worker_mutex);
-		this->_worker_condition.wait(locker, stop_token, [this] {return this->checkwakeUpCondition(); });
+	manager->addSpinningWorker(this->_job_priority);
 
-		// Check if stop was requested during wait
-		if (stop_token.stop_requested())
+	while (found == nullptr && !stop_token.stop_requested())
+	{
+		for (int i = 0; i < strategy.spin_count && found == nullptr && !stop_token.stop_requested(); i++)
+		{
+			cpuRelax();
+
+			if (this->hasPendingJob(manager))
+			{
+				found = this->acquireJob(manager);
+			}
+		}
+
+		for (int i = 0; i < strategy.yield_count && found == nullptr && !stop_token.stop_requested(); i++)
+		{
+			std::this_thread::yield();
+
+			if (this->hasPendingJob(manager))
+			{
+				found = this->acquireJob(manager);
+			}
+		}
+
+		if (strategy.park)
 		{
 			break;
 		}
 
+		// a never-parking worker follows strategy changes, and always spins at least a little
+		strategy = manager->getWaitStrategy(this->_job_priority);
+		strategy.spin_count = std::max(strategy.spin_count, strategy.park ? 0 : 1);
+	}
+
+	manager->removeSpinningWorker(this->_job_priority);
+
+	return found;
+}
+
+std::shared_ptr<job> thread_worker::acquireJob(std::shared_ptr<job_manager>& manager)
+{
+	uint64_t levels = this->_job_match_levels.load(std::memory_order_relaxed);
+
+	if (manager->isWorkStealing())
+	{
+		// own deque first (LIFO), then steal from another worker (FIFO), then the shared queues
+		std::shared_ptr<job> local_job = manager->take_local_job(this->_local_jobs.get());
+
+		if (local_job != nullptr)
+		{
+			return local_job;
+		}
+
+		local_job = manager->steal_job(this->_local_jobs.get(), levels);
+
+		if (local_job != nullptr)
+		{
+			return local_job;
+		}
+	}
+
+	// get job that match thread's priority.
+	// if there is no job match priority, thread find lower priority job than itself's priority(in priority range)
+	return manager->pop_job(this->_job_priority, levels, this->_numa_node);
+}
+
+void thread_worker::park(std::stop_token& stop_token)
+{
+	std::shared_ptr<job_manager> manager = this->_job_manager.lock();
+
+	// hand cached job memory back while idle, and release free slabs once the whole pool is idle
+	job_allocator::flushThreadCache();
+
+	std::unique_lock<std::mutex> locker(this->_worker_mutex);
+
+	// register as idle before the final check so a push either sees us idle or we see its job
+	if (manager != nullptr)
+	{
+		this->_idle_levels = this->_job_match_levels.load(std::memory_order_relaxed);
+		this->_idle = true;
+
+		// the last worker to park releases free slabs, outside the lock so a wake-up is not held up
+		if (manager->addIdleWorker(this->_idle_slot, this->_idle_levels) >= manager->getRegisteredWorkerCount() && manager->getAllJobCount() <= 0)
+		{
+			locker.unlock();
+			trimIdleMemory();
+			locker.lock();
+		}
+	}
+
+	bool tracing = job_tracer::isEnabled();
+
+	this->_idle_since.store(metricsClockNow(), std::memory_order_relaxed);
+
+	if (tracing)
+	{
+		job_tracer::record(trace_event_type::PARK, 0, this->_job_priority);
+	}
+
+	this->_worker_condition.wait(locker, stop_token, [this] { return this->_wake_pending || this->checkwakeUpCondition(); });
+
+	if (tracing)
+	{
+		job_tracer::record(trace_event_type::WAKEUP, 0, this->_job_priority);
+	}
+
+	this->_wake_pending = false;
+	this->_idle_since.store(0, std::memory_order_relaxed);
+
+	if (manager != nullptr)
+	{
+		this->claimIdle();
+	}
+}
+
+void thread_worker::worker_function(std::stop_token stop_token)
+{
+	_current_worker = this;
+
+	if (!this->_cpu_affinity.empty())
+	{
+		cpu_topology::pinCurrentThread(this->_cpu_affinity);
+	}
+
+	job_tracer::setThreadName("worker (priority " + std::to_string((int)this->_job_priority) + ")");
+
+	while (!stop_token.stop_requested())
+	{
 		std::shared_ptr<job_manager> manager = this->_job_manager.lock();
+		std::weak_ptr<job_manager> source_manager = manager;
+		std::shared_ptr<job> cur_job = nullptr;
+
+		bool record_metrics = false;
 
-		if (manager == nullptr)
+		if (manager != nullptr)
 		{
-			continue;
+			cur_job = this->acquireJob(manager);
+			record_metrics = manager->isMetricsEnabled();
+			manager.reset();
 		}
 
-		// get job that match thread's priority.
-		// if there is no job match priority, thread find lower priority job than itself's priority(in priority range)
-		cur_job = manager->pop_job(this->_job_match_priorities);
+		if (cur_job == nullptr)
+		{
+			cur_job = this->spinForJob(stop_token);
+		}
 
-		if (!cur_job)
+		if (cur_job == nullptr)
 		{
+			this->park(stop_token);
 			continue;
 		}
 
+		// a job taken off a queue is always run, even when a stop came in meanwhile, so it is never lost
+		this->executeJob(cur_job, record_metrics, source_manager);
+	}
+}
+
+bool thread_worker::runPendingJob(const std::shared_ptr<job_manager>& manager)
+{
+	std::shared_ptr<job_manager> own_manager = this->_job_manager.lock();
+
+	if (own_manager == nullptr || own_manager != manager)
+	{
+		return false;
+	}
+
+	std::shared_ptr<job> cur_job = this->acquireJob(own_manager);
+
+	if (cur_job == nullptr)
+	{
+		return false;
+	}
+
+	this->executeJob(cur_job, own_manager->isMetricsEnabled(), own_manager);
+
+	return true;
+}
+
+void thread_worker::executeJob(const std::shared_ptr<job>& cur_job, bool record_metrics, const std::weak_ptr<job_manager>& source_manager)
+{
+	std::shared_ptr<job_manager> manager = source_manager.lock();
+
+	// off the queue: its slot in a bounded level is free for the next push
+	if (manager != nullptr)
+	{
+		manager->releaseCapacity(cur_job);
 		manager.reset();
-		locker.unlock();
+	}
+
+	cur_job->setJobManager(this->_job_manager);
 
-		if (stop_token.stop_requested()) break;
-		if (cur_job == nullptr || cur_job.use_count() == 0) continue;
+	// a cancelled job, or one that already ran through another queue (task_group), is dropped here
+	if (cur_job->tryStart())
+	{
+		this->runJob(cur_job, record_metrics);
+		cur_job->finishRun();
+	}
 
-		cur_job->setJobManager(this->_job_manager);
+	manager = source_manager.lock();
+
+	if (manager != nullptr)
+	{
+		manager->finishJob();
+	}
+}
+
+void thread_worker::runJob(const std::shared_ptr<job>& cur_job, bool record_metrics)
+{
+	if (job_tracer::isEnabled())
+	{
+		job_tracer::record(trace_event_type::JOB_BEGIN, cur_job->getTraceId(), cur_job->getJobPriority());
+		this->runMeasuredJob(cur_job, record_metrics);
+		job_tracer::record(trace_event_type::JOB_END, cur_job->getTraceId(), cur_job->getJobPriority());
+		return;
+	}
+
+	this->runMeasuredJob(cur_job, record_metrics);
+}
+
+void thread_worker::runMeasuredJob(const std::shared_ptr<job>& cur_job, bool record_metrics)
+{
+	if (!record_metrics || this->_run_times.empty())
+	{
 		cur_job->work();
+		return;
+	}
+
+	int index = std::clamp((int)cur_job->getJobPriority(), 0, (int)this->_run_times.size() - 1);
+	long long start_time = metricsClockNow();
+
+	if (cur_job->getEnqueueTime() > 0)
+	{
+		this->_wait_times[index]->record(start_time - cur_job->getEnqueueTime());
+	}
+
+	cur_job->work();
+
+	long long run_time = metricsClockNow() - start_time;
+
+	this->_run_times[index]->record(run_time);
+	this->_jobs_executed.store(this->_jobs_executed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	this->_busy_ns.store(this->_busy_ns.load(std::memory_order_relaxed) + (uint64_t)run_time, std::memory_order_relaxed);
+}
+
+void thread_worker::collectMetrics(pool_metrics_snapshot& snapshot)
+{
+	while (snapshot.priorities.size() < this->_run_times.size())
+	{
+		snapshot.priorities.push_back(priority_metrics_snapshot());
+		snapshot.priorities.back().priority = (job_priority)(snapshot.priorities.size() - 1);
+	}
+
+	for (int i = 0; i < (int)this->_run_times.size(); i++)
+	{
+		this->_wait_times[i]->mergeInto(snapshot.priorities[i].wait_time);
+		this->_run_times[i]->mergeInto(snapshot.priorities[i].run_time);
+		snapshot.priorities[i].executed = snapshot.priorities[i].run_time.count;
 	}
-}
\ No newline at end of file
+
+	worker_metrics_snapshot worker_metrics;
+	worker_metrics.priority = this->_job_priority;
+	worker_metrics.jobs_executed = this->_jobs_executed.load(std::memory_order_relaxed);
+	worker_metrics.busy_ns = this->_busy_ns.load(std::memory_order_relaxed);
+
+	long long start_time = this->_start_time.load(std::memory_order_relaxed);
+
+	if (start_time > 0)
+	{
+		uint64_t lifetime = (uint64_t)std::max(0LL, metricsClockNow() - start_time);
+		worker_metrics.idle_ns = lifetime > worker_metrics.busy_ns ? lifetime - worker_metrics.busy_ns : 0;
+	}
+
+	uint64_t total = worker_metrics.busy_ns + worker_metrics.idle_ns;
+	worker_metrics.utilisation = total > 0 ? (double)worker_metrics.busy_ns / (double)total : 0.0;
+
+	snapshot.workers.push_back(worker_metrics);
+}
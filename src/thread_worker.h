@@ -15,30 +15,113 @@ public:
 
 	void setJobManager(std::shared_ptr<job_manager> job_manager);
 
+	// worker running on the calling thread, or nullptr when called from outside a worker
+	static thread_worker* current();
+
 private:
 	job_priority _job_priority;
-	std::vector<job_priority> _job_match_priorities;
+	bool _reserved;
+
+	// levels this worker runs, bit i for job_priority(i); rebuilt by setJobMatchPriorities()
+	std::atomic<uint64_t> _job_match_levels;
 	std::atomic_bool _terminated;
 
+	// set while parked; a notifier that flips it back claims this worker for one wake-up. _idle and
+	// the worker's bits in the manager's idle masks only change under _worker_mutex.
+	std::atomic_bool _idle;
+	bool _wake_pending;
+
+	// slot in the manager's idle-worker registry (-1 without a manager) and the levels it is parked for
+	int _idle_slot;
+	uint64_t _idle_levels;
+
 	std::jthread _worker_thread;
 	std::mutex _worker_mutex;
 	std::condition_variable_any _worker_condition;
 
 	std::weak_ptr<job_manager> _job_manager;
 
+	// local deque used in work-stealing mode
+	std::shared_ptr<work_stealing_deque> _local_jobs;
+
+	// written only by the worker thread, read by thread_pool::snapshot(); one per priority level of the manager
+	std::vector<std::unique_ptr<latency_histogram>> _wait_times;
+	std::vector<std::unique_ptr<latency_histogram>> _run_times;
+	std::atomic<uint64_t> _jobs_executed;
+	std::atomic<uint64_t> _busy_ns;
+	std::atomic<long long> _start_time;
+
+	// steady-clock nanoseconds when the worker parked, 0 while it is running
+	std::atomic<long long> _idle_since;
+
+	// CPUs the thread is pinned to when it starts (empty: not pinned) and the NUMA node it serves
+	std::vector<int> _cpu_affinity;
+	int _numa_node;
+
+	static thread_local thread_worker* _current_worker;
+
 private:
 	void jobCountChanged();
 	bool checkwakeUpCondition();
+	bool hasPendingJob(const std::shared_ptr<job_manager>& manager);
+	std::shared_ptr<job> acquireJob(std::shared_ptr<job_manager>& manager);
+
+	// flip _idle back and leave the idle masks; false when not parked. _worker_mutex must be held
+	bool claimIdle();
+
+	// spin and yield as the wait strategy says before parking, returns a job when one showed up
+	std::shared_ptr<job> spinForJob(std::stop_token& stop_token);
+	void park(std::stop_token& stop_token);
+	void executeJob(const std::shared_ptr<job>& cur_job, bool record_metrics, const std::weak_ptr<job_manager>& source_manager);
+	void runJob(const std::shared_ptr<job>& cur_job, bool record_metrics);
+	void runMeasuredJob(const std::shared_ptr<job>& cur_job, bool record_metrics);
 
 public:
 	void startWorker();
 	void stopWorker();
 
 	job_priority getPriority();
+
+	// take the levels to run from the job manager's borrow settings; called when the worker joins a
+	// manager and again by the pool whenever the borrow settings change
 	void setJobMatchPriorities();
 
+	// a reserved worker only runs jobs of its own level, so the level always has it available.
+	// Set before the worker is added to a pool.
+	void setReserved(bool reserved);
+	bool isReserved();
+
+	// pin the worker thread to these CPUs from its next start; the worker's NUMA node becomes the
+	// node of the first CPU. Set both before the worker is added to a pool.
+	void setCpuAffinity(const std::vector<int>& cpus);
+	const std::vector<int>& getCpuAffinity();
+
+	// NUMA node whose queues this worker serves first, -1 (the default for unpinned workers) for none
+	void setNumaNode(int numa_node);
+	int getNumaNode();
+
+	// push a job spawned by the job running on this worker into its local deque
+	bool canPushLocalJob(const std::shared_ptr<job>& new_job, const std::shared_ptr<job_manager>& manager);
+	bool pushLocalJob(std::shared_ptr<job> new_job, std::shared_ptr<job_manager> manager);
+	void pushLocalJobs(const std::vector<std::shared_ptr<job>>& new_jobs, std::shared_ptr<job_manager> manager);
+
+	// help from inside a running job: take one queued job of the manager and run it on this thread;
+	// false when this worker serves another manager or nothing is queued
+	bool runPendingJob(const std::shared_ptr<job_manager>& manager);
+
 public:
 	void notifyWakeUp();
+	bool tryWakeUp();
+
+	// claim a parked worker like tryWakeUp() and ask it to stop before it can leave park(), so it takes
+	// no further job; false when it is not parked or a notifier claimed it first. Join with stopWorker().
+	bool tryRetire();
+	bool isIdle();
+	long long getIdleSince();
+	bool canRunPriority(job_priority priority);
 	void worker_function(std::stop_token stop_token);
+
+	// add this worker's counters to the snapshot (priority histograms are merged, one worker entry appended)
+	void collectMetrics(pool_metrics_snapshot& snapshot);
 };
 
@@ -0,0 +1,333 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+using timer_detail::timer_entry;
+
+namespace
+{
+	constexpr uint64_t no_tick = std::numeric_limits<uint64_t>::max();
+}
+
+timer_handle::timer_handle(std::weak_ptr<timer_entry> entry)
+	: _entry(std::move(entry))
+{
+}
+
+bool timer_handle::cancel()
+{
+	std::shared_ptr<timer_entry> entry = this->_entry.lock();
+
+	if (entry == nullptr)
+	{
+		return false;
+	}
+
+	std::shared_ptr<timer_wheel> wheel = entry->wheel.lock();
+
+	return wheel != nullptr && wheel->cancel(entry.get());
+}
+
+bool timer_handle::isPending() const
+{
+	return !this->_entry.expired();
+}
+
+timer_wheel::timer_wheel()
+	: _start(clock::now()), _current_tick(0), _wake_tick(no_tick), _changed(false), _slots(), _occupied(), _count(0)
+{
+}
+
+timer_wheel::~timer_wheel()
+{
+	this->clear();
+}
+
+timer_handle timer_wheel::add(clock::time_point deadline, tick_duration period, job_function fire)
+{
+	auto entry = std::make_shared<timer_entry>();
+	entry->period = (uint64_t)std::max<long long>(period.count(), 0);
+	entry->fire = std::move(fire);
+	entry->wheel = this->weak_from_this();
+	entry->self = entry;
+
+	std::lock_guard<std::mutex> locker(this->_mutex);
+
+	// never early: the deadline is rounded up to the next tick, and at least one tick ahead
+	entry->deadline = std::max(this->toTick(deadline + tick_duration(1) - clock::duration(1)), this->_current_tick + 1);
+
+	this->insert(entry.get());
+	this->_count++;
+
+	// only a deadline before the timer thread's planned wake-up needs to wake it
+	if (entry->deadline < this->_wake_tick)
+	{
+		this->_changed = true;
+		this->_condition.notify_one();
+	}
+
+	return timer_handle(entry);
+}
+
+bool timer_wheel::cancel(timer_entry* entry)
+{
+	// declared before the lock, so the entry and its callback are released after the unlock
+	std::shared_ptr<timer_entry> self;
+
+	std::lock_guard<std::mutex> locker(this->_mutex);
+
+	if (entry->level < 0)
+	{
+		return false;
+	}
+
+	this->unlink(entry);
+	this->_count--;
+
+	self = std::move(entry->self);
+
+	return true;
+}
+
+void timer_wheel::clear()
+{
+	std::vector<std::shared_ptr<timer_entry>> dropped;
+
+	{
+		std::lock_guard<std::mutex> locker(this->_mutex);
+
+		for (int level = 0; level < levels; level++)
+		{
+			for (int slot = 0; slot < slots; slot++)
+			{
+				while (this->_slots[level][slot] != nullptr)
+				{
+					timer_entry* entry = this->_slots[level][slot];
+
+					this->unlink(entry);
+					dropped.push_back(std::move(entry->self));
+				}
+			}
+		}
+
+		this->_count = 0;
+	}
+
+	// fire callbacks are destroyed outside the lock, they may own jobs with arbitrary captures
+	dropped.clear();
+}
+
+size_t timer_wheel::size()
+{
+	std::lock_guard<std::mutex> locker(this->_mutex);
+
+	return this->_count;
+}
+
+bool timer_wheel::runDue(std::stop_token stop_token)
+{
+	std::vector<std::shared_ptr<timer_entry>> due;
+
+	{
+		std::unique_lock<std::mutex> locker(this->_mutex);
+
+		while (true)
+		{
+			if (stop_token.stop_requested())
+			{
+				return false;
+			}
+
+			this->advanceTo(this->toTick(clock::now()), due);
+
+			if (!due.empty())
+			{
+				break;
+			}
+
+			this->_wake_tick = this->getNextWakeTick();
+			this->_changed = false;
+
+			if (this->_wake_tick == no_tick)
+			{
+				this->_condition.wait(locker, stop_token, [this] { return this->_changed; });
+			}
+			else
+			{
+				this->_condition.wait_until(locker, stop_token, this->toTime(this->_wake_tick), [this] { return this->_changed; });
+			}
+		}
+
+		// awake: timers added while the callbacks run are seen on the next round without a notify
+		this->_wake_tick = 0;
+	}
+
+	for (auto& entry : due)
+	{
+		entry->fire();
+	}
+
+	return true;
+}
+
+uint64_t timer_wheel::toTick(clock::time_point time) const
+{
+	if (time <= this->_start)
+	{
+		return 0;
+	}
+
+	return (uint64_t)std::chrono::duration_cast<tick_duration>(time - this->_start).count();
+}
+
+timer_wheel::clock::time_point timer_wheel::toTime(uint64_t tick) const
+{
+	return this->_start + tick_duration(tick);
+}
+
+void timer_wheel::insert(timer_entry* entry)
+{
+	uint64_t delta = entry->deadline - this->_current_tick;
+	int level = 0;
+
+	while (level < levels - 1 && delta >= (1ull << (slot_bits * (level + 1))))
+	{
+		level++;
+	}
+
+	int shift = slot_bits * level;
+	int slot = (int)((entry->deadline >> shift) & (slots - 1));
+
+	// beyond the wheel's span: park in the top slot that comes round last, it is placed again from there
+	if (delta >= (1ull << (slot_bits * levels)))
+	{
+		slot = (int)(((this->_current_tick >> shift) + slots - 1) & (slots - 1));
+	}
+
+	entry->level = level;
+	entry->slot = slot;
+	entry->prev = nullptr;
+	entry->next = this->_slots[level][slot];
+
+	if (entry->next != nullptr)
+	{
+		entry->next->prev = entry;
+	}
+
+	this->_slots[level][slot] = entry;
+	this->_occupied[level] |= 1ull << slot;
+}
+
+void timer_wheel::unlink(timer_entry* entry)
+{
+	if (entry->prev != nullptr)
+	{
+		entry->prev->next = entry->next;
+	}
+	else
+	{
+		this->_slots[entry->level][entry->slot] = entry->next;
+	}
+
+	if (entry->next != nullptr)
+	{
+		entry->next->prev = entry->prev;
+	}
+
+	if (this->_slots[entry->level][entry->slot] == nullptr)
+	{
+		this->_occupied[entry->level] &= ~(1ull << entry->slot);
+	}
+
+	entry->prev = nullptr;
+	entry->next = nullptr;
+	entry->level = -1;
+	entry->slot = -1;
+}
+
+void timer_wheel::advanceTo(uint64_t tick, std::vector<std::shared_ptr<timer_entry>>& due)
+{
+	while (this->_current_tick < tick)
+	{
+		// nothing happens between now and the next occupied slot, skip straight to it
+		uint64_t next = std::min(this->getNextWakeTick(), tick);
+
+		if (next == no_tick || this->_count == 0)
+		{
+			this->_current_tick = tick;
+			return;
+		}
+
+		this->_current_tick = next;
+
+		// cascade the higher levels whose slot starts at this tick, top level first
+		for (int level = levels - 1; level > 0; level--)
+		{
+			int shift = slot_bits * level;
+
+			if ((next & ((1ull << shift) - 1)) != 0)
+			{
+				continue;
+			}
+
+			int slot = (int)((next >> shift) & (slots - 1));
+
+			while (this->_slots[level][slot] != nullptr)
+			{
+				timer_entry* entry = this->_slots[level][slot];
+
+				this->unlink(entry);
+				this->insert(entry);
+			}
+		}
+
+		int slot = (int)(next & (slots - 1));
+
+		while (this->_slots[0][slot] != nullptr)
+		{
+			timer_entry* entry = this->_slots[0][slot];
+
+			this->unlink(entry);
+
+			if (entry->period > 0)
+			{
+				// fixed rate; ticks missed while the thread was late are skipped, not fired in a burst
+				entry->deadline = std::max(entry->deadline + entry->period, next + 1);
+				this->insert(entry);
+
+				due.push_back(entry->self);
+			}
+			else
+			{
+				this->_count--;
+				due.push_back(std::move(entry->self));
+			}
+		}
+	}
+}
+
+uint64_t timer_wheel::getNextWakeTick() const
+{
+	uint64_t next = no_tick;
+
+	for (int level = 0; level < levels; level++)
+	{
+		if (this->_occupied[level] == 0)
+		{
+			continue;
+		}
+
+		int shift = slot_bits * level;
+
+		// first slot after the current one at this level, in the order the wheel reaches them
+		uint64_t base = (this->_current_tick >> shift) + 1;
+		int rotation = (int)(base & (slots - 1));
+		uint64_t rotated = std::rotr(this->_occupied[level], rotation);
+
+		next = std::min(next, (base + (uint64_t)std::countr_zero(rotated)) << shift);
+	}
+
+	return next;
+}
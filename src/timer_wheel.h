@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <vector>
+
+#include "job_function.h"
+
+class timer_wheel;
+
+namespace timer_detail
+{
+	// one pending timer, linked into a wheel slot; keeps itself alive through `self` while linked
+	struct timer_entry
+	{
+		uint64_t deadline = 0;
+		uint64_t period = 0;
+
+		// runs on the timer thread when the timer is due, normally pushing a job into the pool
+		job_function fire;
+
+		timer_entry* prev = nullptr;
+		timer_entry* next = nullptr;
+		int level = -1;
+		int slot = -1;
+
+		std::shared_ptr<timer_entry> self;
+		std::weak_ptr<timer_wheel> wheel;
+	};
+}
+
+// handle of a timer added to a thread_pool; copies refer to the same timer
+class timer_handle
+{
+public:
+	timer_handle() = default;
+	explicit timer_handle(std::weak_ptr<timer_detail::timer_entry> entry);
+
+	// remove the timer in O(1); false when it already fired (one-shot), was cancelled or its pool is gone.
+	// A job the timer already pushed into the pool still runs.
+	bool cancel();
+
+	bool isPending() const;
+
+private:
+	std::weak_ptr<timer_detail::timer_entry> _entry;
+};
+
+// Hierarchical timing wheel with 1ms ticks: 4 levels of 64 slots cover 2^24 ticks (about 4.6 hours),
+// later deadlines wait in the top level and are placed again when their slot comes round. Adding
+// and cancelling are O(1); a timer moves down at most one level per cascade until it is due.
+class timer_wheel : public std::enable_shared_from_this<timer_wheel>
+{
+public:
+	using clock = std::chrono::steady_clock;
+	using tick_duration = std::chrono::milliseconds;
+
+public:
+	timer_wheel();
+	~timer_wheel();
+
+	timer_wheel(const timer_wheel&) = delete;
+	timer_wheel& operator=(const timer_wheel&) = delete;
+
+public:
+	// fire once at deadline, or at deadline and then every period (period > 0)
+	timer_handle add(clock::time_point deadline, tick_duration period, job_function fire);
+	bool cancel(timer_detail::timer_entry* entry);
+
+	// drop every pending timer
+	void clear();
+	size_t size();
+
+	// block until timers are due and run their fire callbacks; false once a stop is requested
+	bool runDue(std::stop_token stop_token);
+
+public:
+	static constexpr int slot_bits = 6;
+	static constexpr int slots = 1 << slot_bits;
+	static constexpr int levels = 4;
+
+private:
+	uint64_t toTick(clock::time_point time) const;
+	clock::time_point toTime(uint64_t tick) const;
+
+	void insert(timer_detail::timer_entry* entry);
+	void unlink(timer_detail::timer_entry* entry);
+	void advanceTo(uint64_t tick, std::vector<std::shared_ptr<timer_detail::timer_entry>>& due);
+	uint64_t getNextWakeTick() const;
+
+private:
+	std::mutex _mutex;
+	std::condition_variable_any _condition;
+
+	clock::time_point _start;
+	uint64_t _current_tick;
+
+	// tick the timer thread sleeps until, UINT64_MAX while it waits without timeout
+	uint64_t _wake_tick;
+	bool _changed;
+
+	timer_detail::timer_entry* _slots[levels][slots];
+	uint64_t _occupied[levels];
+	size_t _count;
+};
@@ -0,0 +1,155 @@
+#include "work_stealing_deque.h"
+
+work_stealing_deque::circular_array::circular_array(int64_t capacity)
+{
+	this->capacity = capacity;
+	this->mask = capacity - 1;
+	this->items = std::make_unique<std::atomic<job*>[]>(capacity);
+}
+
+job* work_stealing_deque::circular_array::get(int64_t index)
+{
+	return this->items[index & this->mask].load(std::memory_order_relaxed);
+}
+
+void work_stealing_deque::circular_array::put(int64_t index, job* item)
+{
+	this->items[index & this->mask].store(item, std::memory_order_relaxed);
+}
+
+work_stealing_deque::work_stealing_deque(job_priority owner_priority, int64_t initial_capacity)
+	: _owner_priority(owner_priority), _top(0), _bottom(0)
+{
+	int64_t capacity = 2;
+	while (capacity < initial_capacity)
+	{
+		capacity <<= 1;
+	}
+
+	this->_arrays.push_back(std::make_unique<circular_array>(capacity));
+	this->_array.store(this->_arrays.back().get(), std::memory_order_relaxed);
+}
+
+work_stealing_deque::~work_stealing_deque()
+{
+	// drop the references of jobs that were never taken
+	while (this->take() != nullptr)
+	{
+	}
+}
+
+void work_stealing_deque::push(std::shared_ptr<job> new_job)
+{
+	int64_t bottom = this->_bottom.load(std::memory_order_relaxed);
+	int64_t top = this->_top.load(std::memory_order_acquire);
+	circular_array* array = this->_array.load(std::memory_order_relaxed);
+
+	if (bottom - top > array->capacity - 1)
+	{
+		array = this->grow(array, bottom, top);
+	}
+
+	// the deque holds the job through a self reference while it is stored as a raw pointer
+	job* raw_job = new_job.get();
+	raw_job->_deque_reference = std::move(new_job);
+
+	array->put(bottom, raw_job);
+	this->_bottom.store(bottom + 1, std::memory_order_release);
+}
+
+std::shared_ptr<job> work_stealing_deque::take()
+{
+	int64_t bottom = this->_bottom.load(std::memory_order_relaxed) - 1;
+	circular_array* array = this->_array.load(std::memory_order_relaxed);
+
+	this->_bottom.store(bottom, std::memory_order_seq_cst);
+	int64_t top = this->_top.load(std::memory_order_seq_cst);
+
+	if (top > bottom)
+	{
+		// empty
+		this->_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	job* raw_job = array->get(bottom);
+
+	if (top == bottom)
+	{
+		// last item: race against thieves for it
+		if (!this->_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			raw_job = nullptr;
+		}
+
+		this->_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	return release(raw_job);
+}
+
+std::shared_ptr<job> work_stealing_deque::steal()
+{
+	int64_t top = this->_top.load(std::memory_order_seq_cst);
+	int64_t bottom = this->_bottom.load(std::memory_order_seq_cst);
+
+	if (top >= bottom)
+	{
+		return nullptr;
+	}
+
+	circular_array* array = this->_array.load(std::memory_order_acquire);
+	job* raw_job = array->get(top);
+
+	if (!this->_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		// lost the race against the owner or another thief
+		return nullptr;
+	}
+
+	return release(raw_job);
+}
+
+int64_t work_stealing_deque::size()
+{
+	int64_t bottom = this->_bottom.load(std::memory_order_relaxed);
+	int64_t top = this->_top.load(std::memory_order_relaxed);
+
+	return bottom > top ? bottom - top : 0;
+}
+
+bool work_stealing_deque::empty()
+{
+	return this->size() <= 0;
+}
+
+job_priority work_stealing_deque::getOwnerPriority()
+{
+	return this->_owner_priority;
+}
+
+work_stealing_deque::circular_array* work_stealing_deque::grow(circular_array* old_array, int64_t bottom, int64_t top)
+{
+	auto new_array = std::make_unique<circular_array>(old_array->capacity * 2);
+
+	for (int64_t i = top; i < bottom; i++)
+	{
+		new_array->put(i, old_array->get(i));
+	}
+
+	circular_array* array = new_array.get();
+	this->_arrays.push_back(std::move(new_array));
+	this->_array.store(array, std::memory_order_release);
+
+	return array;
+}
+
+std::shared_ptr<job> work_stealing_deque::release(job* raw_job)
+{
+	if (raw_job == nullptr)
+	{
+		return nullptr;
+	}
+
+	return std::move(raw_job->_deque_reference);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "job.h"
+
+// Chase-Lev work-stealing deque.
+// Only the owning worker calls push() and take(), which work LIFO on the bottom end so recently
+// spawned jobs run while their data is still hot. Any other worker may call steal(), which takes
+// FIFO from the top end. The backing array grows on demand; retired arrays are kept until the
+// deque is destroyed because a concurrent thief may still be reading them.
+class work_stealing_deque
+{
+public:
+	work_stealing_deque(job_priority owner_priority, int64_t initial_capacity = 256);
+	~work_stealing_deque();
+
+	work_stealing_deque(const work_stealing_deque&) = delete;
+	work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+public:
+	// owner only
+	void push(std::shared_ptr<job> new_job);
+	std::shared_ptr<job> take();
+
+	// any thread
+	std::shared_ptr<job> steal();
+
+	int64_t size();
+	bool empty();
+	job_priority getOwnerPriority();
+
+private:
+	struct circular_array
+	{
+		circular_array(int64_t capacity);
+
+		int64_t capacity;
+		int64_t mask;
+		std::unique_ptr<std::atomic<job*>[]> items;
+
+		job* get(int64_t index);
+		void put(int64_t index, job* item);
+	};
+
+	circular_array* grow(circular_array* old_array, int64_t bottom, int64_t top);
+	static std::shared_ptr<job> release(job* raw_job);
+
+private:
+	job_priority _owner_priority;
+
+	alignas(64) std::atomic<int64_t> _top;
+	alignas(64) std::atomic<int64_t> _bottom;
+	std::atomic<circular_array*> _array;
+
+	std::vector<std::unique_ptr<circular_array>> _arrays;
+};